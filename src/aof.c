@@ -795,27 +795,34 @@ int rewriteListObject(rio *r, robj *key, robj *o) {
             if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list *list = o->ptr;
-        listNode *ln;
-        listIter li;
-
-        listRewind(list,&li);
-        while((ln = listNext(&li))) {
-            robj *eleobj = listNodeValue(ln);
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistIter *li = quicklistGetIterator(o->ptr,AL_START_HEAD);
+        quicklistEntry entry;
 
+        while(quicklistNext(li,&entry)) {
             if (count == 0) {
                 int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
                     REDIS_AOF_REWRITE_ITEMS_PER_CMD : items;
 
-                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) return 0;
-                if (rioWriteBulkString(r,"RPUSH",5) == 0) return 0;
-                if (rioWriteBulkObject(r,key) == 0) return 0;
+                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) goto werr;
+                if (rioWriteBulkString(r,"RPUSH",5) == 0) goto werr;
+                if (rioWriteBulkObject(r,key) == 0) goto werr;
+            }
+            if (entry.value) {
+                if (rioWriteBulkString(r,(char*)entry.value,entry.sz) == 0)
+                    goto werr;
+            } else {
+                if (rioWriteBulkLongLong(r,entry.longval) == 0) goto werr;
             }
-            if (rioWriteBulkObject(r,eleobj) == 0) return 0;
             if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
+        quicklistReleaseIterator(li);
+        return 1;
+
+werr:
+        quicklistReleaseIterator(li);
+        return 0;
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -996,6 +1003,203 @@ int rewriteHashObject(rio *r, robj *key, robj *o) {
     return 1;
 }
 
+/* Write an element of InfQ as a bulk string, without its expire time. */
+static int rioWriteBulkInfqElement(rio *r, robj *o, const void *data, int size) {
+    robj *eleobj;
+    int retval;
+
+    infqElementPayload(o,&data,&size);
+    if (infqElementDecode(o,&data,&size) == REDIS_ERR) return 0;
+    if (o->encoding != REDIS_ENCODING_INFQ || size == 0)
+        return rioWriteBulkString(r,(char*)data,size);
+
+    if ((eleobj = deserialize(data,size)) == NULL) return 0;
+    retval = rioWriteBulkObject(r,eleobj);
+    decrRefCount(eleobj);
+    return retval;
+}
+
+/* Return true if the payload of an InfQ element is named like an option of
+ * QPUSH, so it would be parsed as the option if it came first. */
+static int infqPayloadIsPushOption(robj *o, const void *data, int size) {
+    static const char *opts[] = {"EX","PX","PXAT","PRIORITY",NULL};
+    robj *eleobj;
+    sds s;
+    int j, retval = 0;
+
+    if (infqElementDecode(o,&data,&size) == REDIS_ERR) return 0;
+    if (o->encoding != REDIS_ENCODING_INFQ || size == 0) {
+        s = sdsnewlen(data,size);
+    } else {
+        if ((eleobj = deserialize(data,size)) == NULL) return 0;
+        eleobj = getDecodedObject(eleobj);
+        s = sdsdup(eleobj->ptr);
+        decrRefCount(eleobj);
+    }
+    for (j = 0; opts[j] != NULL; j++)
+        if (!strcasecmp(s,opts[j])) retval = 1;
+    sdsfree(s);
+    return retval;
+}
+
+/* Return the number of elements from 'index' that can be pushed by a single
+ * QPUSH, at most REDIS_AOF_REWRITE_ITEMS_PER_CMD. The elements of an expiring
+ * InfQ have to share the expire time, that is stored in 'expire'. A first
+ * element named like an option of QPUSH is pushed alone. */
+static long rewriteInfqPushLength(robj *key, robj *o, long index, long end,
+                                  mstime_t *expire) {
+    infqIterator it;
+    const void *data;
+    long len = 0, max = end - index;
+    int size, expiring = ((infqObject *)o->ptr)->expiring;
+
+    if (max > REDIS_AOF_REWRITE_ITEMS_PER_CMD)
+        max = REDIS_AOF_REWRITE_ITEMS_PER_CMD;
+    *expire = 0;
+
+    infqInitIterator(&it,o,index,index+max-1);
+    while (len < max) {
+        mstime_t when;
+
+        if (infqNext(&it,&data,&size) != 1) {
+            redisLog(REDIS_WARNING,"Can't fetch element %ld of InfQ %s",
+                it.index-1,(char*)key->ptr);
+            return -1;
+        }
+        when = infqElementPayload(o,&data,&size);
+        if (len == 0 && max > 1 && infqPayloadIsPushOption(o,data,size)) {
+            *expire = when;
+            return 1;
+        }
+        if (!expiring) return max;
+        if (len > 0 && when != *expire) break;
+        *expire = when;
+        len++;
+    }
+    return len;
+}
+
+/* Emit the commands needed to rebuild an InfQ: QCREATE if it has its own
+ * settings, is expiring or has no element, then QPUSH of the elements from
+ * the head to the tail of each lane, with PRIORITY for the lanes above 0 and
+ * PXAT if they expire. The leases of QRESERVE are restored as they are by
+ * QRESTORELEASES, with their ids, deadlines and the next id. The
+ * consumer groups are created at the head and advanced to their offsets once
+ * all of them exist, so no element is popped before every group passed it. */
+int rewriteInfqObject(rio *r, robj *key, robj *o) {
+    infqObject *qo = o->ptr;
+    long qlen = infqLength(o), index = 0, end = 0, len, j;
+    long long count = 0, items = infqLeasesLength(o);
+    infqIterator it;
+    zskiplistNode *ln;
+    mstime_t expire;
+    const void *data;
+    infq_t *lane;
+    dictIterator *di;
+    dictEntry *de;
+    int size, p;
+
+    if (qo->conf_set || qo->expiring || qlen == 0) {
+        if (rioWriteBulkCount(r,'*',2+(qo->expiring ? 1 : 0)+(qo->conf_set ? 8 : 0)) == 0)
+            return 0;
+        if (rioWriteBulkString(r,"QCREATE",7) == 0) return 0;
+        if (rioWriteBulkObject(r,key) == 0) return 0;
+        if (qo->expiring && rioWriteBulkString(r,"EXPIRING",8) == 0) return 0;
+        if (qo->conf_set) {
+            if (rioWriteBulkString(r,"BLOCKSIZE",9) == 0) return 0;
+            if (rioWriteBulkLongLong(r,qo->conf.mem_block_size) == 0) return 0;
+            if (rioWriteBulkString(r,"PUSHBLOCKS",10) == 0) return 0;
+            if (rioWriteBulkLongLong(r,qo->conf.pushq_blocks_num) == 0) return 0;
+            if (rioWriteBulkString(r,"POPBLOCKS",9) == 0) return 0;
+            if (rioWriteBulkLongLong(r,qo->conf.popq_blocks_num) == 0) return 0;
+            if (rioWriteBulkString(r,"DUMPUSAGE",9) == 0) return 0;
+            if (rioWriteBulkDouble(r,qo->conf.dump_blocks_usage) == 0) return 0;
+        }
+    }
+
+    /* The lanes are walked in the order they are served, so 'index' runs
+     * over the elements of the InfQ as seen by infqNext(). */
+    for (p = REDIS_INFQ_PRIORITIES-1; p >= 0 && index < qlen; p--) {
+        if ((lane = infqLaneQueue(o,p)) == NULL) continue;
+        end += infq_size(lane);
+
+        for (; index < end; index += len) {
+            if ((len = rewriteInfqPushLength(key,o,index,end,&expire)) == -1)
+                return 0;
+
+            if (rioWriteBulkCount(r,'*',2+(p ? 2 : 0)+(expire ? 2 : 0)+len) == 0)
+                return 0;
+            if (rioWriteBulkString(r,"QPUSH",5) == 0) return 0;
+            if (rioWriteBulkObject(r,key) == 0) return 0;
+            if (p) {
+                if (rioWriteBulkString(r,"PRIORITY",8) == 0) return 0;
+                if (rioWriteBulkLongLong(r,p) == 0) return 0;
+            }
+            if (expire) {
+                if (rioWriteBulkString(r,"PXAT",4) == 0) return 0;
+                if (rioWriteBulkLongLong(r,expire) == 0) return 0;
+            }
+
+            infqInitIterator(&it,o,index,index+len-1);
+            for (j = 0; j < len; j++) {
+                if (infqNext(&it,&data,&size) != 1) {
+                    redisLog(REDIS_WARNING,"Can't fetch element %ld of InfQ %s",
+                        it.index-1,(char*)key->ptr);
+                    return 0;
+                }
+                if (rioWriteBulkInfqElement(r,o,data,size) == 0) return 0;
+            }
+        }
+    }
+
+    /* The leases in flight keep their ids and deadlines, so that the QACKs
+     * logged after the rewrite still match them. */
+    ln = qo->leases ? qo->leases->zsl->header->level[0].forward : NULL;
+    while (items) {
+        if (count == 0) {
+            int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
+                REDIS_AOF_REWRITE_ITEMS_PER_CMD : items;
+
+            if (rioWriteBulkCount(r,'*',3+cmd_items*3) == 0) return 0;
+            if (rioWriteBulkString(r,"QRESTORELEASES",14) == 0) return 0;
+            if (rioWriteBulkObject(r,key) == 0) return 0;
+            if (rioWriteBulkLongLong(r,qo->leases->next_id) == 0) return 0;
+        }
+
+        infqLease *lease = dictFetchValue(qo->leases->dict,ln->obj);
+        if (rioWriteBulkObject(r,ln->obj) == 0) return 0;
+        if (rioWriteBulkLongLong(r,lease->deadline) == 0) return 0;
+        if (rioWriteBulkObject(r,lease->value) == 0) return 0;
+        ln = ln->level[0].forward;
+        if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+        items--;
+    }
+
+    if (infqGroupsLength(o) == 0) return 1;
+    for (p = 0; p < 2; p++) {
+        di = dictGetIterator(qo->groups);
+        while((de = dictNext(di)) != NULL) {
+            sds name = dictGetKey(de);
+            long long offset = infqGroupOffset(o,de);
+
+            if (p == 1 && offset == 0) continue;
+            if (rioWriteBulkCount(r,'*',p == 0 ? 4 : 5) == 0 ||
+                rioWriteBulkString(r,"QGROUP",6) == 0 ||
+                rioWriteBulkString(r,p == 0 ? "CREATE" : "ADVANCE",
+                                   p == 0 ? 6 : 7) == 0 ||
+                rioWriteBulkObject(r,key) == 0 ||
+                rioWriteBulkString(r,name,sdslen(name)) == 0 ||
+                (p == 1 && rioWriteBulkLongLong(r,offset) == 0))
+            {
+                dictReleaseIterator(di);
+                return 0;
+            }
+        }
+        dictReleaseIterator(di);
+    }
+    return 1;
+}
+
 /* This function is called by the child rewriting the AOF file to read
  * the difference accumulated from the parent into a buffer, that is
  * concatenated at the end of the rewrite. */
@@ -1088,6 +1292,8 @@ int rewriteAppendOnlyFile(char *filename) {
                 if (rewriteSortedSetObject(&aof,&key,o) == 0) goto werr;
             } else if (o->type == REDIS_HASH) {
                 if (rewriteHashObject(&aof,&key,o) == 0) goto werr;
+            } else if (o->type == REDIS_INFQ) {
+                if (rewriteInfqObject(&aof,&key,o) == 0) goto werr;
             } else {
                 redisPanic("Unknown object type");
             }
@@ -1266,12 +1472,40 @@ void aofClosePipes(void) {
  *    finally will rename(2) the temp file in the actual file name.
  *    The the new file is reopened as the new append only file. Profit!
  */
+/* Continue the unlinkers of InfQs suspended for the AOF rewrite, or leave
+ * them to the running BGSAVE. */
+void continueInfqUnlinkerSuspendedByAof(void) {
+    if (server.infq_unlinker_suspend_type != REDIS_INFQ_UNLINKER_SUSPEND_AOF) return;
+
+    if (server.rdb_child_pid != -1) {
+        server.infq_unlinker_suspend_type = REDIS_INFQ_UNLINKER_SUSPEND_RDB;
+        return;
+    }
+    if (iterateInfQ(iter_infq_continue_unlinker, NULL, NULL, 1) == REDIS_ERR) {
+        redisLog(REDIS_WARNING, "failed to continue unlinker");
+    }
+    server.infq_unlinker_suspend_type = REDIS_INFQ_UNLINKER_SUSPEND_NONE;
+}
+
 int rewriteAppendOnlyFileBackground(void) {
     pid_t childpid;
     long long start;
 
     if (server.aof_child_pid != -1) return REDIS_ERR;
     if (aofCreatePipes() != REDIS_OK) return REDIS_ERR;
+
+    // the child reads the file blocks of InfQs, suspend the unlinker
+    if (server.infq_unlinker_suspend_type == REDIS_INFQ_UNLINKER_SUSPEND_NONE &&
+            dictSize(server.infq_keys) > 0) {
+        if (iterateInfQ(iter_infq_suspend_callback, NULL, NULL, 1) == REDIS_ERR) {
+            redisLog(REDIS_WARNING, "failed to suspend infq");
+            iterateInfQ(iter_infq_continue_unlinker, NULL, NULL, 0);
+            aofClosePipes();
+            return REDIS_ERR;
+        }
+        server.infq_unlinker_suspend_type = REDIS_INFQ_UNLINKER_SUSPEND_AOF;
+    }
+
     start = ustime();
     if ((childpid = fork()) == 0) {
         char tmpfile[256];
@@ -1301,6 +1535,7 @@ int rewriteAppendOnlyFileBackground(void) {
             redisLog(REDIS_WARNING,
                 "Can't rewrite append only file in background: fork: %s",
                 strerror(errno));
+            continueInfqUnlinkerSuspendedByAof();
             return REDIS_ERR;
         }
         redisLog(REDIS_NOTICE,
@@ -1498,6 +1733,7 @@ cleanup:
     aofRewriteBufferReset();
     aofRemoveTempFile(server.aof_child_pid);
     server.aof_child_pid = -1;
+    continueInfqUnlinkerSuspendedByAof();
     server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
     server.aof_rewrite_time_start = -1;
     /* Schedule a new rewrite if we are waiting for it to switch the AOF ON. */
@@ -129,7 +129,7 @@ void processUnblockedClients(void) {
 /* Unblock a client calling the right function depending on the kind
  * of operation the client is blocking for. */
 void unblockClient(redisClient *c) {
-    if (c->btype == REDIS_BLOCKED_LIST) {
+    if (c->btype == REDIS_BLOCKED_LIST || c->btype == REDIS_BLOCKED_INFQ) {
         unblockClientWaitingData(c);
     } else if (c->btype == REDIS_BLOCKED_WAIT) {
         unblockClientWaitingReplicas(c);
@@ -148,7 +148,7 @@ void unblockClient(redisClient *c) {
 /* This function gets called when a blocked client timed out in order to
  * send it a reply of some kind. */
 void replyToBlockedClientTimedOut(redisClient *c) {
-    if (c->btype == REDIS_BLOCKED_LIST) {
+    if (c->btype == REDIS_BLOCKED_LIST || c->btype == REDIS_BLOCKED_INFQ) {
         addReply(c,shared.nullmultibulk);
     } else if (c->btype == REDIS_BLOCKED_WAIT) {
         addReplyLongLong(c,replicationCountAcksByOffset(c->bpop.reploffset));
@@ -4969,7 +4969,8 @@ void clusterRedirectClient(redisClient *c, clusterNode *n, int hashslot, int err
  * longer handles, the client is sent a redirection error, and the function
  * returns 1. Otherwise 0 is returned and no operation is performed. */
 int clusterRedirectBlockedClientIfNeeded(redisClient *c) {
-    if (c->flags & REDIS_BLOCKED && c->btype == REDIS_BLOCKED_LIST) {
+    if (c->flags & REDIS_BLOCKED &&
+        (c->btype == REDIS_BLOCKED_LIST || c->btype == REDIS_BLOCKED_INFQ)) {
         dictEntry *de;
         dictIterator *di;
 
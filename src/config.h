@@ -103,6 +103,13 @@
 #endif
 #endif
 
+/* Test for sendfile() and posix_fadvise() on Linux, used to send files to
+ * slaves. */
+#ifdef __linux__
+#define HAVE_SENDFILE 1
+#define HAVE_FADVISE 1
+#endif
+
 #ifdef HAVE_SYNC_FILE_RANGE
 #define rdb_fsync_range(fd,off,size) sync_file_range(fd,off,size,SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE)
 #else
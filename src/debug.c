@@ -287,6 +287,7 @@ void debugCommand(redisClient *c) {
         dictEntry *de;
         robj *val;
         char *strenc;
+        char extra[128] = {0};
 
         if ((de = dictFind(c->db->dict,c->argv[2]->ptr)) == NULL) {
             addReply(c,shared.nokeyerr);
@@ -295,13 +296,31 @@ void debugCommand(redisClient *c) {
         val = dictGetVal(de);
         strenc = strEncoding(val->encoding);
 
+        if (val->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist *ql = val->ptr;
+            quicklistNode *node;
+            unsigned long compressed = 0, ziplist_max = 0;
+            unsigned long long used = 0;
+
+            for (node = ql->head; node; node = node->next) {
+                if (quicklistNodeIsCompressed(node)) compressed++;
+                if (node->sz > ziplist_max) ziplist_max = node->sz;
+                used += node->sz;
+            }
+            snprintf(extra,sizeof(extra),
+                " ql_nodes:%u ql_avg_node:%.2f ql_ziplist_max:%lu"
+                " ql_compressed:%lu ql_uncompressed_size:%llu",
+                ql->len, ql->len ? (double)ql->count/ql->len : 0,
+                ziplist_max, compressed, used);
+        }
+
         addReplyStatusFormat(c,
             "Value at:%p refcount:%d "
             "encoding:%s serializedlength:%lld "
-            "lru:%d lru_seconds_idle:%llu",
+            "lru:%d lru_seconds_idle:%llu%s",
             (void*)val, val->refcount,
             strenc, (long long) rdbSavedObjectLen(val),
-            val->lru, estimateObjectIdleTime(val)/1000);
+            val->lru, estimateObjectIdleTime(val)/1000, extra);
     } else if (!strcasecmp(c->argv[1]->ptr,"sdslen") && c->argc == 3) {
         dictEntry *de;
         robj *val;
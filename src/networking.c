@@ -32,6 +32,20 @@
 #include <math.h>
 
 static void setProtocolError(redisClient *c, int pos);
+static int postponeClientRead(redisClient *c);
+
+/* Counters updated both by the main thread and by the I/O threads. */
+#if defined(__ATOMIC_RELAXED)
+#define ioAtomicIncr(var,count) __atomic_add_fetch(&var,(count),__ATOMIC_RELAXED)
+#define ioAtomicGet(var) __atomic_load_n(&var,__ATOMIC_SEQ_CST)
+#define ioAtomicSet(var,value) __atomic_store_n(&var,(value),__ATOMIC_SEQ_CST)
+#else
+#define ioAtomicIncr(var,count) __sync_add_and_fetch(&var,(count))
+#define ioAtomicGet(var) __sync_add_and_fetch(&var,0)
+#define ioAtomicSet(var,value) do { \
+    __sync_synchronize(); var = (value); __sync_synchronize(); \
+} while(0)
+#endif
 
 /* To evaluate the output buffer size of a client we need to get size of
  * allocated objects, however we can't used zmalloc_size() directly on sds
@@ -105,8 +119,10 @@ redisClient *createClient(int fd) {
     c->repl_ack_off = 0;
     c->repl_ack_time = 0;
     c->slave_listening_port = 0;
+    c->slave_capa = 0;
     c->reply = listCreate();
     c->reply_bytes = 0;
+    c->reply_written = 0;
     c->obuf_soft_limit_reached_time = 0;
     listSetFreeMethod(c->reply,decrRefCountVoid);
     listSetDupMethod(c->reply,dupClientReplyValue);
@@ -126,7 +142,12 @@ redisClient *createClient(int fd) {
     c->repl_infq_file_suffix = -1;
     c->repl_infq_keys_iter = NULL;
     c->repl_infq_cur_key = NULL;
+    c->repl_infq_cur_priority = 0;
     c->repl_infq_files = NULL;
+    c->repl_infq_held = NULL;
+    c->repl_infq_checksum = 0;
+    c->repl_infq_held_file = 0;
+    c->repl_infq_file = NULL;
     listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
     listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
     if (fd != -1) listAddNodeTail(server.clients,c);
@@ -134,22 +155,38 @@ redisClient *createClient(int fd) {
     return c;
 }
 
+/* Return true if the client has replies not yet written to its socket. */
+int clientHasPendingReplies(redisClient *c) {
+    return c->bufpos || listLength(c->reply);
+}
+
+/* Schedule the client to have its replies written. Instead of installing
+ * the write handler, that costs two epoll_ctl() calls per reply, the client
+ * is queued in server.clients_pending_write: the replies are written before
+ * re-entering the event loop, and the write handler is only installed if
+ * the socket can't take them all, see handleClientsWithPendingWrites(). */
+static void clientInstallWriteHandler(redisClient *c) {
+    if (!(c->flags & REDIS_PENDING_WRITE)) {
+        c->flags |= REDIS_PENDING_WRITE;
+        listAddNodeHead(server.clients_pending_write,c);
+    }
+}
+
 /* This function is called every time we are going to transmit new data
  * to the client. The behavior is the following:
  *
  * If the client should receive new data (normal clients will) the function
- * returns REDIS_OK, and make sure to install the write handler in our event
- * loop so that when the socket is writable new data gets written.
+ * returns REDIS_OK, and make sure to queue the client in the list of pending
+ * writes, so that new data gets written before re-entering the event loop.
  *
  * If the client should not receive new data, because it is a fake client
- * (used to load AOF in memory), a master or because the setup of the write
- * handler failed, the function returns REDIS_ERR.
+ * (used to load AOF in memory) or a master, the function returns REDIS_ERR.
  *
- * The function may return REDIS_OK without actually installing the write
- * event handler in the following cases:
+ * The function may return REDIS_OK without actually queueing the client in
+ * the following cases:
  *
- * 1) The event handler should already be installed since the output buffer
- *    already contained something.
+ * 1) The client should already be queued, or have the write handler
+ *    installed, since the output buffer already contained something.
  * 2) The client is a slave but not yet online, so we want to just accumulate
  *    writes in the buffer but not actually sending them yet.
  *
@@ -168,19 +205,17 @@ int prepareClientToWrite(redisClient *c) {
 
     if (c->fd <= 0) return REDIS_ERR; /* Fake client for AOF loading. */
 
-    /* Only install the handler if not already installed and, in case of
+    /* Replies queued by an I/O thread while parsing the query (protocol
+     * errors) are scheduled by the main thread once the read is done. */
+    if (c->flags & REDIS_PENDING_READ) return REDIS_OK;
+
+    /* Only schedule the write if not already scheduled and, in case of
      * slaves, if the client can actually receive writes. */
-    if (c->bufpos == 0 && listLength(c->reply) == 0 &&
+    if (!clientHasPendingReplies(c) &&
         (c->replstate == REDIS_REPL_NONE ||
          (c->replstate == REDIS_REPL_ONLINE && !c->repl_put_online_on_ack)))
     {
-        /* Try to install the write handler. */
-        if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
-                sendReplyToClient, c) == AE_ERR)
-        {
-            freeClientAsync(c);
-            return REDIS_ERR;
-        }
+        clientInstallWriteHandler(c);
     }
 
     /* Authorize the caller to queue in the output buffer of this client. */
@@ -758,12 +793,27 @@ void freeClient(redisClient *c) {
         listDelNode(server.unblocked_clients,ln);
     }
 
+    /* Remove the client from the lists handled by the I/O threads. */
+    if (c->flags & REDIS_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+    }
+    if (c->flags & REDIS_PENDING_WRITE) {
+        ln = listSearchKey(server.clients_pending_write,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_write,ln);
+    }
+
     /* Master/slave cleanup Case 1:
      * we lost the connection with a slave. */
     if (c->flags & REDIS_SLAVE) {
         if (c->replstate == REDIS_REPL_SEND_BULK) {
             if (c->repldbfd != -1) close(c->repldbfd);
             if (c->replpreamble) sdsfree(c->replpreamble);
+        } else if (c->replstate == REDIS_REPL_SEND_INFQ) {
+            closeInfQFileForSlave(c);
+            if (c->replpreamble) sdsfree(c->replpreamble);
         }
         list *l = (c->flags & REDIS_MONITOR) ? server.monitors : server.slaves;
         ln = listSearchKey(l,c);
@@ -797,6 +847,7 @@ void freeClient(redisClient *c) {
     sdsfree(c->peerid);
 
     if (c->repl_infq_file_iter != NULL) listReleaseIterator(c->repl_infq_file_iter);
+    if (c->repl_infq_held != NULL) dictRelease(c->repl_infq_held);
     zfree(c);
 }
 
@@ -821,50 +872,115 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
-void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    redisClient *c = privdata;
-    int nwritten = 0, totwritten = 0, objlen;
-    size_t objmem;
+/* Max number of buffers written by a single writev() call. */
+#ifdef IOV_MAX
+#define REDIS_IOV_MAX IOV_MAX
+#else
+#define REDIS_IOV_MAX 1024
+#endif
+
+/* Write the pending replies of the client to its socket. Returns REDIS_ERR
+ * if the client must be freed, either because of a write error or since
+ * the whole reply of a REDIS_CLOSE_AFTER_REPLY client was sent: freeing it
+ * is up to the caller, as this function is also called by the I/O threads.
+ *
+ * The static buffer and the objects of the reply list are gathered and sent
+ * with a single writev() call, up to REDIS_IOV_MAX buffers at a time, so a
+ * multi bulk reply made of many small objects costs a few syscalls.
+ *
+ * When 'handler_installed' is set the writable event of the client is
+ * removed once there is nothing left to write.
+ *
+ * When 'keep_written' is set the objects written are left at the head of
+ * the reply list, counted by c->reply_written, instead of being released:
+ * this is how the I/O threads write, as the objects may be shared with
+ * clients served by other threads and the refcount is not atomic. The main
+ * thread releases them with releaseWrittenReplies() once the threads are
+ * done. */
+static int _writeToClient(int fd, redisClient *c, int handler_installed,
+                          int keep_written)
+{
+    struct iovec iov[REDIS_IOV_MAX];
+    int nwritten = 0, totwritten = 0;
+    size_t objlen, objmem;
+    unsigned long j;
+    listNode *head, *ln;
     robj *o;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
 
-    while(c->bufpos > 0 || listLength(c->reply)) {
+    /* The first object of the list not written yet. */
+    head = listFirst(c->reply);
+    for (j = 0; j < c->reply_written; j++) head = listNextNode(head);
+
+    while(c->bufpos > 0 || head) {
+        int iovcnt = 0;
+        size_t iovlen = 0, sentlen = c->sentlen;
+
+        /* Gather the static buffer, then the objects of the reply list. The
+         * first buffer starts after what was already sent of it. */
         if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
+            iov[iovcnt].iov_base = c->buf+sentlen;
+            iov[iovcnt].iov_len = c->bufpos-sentlen;
+            iovlen += iov[iovcnt++].iov_len;
+            sentlen = 0;
+        }
+        for (ln = head; ln && iovcnt < REDIS_IOV_MAX &&
+             iovlen < REDIS_MAX_WRITE_PER_EVENT; ln = listNextNode(ln))
+        {
+            o = listNodeValue(ln);
+            objlen = sdslen(o->ptr);
+            if (objlen == 0) continue;
+            iov[iovcnt].iov_base = ((char*)o->ptr)+sentlen;
+            iov[iovcnt].iov_len = objlen-sentlen;
+            iovlen += iov[iovcnt++].iov_len;
+            sentlen = 0;
+        }
+
+        if (iovcnt == 0) {
+            nwritten = 0;
+        } else {
+            nwritten = writev(fd,iov,iovcnt);
             if (nwritten <= 0) break;
-            c->sentlen += nwritten;
             totwritten += nwritten;
+        }
+
+        /* Consume what was written, that may end in the middle of any of
+         * the buffers. Empty objects are just removed. */
+        sentlen = nwritten;
+        if (c->bufpos > 0) {
+            size_t left = c->bufpos-c->sentlen;
 
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if (c->sentlen == c->bufpos) {
+            if (sentlen < left) {
+                c->sentlen += sentlen;
+                sentlen = 0;
+            } else {
+                sentlen -= left;
                 c->bufpos = 0;
                 c->sentlen = 0;
             }
-        } else {
-            o = listNodeValue(listFirst(c->reply));
+        }
+        while(c->bufpos == 0 && head) {
+            o = listNodeValue(head);
             objlen = sdslen(o->ptr);
+            if (objlen != 0 && sentlen == 0) break;
             objmem = getStringObjectSdsUsedMemory(o);
-
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->reply_bytes -= objmem;
-                continue;
+            if (sentlen < objlen-c->sentlen) {
+                c->sentlen += sentlen;
+                break;
             }
+            sentlen -= objlen-c->sentlen;
+            ln = head;
+            head = listNextNode(head);
+            if (keep_written)
+                c->reply_written++;
+            else
+                listDelNode(c->reply,ln);
+            c->sentlen = 0;
+            c->reply_bytes -= objmem;
+        }
 
-            nwritten = write(fd, ((char*)o->ptr)+c->sentlen,objlen-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+        /* A short write means the socket buffer is full. */
+        if ((size_t)nwritten < iovlen) break;
 
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objmem;
-            }
-        }
         /* Note that we avoid to send more than REDIS_MAX_WRITE_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
          * other clients as well, even if a very large request comes from
@@ -873,19 +989,18 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
          *
          * However if we are over the maxmemory limit we ignore that and
          * just deliver as much data as it is possible to deliver. */
-        server.stat_net_output_bytes += totwritten;
         if (totwritten > REDIS_MAX_WRITE_PER_EVENT &&
             (server.maxmemory == 0 ||
              zmalloc_used_memory() < server.maxmemory)) break;
     }
+    ioAtomicIncr(server.stat_net_output_bytes,totwritten);
     if (nwritten == -1) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
             redisLog(REDIS_VERBOSE,
                 "Error writing to client: %s", strerror(errno));
-            freeClient(c);
-            return;
+            return REDIS_ERR;
         }
     }
     if (totwritten > 0) {
@@ -895,15 +1010,38 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
          * We just rely on data / pings received for timeout detection. */
         if (!(c->flags & REDIS_MASTER)) c->lastinteraction = server.unixtime;
     }
-    if (c->bufpos == 0 && listLength(c->reply) == 0) {
+    if (c->bufpos == 0 && head == NULL) {
         c->sentlen = 0;
-        aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+        if (handler_installed) aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
 
         /* Close connection after entire reply has been sent. */
-        if (c->flags & REDIS_CLOSE_AFTER_REPLY) freeClient(c);
+        if (c->flags & REDIS_CLOSE_AFTER_REPLY) return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+int writeToClient(int fd, redisClient *c, int handler_installed) {
+    return _writeToClient(fd,c,handler_installed,0);
+}
+
+/* Release the objects of the reply list left by _writeToClient() with
+ * 'keep_written' set. */
+static void releaseWrittenReplies(redisClient *c) {
+    while(c->reply_written) {
+        listDelNode(c->reply,listFirst(c->reply));
+        c->reply_written--;
     }
 }
 
+/* Write event handler. Just send data to the client. */
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+
+    if (writeToClient(fd,c,1) == REDIS_ERR) freeClient(c);
+}
+
 /* resetClient prepare the client to process the next command */
 void resetClient(redisClient *c) {
     redisCommandProc *prevcmd = c->cmd ? c->cmd->proc : NULL;
@@ -979,15 +1117,24 @@ int processInlineBuffer(redisClient *c) {
     return REDIS_OK;
 }
 
-/* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
-static void setProtocolError(redisClient *c, int pos) {
+static void logProtocolError(redisClient *c) {
     if (server.verbosity >= REDIS_VERBOSE) {
         sds client = catClientInfoString(sdsempty(),c);
         redisLog(REDIS_VERBOSE,
             "Protocol error from client: %s", client);
         sdsfree(client);
     }
+}
+
+/* Helper function. Trims query buffer to make the function that processes
+ * multi bulk requests idempotent. */
+static void setProtocolError(redisClient *c, int pos) {
+    /* The client info can't be read by the I/O threads: the error of the
+     * clients they parse is logged by the main thread once they are done. */
+    if (c->flags & REDIS_PENDING_READ)
+        c->flags |= REDIS_PROTOCOL_ERROR;
+    else
+        logProtocolError(c);
     c->flags |= REDIS_CLOSE_AFTER_REPLY;
     sdsrange(c->querybuf,pos,-1);
 }
@@ -1130,6 +1277,28 @@ int processMultibulkBuffer(redisClient *c) {
     return REDIS_ERR;
 }
 
+/* Parse the next command of the query buffer into the client argument
+ * vector. Returns REDIS_OK once a full command is available. */
+static int parseQueryBuffer(redisClient *c) {
+    /* Determine request type when unknown. */
+    if (!c->reqtype) {
+        if (c->querybuf[0] == '*') {
+            c->reqtype = REDIS_REQ_MULTIBULK;
+        } else {
+            c->reqtype = REDIS_REQ_INLINE;
+        }
+    }
+
+    if (c->reqtype == REDIS_REQ_INLINE) {
+        return processInlineBuffer(c);
+    } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
+        return processMultibulkBuffer(c);
+    } else {
+        redisPanic("Unknown request type");
+        return REDIS_ERR;
+    }
+}
+
 void processInputBuffer(redisClient *c) {
     /* Keep processing while there is something in the input buffer */
     while(sdslen(c->querybuf)) {
@@ -1144,22 +1313,7 @@ void processInputBuffer(redisClient *c) {
          * this flag has been set (i.e. don't process more commands). */
         if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
 
-        /* Determine request type when unknown. */
-        if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
-                c->reqtype = REDIS_REQ_MULTIBULK;
-            } else {
-                c->reqtype = REDIS_REQ_INLINE;
-            }
-        }
-
-        if (c->reqtype == REDIS_REQ_INLINE) {
-            if (processInlineBuffer(c) != REDIS_OK) break;
-        } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != REDIS_OK) break;
-        } else {
-            redisPanic("Unknown request type");
-        }
+        if (parseQueryBuffer(c) != REDIS_OK) break;
 
         /* Multibulk processing could see a <= 0 length. */
         if (c->argc == 0) {
@@ -1172,14 +1326,23 @@ void processInputBuffer(redisClient *c) {
     }
 }
 
-void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    redisClient *c = (redisClient*) privdata;
+static void logQueryBufLimitReached(redisClient *c) {
+    sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
+
+    bytes = sdscatrepr(bytes,c->querybuf,64);
+    redisLog(REDIS_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
+    sdsfree(ci);
+    sdsfree(bytes);
+}
+
+/* Read what is available on the client socket into its query buffer.
+ * Returns the number of bytes read, 0 if there was nothing to read, or -1
+ * if the client must be freed, that is up to the caller: this function is
+ * also called by the I/O threads, where clients can't be freed. */
+static int readClientSocket(redisClient *c) {
     int nread, readlen;
     size_t qblen;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
 
-    server.current_client = c;
     readlen = REDIS_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1198,40 +1361,49 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
-    nread = read(fd, c->querybuf+qblen, readlen);
+    nread = read(c->fd, c->querybuf+qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {
-            nread = 0;
+            return 0;
         } else {
             redisLog(REDIS_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
-            return;
+            return -1;
         }
     } else if (nread == 0) {
         redisLog(REDIS_VERBOSE, "Client closed connection");
-        freeClient(c);
-        return;
-    }
-    if (nread) {
-        sdsIncrLen(c->querybuf,nread);
-        c->lastinteraction = server.unixtime;
-        if (c->flags & REDIS_MASTER) c->reploff += nread;
-        server.stat_net_input_bytes += nread;
-    } else {
-        server.current_client = NULL;
-        return;
+        return -1;
     }
+    sdsIncrLen(c->querybuf,nread);
+    c->lastinteraction = server.unixtime;
+    if (c->flags & REDIS_MASTER) c->reploff += nread;
+    ioAtomicIncr(server.stat_net_input_bytes,nread);
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
-        sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
+        /* Logged by the main thread for the clients read by the I/O
+         * threads, that can't read the client info. */
+        if (!(c->flags & REDIS_PENDING_READ)) logQueryBufLimitReached(c);
+        return -1;
+    }
+    return nread;
+}
+
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = (redisClient*) privdata;
+    int nread;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+
+    /* With threaded reads the socket is read by the I/O threads, see
+     * handleClientsWithPendingReadsUsingThreads(). */
+    if (postponeClientRead(c)) return;
 
-        bytes = sdscatrepr(bytes,c->querybuf,64);
-        redisLog(REDIS_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
-        sdsfree(ci);
-        sdsfree(bytes);
+    server.current_client = c;
+    nread = readClientSocket(c);
+    if (nread == -1) {
         freeClient(c);
         return;
     }
-    processInputBuffer(c);
+    if (nread) processInputBuffer(c);
     server.current_client = NULL;
 }
 
@@ -1687,12 +1859,15 @@ void flushSlavesOutputBuffers(void) {
         redisClient *slave = listNodeValue(ln);
         int events;
 
+        /* The slave may be waiting in the list of pending writes rather
+         * than having the write handler installed. */
         events = aeGetFileEvents(server.el,slave->fd);
-        if (events & AE_WRITABLE &&
-            slave->replstate == REDIS_REPL_ONLINE &&
-            listLength(slave->reply))
+        if (slave->replstate == REDIS_REPL_ONLINE &&
+            !slave->repl_put_online_on_ack &&
+            clientHasPendingReplies(slave) &&
+            writeToClient(slave->fd,slave,events & AE_WRITABLE) == REDIS_ERR)
         {
-            sendReplyToClient(server.el,slave->fd,slave,0);
+            freeClient(slave);
         }
     }
 }
@@ -1760,13 +1935,332 @@ int clientsArePaused(void) {
  * write, close sequence needed to serve a client.
  *
  * The function returns the total number of events processed. */
+static int ProcessingEventsWhileBlocked = 0;
+
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    /* beforeSleep() is not called here: serve the reads in this thread and
+     * flush the replies before returning. */
+    ProcessingEventsWhileBlocked = 1;
     while (iterations--) {
         int events = aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
+        events += handleClientsWithPendingWrites();
         if (!events) break;
         count += events;
     }
+    ProcessingEventsWhileBlocked = 0;
     return count;
 }
+
+
+/* ========================== Threaded I/O ================================= */
+
+/* With io-threads > 1 the replies accumulated during an event loop iteration
+ * are written, and optionally the sockets of the clients ready to be read
+ * are read and their first command parsed, by a pool of I/O threads. The
+ * main thread fans the clients out from beforeSleep() and waits for the
+ * threads to be done: commands are always executed by the main thread, so
+ * the threads only ever touch the buffers of the clients assigned to them.
+ *
+ * The threads spin waiting for work, so they are only started when there
+ * are enough pending writes to make it worth, and parked on their mutex
+ * otherwise, in which case the main thread does all the I/O. */
+
+#define IO_THREADS_OP_READ 0
+#define IO_THREADS_OP_WRITE 1
+
+static pthread_t io_threads[REDIS_IO_THREADS_MAX_NUM];
+static pthread_mutex_t io_threads_mutex[REDIS_IO_THREADS_MAX_NUM];
+static unsigned long io_threads_pending[REDIS_IO_THREADS_MAX_NUM];
+static list *io_threads_list[REDIS_IO_THREADS_MAX_NUM];
+static int io_threads_op;
+
+/* Read from the client socket and parse the first command of the query
+ * buffer, that the main thread will execute. Clients the main thread would
+ * not process right now are just read, and so are the clients with pending
+ * replies: this way the protocol errors replied by the thread always go in
+ * an empty output buffer, and the reply list is only used by the main
+ * thread. */
+static void ioThreadRead(redisClient *c) {
+    if (readClientSocket(c) == -1) {
+        c->flags |= REDIS_IO_FREE;
+        return;
+    }
+    if (sdslen(c->querybuf) == 0 || server.clients_paused ||
+        c->flags & (REDIS_BLOCKED|REDIS_CLOSE_AFTER_REPLY) ||
+        clientHasPendingReplies(c)) return;
+    if (parseQueryBuffer(c) == REDIS_OK) {
+        if (c->argc == 0)
+            resetClient(c);
+        else
+            c->flags |= REDIS_PENDING_COMMAND;
+    }
+}
+
+static void ioThreadWrite(redisClient *c) {
+    if (_writeToClient(c->fd,c,0,1) == REDIS_ERR) c->flags |= REDIS_IO_FREE;
+}
+
+static void ioThreadProcessList(int id) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(io_threads_list[id],&li);
+    while((ln = listNext(&li))) {
+        redisClient *c = listNodeValue(ln);
+
+        if (io_threads_op == IO_THREADS_OP_WRITE)
+            ioThreadWrite(c);
+        else
+            ioThreadRead(c);
+    }
+    while(listLength(io_threads_list[id]))
+        listDelNode(io_threads_list[id],listFirst(io_threads_list[id]));
+}
+
+void *IOThreadMain(void *arg) {
+    unsigned long id = (unsigned long) arg;
+    sigset_t sigset;
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        redisLog(REDIS_WARNING,
+            "Warning: can't mask SIGALRM in I/O thread: %s", strerror(errno));
+
+    while(1) {
+        int j;
+
+        /* Wait for work, spinning for a while before checking if the main
+         * thread parked us. */
+        for (j = 0; j < 1000000; j++) {
+            if (ioAtomicGet(io_threads_pending[id]) != 0) break;
+        }
+        if (ioAtomicGet(io_threads_pending[id]) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        ioThreadProcessList(id);
+        ioAtomicSet(io_threads_pending[id],0);
+    }
+    return NULL;
+}
+
+/* Spawn the I/O threads, parked until startThreadedIO() is called. The main
+ * thread uses the slot 0 of the per thread state. */
+void initThreadedIO(void) {
+    pthread_attr_t attr;
+    size_t stacksize;
+    unsigned long j;
+
+    server.io_threads_active = 0;
+    if (server.io_threads_num == 1) return;
+
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr,&stacksize);
+    if (!stacksize) stacksize = 1; /* The world is full of Solaris Fixes */
+    while (stacksize < REDIS_THREAD_STACK_SIZE) stacksize *= 2;
+    pthread_attr_setstacksize(&attr, stacksize);
+
+    for (j = 0; j < (unsigned long)server.io_threads_num; j++) {
+        io_threads_list[j] = listCreate();
+        io_threads_pending[j] = 0;
+        if (j == 0) continue;
+        pthread_mutex_init(&io_threads_mutex[j],NULL);
+        pthread_mutex_lock(&io_threads_mutex[j]);
+        if (pthread_create(&io_threads[j],&attr,IOThreadMain,(void*)j) != 0) {
+            redisLog(REDIS_WARNING,"Fatal: Can't initialize the I/O threads.");
+            exit(1);
+        }
+    }
+}
+
+static void startThreadedIO(void) {
+    int j;
+
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    server.io_threads_active = 1;
+}
+
+static void stopThreadedIO(void) {
+    int j;
+
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    server.io_threads_active = 0;
+}
+
+/* Stop the threads when there are too few pending writes to keep them busy.
+ * Returns 1 if the I/O has to be done by the main thread alone. */
+static int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    if (server.io_threads_num == 1) return 1;
+    if (pending < server.io_threads_num*2) {
+        if (server.io_threads_active) stopThreadedIO();
+        return 1;
+    }
+    return 0;
+}
+
+/* Assign the clients of 'l' to the I/O threads, run 'op' on them and wait
+ * for all the threads to be done. Masters and slaves are always served by
+ * the main thread. */
+static void runThreadedIO(list *l, int op) {
+    listIter li;
+    listNode *ln;
+    int j, item = 0;
+
+    listRewind(l,&li);
+    while((ln = listNext(&li))) {
+        redisClient *c = listNodeValue(ln);
+        int target = 0;
+
+        if (!(c->flags & (REDIS_MASTER|REDIS_SLAVE)))
+            target = item++ % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target],c);
+    }
+
+    io_threads_op = op;
+    for (j = 1; j < server.io_threads_num; j++) {
+        unsigned long count = listLength(io_threads_list[j]);
+        ioAtomicSet(io_threads_pending[j],count);
+    }
+    ioThreadProcessList(0);
+    while(1) {
+        unsigned long pending = 0;
+        for (j = 1; j < server.io_threads_num; j++)
+            pending += ioAtomicGet(io_threads_pending[j]);
+        if (pending == 0) break;
+    }
+}
+
+/* Install the write handler for the clients whose replies were not written
+ * entirely to the socket, that would block. */
+static void installPendingWriteHandler(redisClient *c) {
+    if (!clientHasPendingReplies(c)) return;
+    if (aeCreateFileEvent(server.el,c->fd,AE_WRITABLE,
+            sendReplyToClient,c) == AE_ERR) freeClientAsync(c);
+}
+
+/* Write the replies of the clients in server.clients_pending_write from the
+ * main thread, leaving to the write handler what the sockets don't accept.
+ * Called by beforeSleep() when the I/O threads are not running. Returns the
+ * number of clients processed. */
+int handleClientsWithPendingWrites(void) {
+    int processed = listLength(server.clients_pending_write);
+
+    while(listLength(server.clients_pending_write)) {
+        listNode *ln = listFirst(server.clients_pending_write);
+        redisClient *c = listNodeValue(ln);
+
+        c->flags &= ~REDIS_PENDING_WRITE;
+        listDelNode(server.clients_pending_write,ln);
+        if (writeToClient(c->fd,c,0) == REDIS_ERR) {
+            freeClient(c);
+            continue;
+        }
+        installPendingWriteHandler(c);
+    }
+    return processed;
+}
+
+/* Write the pending replies with the I/O threads, if there are enough of
+ * them to keep the threads busy, otherwise from the main thread alone. */
+int handleClientsWithPendingWritesUsingThreads(void) {
+    int processed = listLength(server.clients_pending_write);
+
+    if (processed == 0) return 0;
+    if (stopThreadedIOIfNeeded()) return handleClientsWithPendingWrites();
+    if (!server.io_threads_active) startThreadedIO();
+
+    runThreadedIO(server.clients_pending_write,IO_THREADS_OP_WRITE);
+    while(listLength(server.clients_pending_write)) {
+        listNode *ln = listFirst(server.clients_pending_write);
+        redisClient *c = listNodeValue(ln);
+
+        c->flags &= ~REDIS_PENDING_WRITE;
+        listDelNode(server.clients_pending_write,ln);
+        releaseWrittenReplies(c);
+        if (c->flags & REDIS_IO_FREE) {
+            freeClient(c);
+            continue;
+        }
+        installPendingWriteHandler(c);
+    }
+    server.stat_io_writes_processed += processed;
+    return processed;
+}
+
+/* Return 1 if the socket of the client should be read by the I/O threads.
+ * The client is then queued in server.clients_pending_read. */
+static int postponeClientRead(redisClient *c) {
+    if (server.io_threads_active && server.io_threads_do_reads &&
+        !ProcessingEventsWhileBlocked &&
+        !(c->flags & (REDIS_MASTER|REDIS_SLAVE|REDIS_PENDING_READ)))
+    {
+        c->flags |= REDIS_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read,c);
+        return 1;
+    }
+    return 0;
+}
+
+/* Read the sockets of the clients in server.clients_pending_read with the
+ * I/O threads, then execute the commands parsed by the threads and the rest
+ * of the query buffers. Returns the number of clients processed. */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    int processed = listLength(server.clients_pending_read);
+
+    if (processed == 0) return 0;
+    if (server.io_threads_active) {
+        runThreadedIO(server.clients_pending_read,IO_THREADS_OP_READ);
+        server.stat_io_reads_processed += processed;
+    } else {
+        /* The threads were stopped after the reads were postponed. */
+        listIter li;
+        listNode *ln;
+
+        listRewind(server.clients_pending_read,&li);
+        while((ln = listNext(&li))) ioThreadRead(listNodeValue(ln));
+    }
+
+    while(listLength(server.clients_pending_read)) {
+        listNode *ln = listFirst(server.clients_pending_read);
+        redisClient *c = listNodeValue(ln);
+
+        c->flags &= ~REDIS_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+        if (c->flags & REDIS_IO_FREE) {
+            if (sdslen(c->querybuf) > server.client_max_querybuf_len)
+                logQueryBufLimitReached(c);
+            freeClient(c);
+            continue;
+        }
+        if (c->flags & REDIS_PROTOCOL_ERROR) {
+            c->flags &= ~REDIS_PROTOCOL_ERROR;
+            logProtocolError(c);
+        }
+
+        server.current_client = c;
+        if (c->flags & REDIS_PENDING_COMMAND) {
+            c->flags &= ~REDIS_PENDING_COMMAND;
+            if (processCommand(c) == REDIS_OK) resetClient(c);
+        }
+        processInputBuffer(c);
+        server.current_client = NULL;
+
+        /* Replies queued by the I/O thread itself were not scheduled. */
+        if (clientHasPendingReplies(c) &&
+            !(aeGetFileEvents(server.el,c->fd) & AE_WRITABLE))
+            clientInstallWriteHandler(c);
+    }
+    return processed;
+}
@@ -188,11 +188,11 @@ robj *dupStringObject(robj *o) {
     }
 }
 
-robj *createListObject(void) {
-    list *l = listCreate();
+robj *createQuicklistObject(void) {
+    quicklist *l = quicklistCreate(server.list_max_ziplist_entries,
+                                   server.list_compress_depth);
     robj *o = createObject(REDIS_LIST,l);
-    listSetFreeMethod(l,decrRefCountVoid);
-    o->encoding = REDIS_ENCODING_LINKEDLIST;
+    o->encoding = REDIS_ENCODING_QUICKLIST;
     return o;
 }
 
@@ -242,38 +242,47 @@ robj *createZsetZiplistObject(void) {
     return o;
 }
 
-robj *createInfqObject(robj *key) {
+/* Fill 'conf' with the default settings of InfQ. */
+void initInfqConfig(infqConfig *conf) {
+    conf->mem_block_size = server.infq_mem_block_size;
+    conf->pushq_blocks_num = server.infq_pushq_blocks_num;
+    conf->popq_blocks_num = server.infq_popq_blocks_num;
+    conf->dump_blocks_usage = server.infq_dump_blocks_usage;
+}
+
+/* Init an infQ named 'name' with the settings of 'qconf', keeping its files
+ * in 'subdir' of 'dir', or in 'dir' itself if 'subdir' is NULL. 'dir' is
+ * the data path of InfQ if NULL, and is created if needed. */
+infq_t *createInfq(const char *dir, const char *subdir, const char *name,
+                   infqConfig *qconf) {
     infq_config_t   conf;
     char            buf[1024];
     int             ret, len;
-    sds             key_str;
-    char            *name;
+    infq_t          *q;
+
+    if (dir == NULL) {
+        dir = server.infq_data_path;
+    }
 
     // make sure directory existence
-    if (access(server.infq_data_path, F_OK) == -1) {
-        redisLog(REDIS_NOTICE, "InfQ dir doesn't exist, create it, dir: %s", server.infq_data_path);
-        if (mkdirat(AT_FDCWD, server.infq_data_path, 0755) == -1) {
+    if (access(dir, F_OK) == -1) {
+        redisLog(REDIS_NOTICE, "InfQ dir doesn't exist, create it, dir: %s", dir);
+        if (mkdirat(AT_FDCWD, dir, 0755) == -1) {
             redisLog(REDIS_WARNING, "failed to create InfQ dir, dir: %s, err: %s",
-                    server.infq_data_path, strerror(errno));
+                    dir, strerror(errno));
             return NULL;
         }
     }
 
-    if (key != NULL) {
-        if (key->type != REDIS_STRING) {
-            redisLog(REDIS_WARNING, "key is not a string");
-            return NULL;
-        }
-
-        key_str = key->ptr;
-        len = strlen(server.infq_data_path);
-        if (len && server.infq_data_path[len - 1] != '/') {
-            ret = snprintf(buf, 1024, "%s/%s", server.infq_data_path, key_str);
+    if (subdir != NULL) {
+        len = strlen(dir);
+        if (len && dir[len - 1] != '/') {
+            ret = snprintf(buf, 1024, "%s/%s", dir, subdir);
         } else {
-            ret = snprintf(buf, 1024, "%s%s", server.infq_data_path, key_str);
+            ret = snprintf(buf, 1024, "%s%s", dir, subdir);
         }
     } else {
-        ret = snprintf(buf, 1024, "%s", server.infq_data_path);
+        ret = snprintf(buf, 1024, "%s", dir);
     }
 
     if (ret < 0 || ret >= 1024) {
@@ -283,24 +292,62 @@ robj *createInfqObject(robj *key) {
     }
 
     infq_config_logging(server.infq_logging_level, infq_debug_log, infq_info_log, infq_error_log);
-    conf.mem_block_size = server.infq_mem_block_size;
-    conf.pushq_blocks_num = server.infq_pushq_blocks_num;
-    conf.popq_blocks_num = server.infq_popq_blocks_num;
+    conf.mem_block_size = qconf->mem_block_size;
+    conf.pushq_blocks_num = qconf->pushq_blocks_num;
+    conf.popq_blocks_num = qconf->popq_blocks_num;
     conf.data_path = buf;
-    conf.block_usage_to_dump = server.infq_dump_blocks_usage;
+    conf.block_usage_to_dump = qconf->dump_blocks_usage;
 
-    if (key == NULL) {
+    if (name == NULL) {
         name = "__NULL__";
-    } else {
-        name = (sds)key->ptr;
     }
-    infq_t* q = infq_init_by_conf(&conf, name);
+    q = infq_init_by_conf(&conf, (char *)name);
     if (q == NULL) {
         redisLog(REDIS_NOTICE, "failed to init infQ, data_path: %s, key: %s", buf, name);
         return NULL;
     }
-    robj *o = createObject(REDIS_INFQ, q);
-    o->encoding = REDIS_ENCODING_INFQ;
+    return q;
+}
+
+/* Create an InfQ with the settings of 'qconf', or the default settings if
+ * 'qconf' is NULL. */
+robj *createInfqObject(robj *key, infqConfig *qconf) {
+    infqConfig      defconf;
+    int             conf_set;
+    sds             key_str = NULL;
+    infq_t          *q;
+
+    if (key != NULL) {
+        if (key->type != REDIS_STRING) {
+            redisLog(REDIS_WARNING, "key is not a string");
+            return NULL;
+        }
+        key_str = key->ptr;
+    }
+
+    conf_set = qconf != NULL;
+    if (!conf_set) {
+        initInfqConfig(&defconf);
+        qconf = &defconf;
+    }
+
+    if ((q = createInfq(NULL, key_str, key_str, qconf)) == NULL) {
+        return NULL;
+    }
+    infqObject *qo = zmalloc(sizeof(*qo));
+    qo->q = q;
+    qo->conf = *qconf;
+    qo->conf_set = conf_set;
+    qo->expiring = 0;
+    qo->expire_runs = NULL;
+    memset(qo->lanes, 0, sizeof(qo->lanes));
+    qo->leases = NULL;
+    qo->groups = NULL;
+    qo->pushed = 0;
+    qo->jumped_at = 0;
+    qo->last_push = server.unixtime;
+    robj *o = createObject(REDIS_INFQ, qo);
+    o->encoding = server.infq_element_encoding;
     return o;
 }
 
@@ -312,8 +359,8 @@ void freeStringObject(robj *o) {
 
 void freeListObject(robj *o) {
     switch (o->encoding) {
-    case REDIS_ENCODING_LINKEDLIST:
-        listRelease((list*) o->ptr);
+    case REDIS_ENCODING_QUICKLIST:
+        quicklistRelease(o->ptr);
         break;
     case REDIS_ENCODING_ZIPLIST:
         zfree(o->ptr);
@@ -368,7 +415,17 @@ void freeHashObject(robj *o) {
 }
 
 void freeInfqObject(robj *o) {
-    infq_destroy_completely(o->ptr);
+    infqObject *qo = o->ptr;
+    int j;
+
+    infq_destroy_completely(qo->q);
+    for (j = 1; j < REDIS_INFQ_PRIORITIES; j++) {
+        if (qo->lanes[j]) freeInfqLane(qo->lanes[j]);
+    }
+    if (qo->leases) freeInfqLeases(qo->leases);
+    if (qo->groups) dictRelease(qo->groups);
+    if (qo->expire_runs) listRelease(qo->expire_runs);
+    zfree(qo);
 }
 
 void incrRefCount(robj *o) {
@@ -759,6 +816,9 @@ char *strEncoding(int encoding) {
     case REDIS_ENCODING_SKIPLIST: return "skiplist";
     case REDIS_ENCODING_EMBSTR: return "embstr";
     case REDIS_ENCODING_INFQ: return "infq";
+    case REDIS_ENCODING_INFQ_RAW: return "infqraw";
+    case REDIS_ENCODING_INFQ_LZF: return "infqlzf";
+    case REDIS_ENCODING_QUICKLIST: return "quicklist";
     default: return "unknown";
     }
 }
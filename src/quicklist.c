@@ -0,0 +1,682 @@
+/* quicklist.c - A doubly linked list of ziplists
+ *
+ * A quicklist is the encoding used for lists that grew too big to be stored
+ * in a single ziplist. Instead of switching to a linked list of objects, that
+ * costs two allocations and more than 40 bytes of overhead per element, the
+ * list is split into a doubly linked list of nodes each holding a small
+ * ziplist. Pushing and popping at both ends stays O(1), since only the ziplist
+ * at the head or at the tail is modified, while the memory usage is about the
+ * one of a ziplist.
+ *
+ * The size of every node is bounded by the 'fill' factor:
+ *
+ * - A positive fill is the max number of entries of every ziplist, while the
+ *   ziplist is also never allowed to grow past SIZE_SAFETY_LIMIT bytes unless
+ *   it holds a single entry.
+ * - A negative fill from -1 to -5 limits the ziplist size in bytes to 4kb,
+ *   8kb, 16kb, 32kb or 64kb regardless of the number of entries.
+ *
+ * Optionally the nodes of the list can be compressed with LZF. Lists are
+ * mostly accessed at the ends, so 'compress' is the number of nodes left
+ * uncompressed at each end of the list, while all the nodes in between are
+ * stored compressed. A compressed node that is accessed anyway is
+ * decompressed, and compressed again once the operation is done.
+ */
+
+#include <string.h>
+#include "quicklist.h"
+#include "zmalloc.h"
+#include "ziplist.h"
+#include "util.h"
+#include "lzf.h"
+#include "redisassert.h"
+
+/* Max size in bytes of a ziplist when the fill is positive. */
+#define SIZE_SAFETY_LIMIT 8192
+
+/* Max size in bytes of a ziplist for the negative fill factors -1 to -5. */
+static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
+
+/* Max fill factor, and max number of nodes left uncompressed at each end. */
+#define FILL_MAX (1 << 15)
+#define COMPRESS_MAX (1 << 16)
+
+/* Nodes smaller than MIN_COMPRESS_BYTES are never compressed, and nodes that
+ * don't save at least MIN_COMPRESS_IMPROVE bytes are left uncompressed. */
+#define MIN_COMPRESS_BYTES 48
+#define MIN_COMPRESS_IMPROVE 8
+
+/* Create a new empty quicklist. See the top of the file for the meaning of
+ * 'fill' and 'compress'. */
+quicklist *quicklistCreate(int fill, int compress) {
+    quicklist *ql;
+
+    ql = zmalloc(sizeof(*ql));
+    ql->head = ql->tail = NULL;
+    ql->len = 0;
+    ql->count = 0;
+    if (fill > FILL_MAX) fill = FILL_MAX;
+    else if (fill < -5) fill = -5;
+    ql->fill = fill;
+    if (compress < 0) compress = 0;
+    else if (compress > COMPRESS_MAX) compress = COMPRESS_MAX;
+    ql->compress = compress;
+    return ql;
+}
+
+static quicklistNode *quicklistCreateNode(void) {
+    quicklistNode *node;
+
+    node = zmalloc(sizeof(*node));
+    node->prev = node->next = NULL;
+    node->zl = NULL;
+    node->sz = 0;
+    node->count = 0;
+    node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+    node->recompress = 0;
+    return node;
+}
+
+/* Return the number of entries stored in the quicklist. */
+unsigned long quicklistCount(const quicklist *ql) {
+    return ql->count;
+}
+
+/* Free the whole quicklist. */
+void quicklistRelease(quicklist *ql) {
+    quicklistNode *current, *next;
+
+    current = ql->head;
+    while (current) {
+        next = current->next;
+        zfree(current->zl);
+        zfree(current);
+        current = next;
+    }
+    zfree(ql);
+}
+
+#define quicklistNodeUpdateSz(node) \
+    do { (node)->sz = ziplistBlobLen((node)->zl); } while (0)
+
+/* ---------------------------- Node compression ---------------------------- */
+
+/* Compress the ziplist of 'node' with LZF. Returns 1 if the node is now
+ * compressed, 0 if it was too small or didn't compress well enough, in which
+ * case it is left untouched. */
+static int quicklistCompressNode(quicklistNode *node) {
+    quicklistLZF *lzf;
+
+    node->recompress = 0;
+    if (node->encoding == QUICKLIST_NODE_ENCODING_LZF) return 1;
+    if (node->sz < MIN_COMPRESS_BYTES) return 0;
+
+    lzf = zmalloc(sizeof(*lzf) + node->sz);
+    lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed, node->sz);
+    if (lzf->sz == 0 || lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+        zfree(lzf);
+        return 0;
+    }
+    lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
+    zfree(node->zl);
+    node->zl = (unsigned char*)lzf;
+    node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+    return 1;
+}
+
+/* Turn a compressed node back into a plain ziplist. */
+static void quicklistDecompressNode(quicklistNode *node) {
+    quicklistLZF *lzf;
+    unsigned char *zl;
+
+    node->recompress = 0;
+    if (node->encoding != QUICKLIST_NODE_ENCODING_LZF) return;
+
+    lzf = (quicklistLZF*)node->zl;
+    zl = zmalloc(node->sz);
+    assert(lzf_decompress(lzf->compressed, lzf->sz, zl, node->sz) ==
+           node->sz);
+    zfree(lzf);
+    node->zl = zl;
+    node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+}
+
+/* Decompress a node that needs to be accessed, remembering it was compressed
+ * so that quicklistRecompressOnly() can compress it again when done. */
+#define quicklistDecompressNodeForUse(_node)                                 \
+    do {                                                                     \
+        if ((_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {              \
+            quicklistDecompressNode(_node);                                  \
+            (_node)->recompress = 1;                                         \
+        }                                                                    \
+    } while (0)
+
+#define quicklistRecompressOnly(_node)                                       \
+    do {                                                                     \
+        if ((_node)->recompress) quicklistCompressNode(_node);               \
+    } while (0)
+
+/* Restore the compression invariant after the list was modified: the first
+ * and last 'compress' nodes are kept uncompressed, every other node is
+ * compressed. Only the nodes at the border of the uncompressed windows may
+ * be in the wrong state after a push, pop or node removal, plus 'node' if
+ * not NULL, that is the node just accessed by the caller. */
+static void quicklistCompress(const quicklist *ql, quicklistNode *node) {
+    quicklistNode *forward, *reverse;
+    unsigned int depth;
+    int in_depth = 0;
+
+    if (ql->compress == 0 || ql->len == 0) return;
+
+    forward = ql->head;
+    reverse = ql->tail;
+    for (depth = 0; depth < ql->compress; depth++) {
+        quicklistDecompressNode(forward);
+        quicklistDecompressNode(reverse);
+        if (forward == node || reverse == node) in_depth = 1;
+
+        /* The two windows met: the whole list stays uncompressed. */
+        if (forward == reverse || forward->next == reverse) return;
+        forward = forward->next;
+        reverse = reverse->prev;
+    }
+
+    /* 'forward' and 'reverse' are now the first nodes outside the windows. */
+    quicklistCompressNode(forward);
+    quicklistCompressNode(reverse);
+    if (node && !in_depth) quicklistCompressNode(node);
+}
+
+/* ------------------------------ Node sizing ------------------------------- */
+
+/* Return true if a ziplist of 'sz' bytes and 'count' entries respects the
+ * limits set by 'fill'. */
+static int quicklistWithinLimits(size_t sz, unsigned int count, int fill) {
+    if (fill >= 0) {
+        return count <= (unsigned int)fill && sz <= SIZE_SAFETY_LIMIT;
+    } else {
+        return sz <= optimization_level[-fill - 1];
+    }
+}
+
+/* Return true if an entry of 'sz' bytes can be added to 'node' without
+ * breaking the limits set by 'fill'. The ziplist header of the new entry is
+ * estimated from its length. */
+static int quicklistNodeAllowInsert(const quicklistNode *node, int fill,
+                                    size_t sz) {
+    size_t new_sz;
+
+    if (node == NULL) return 0;
+    new_sz = node->sz + sz + (sz < 254 ? 1 : 5) +
+             (sz < 64 ? 1 : (sz < 16384 ? 2 : 5));
+    return quicklistWithinLimits(new_sz, node->count + 1, fill);
+}
+
+/* -------------------------- Node list management -------------------------- */
+
+/* Link 'new_node' after (or before when 'after' is 0) 'old_node', that is
+ * NULL only when the list is empty. */
+static void quicklistInsertNode(quicklist *ql, quicklistNode *old_node,
+                                quicklistNode *new_node, int after) {
+    if (after) {
+        new_node->prev = old_node;
+        if (old_node) {
+            new_node->next = old_node->next;
+            if (old_node->next) old_node->next->prev = new_node;
+            old_node->next = new_node;
+        }
+        if (ql->tail == old_node) ql->tail = new_node;
+    } else {
+        new_node->next = old_node;
+        if (old_node) {
+            new_node->prev = old_node->prev;
+            if (old_node->prev) old_node->prev->next = new_node;
+            old_node->prev = new_node;
+        }
+        if (ql->head == old_node) ql->head = new_node;
+    }
+    if (ql->len == 0) ql->head = ql->tail = new_node;
+    ql->len++;
+    quicklistCompress(ql, old_node);
+}
+
+/* Unlink and free 'node'. Its entries are subtracted from the list count. */
+static void quicklistDelNode(quicklist *ql, quicklistNode *node) {
+    if (node->next) node->next->prev = node->prev;
+    if (node->prev) node->prev->next = node->next;
+    if (node == ql->tail) ql->tail = node->prev;
+    if (node == ql->head) ql->head = node->next;
+    ql->len--;
+    ql->count -= node->count;
+    zfree(node->zl);
+    zfree(node);
+    quicklistCompress(ql, NULL);
+}
+
+/* Delete the entry at '*p' from the uncompressed 'node', updating '*p' to
+ * the next entry. Returns 1 if the node was freed because it became empty,
+ * in which case '*p' is no longer valid. */
+static int quicklistDelIndex(quicklist *ql, quicklistNode *node,
+                             unsigned char **p) {
+    node->zl = ziplistDelete(node->zl, p);
+    node->count--;
+    ql->count--;
+    if (node->count == 0) {
+        quicklistDelNode(ql, node);
+        return 1;
+    }
+    quicklistNodeUpdateSz(node);
+    return 0;
+}
+
+/* Split the uncompressed 'node' in two: 'node' keeps its first 'offset'
+ * entries, while the returned new node gets the remaining ones. */
+static quicklistNode *quicklistSplitNode(quicklistNode *node,
+                                         unsigned int offset) {
+    quicklistNode *new_node = quicklistCreateNode();
+
+    new_node->zl = zmalloc(node->sz);
+    memcpy(new_node->zl, node->zl, node->sz);
+    new_node->zl = ziplistDeleteRange(new_node->zl, 0, offset);
+    new_node->count = node->count - offset;
+    quicklistNodeUpdateSz(new_node);
+
+    node->zl = ziplistDeleteRange(node->zl, offset, node->count - offset);
+    node->count = offset;
+    quicklistNodeUpdateSz(node);
+    return new_node;
+}
+
+/* Called after 'node' grew because of an insertion in the middle of the
+ * list: split it in two if it is now over the limits, and restore the
+ * compression invariant. */
+static void quicklistNodeGrew(quicklist *ql, quicklistNode *node) {
+    if (node->count > 1 &&
+        !quicklistWithinLimits(node->sz, node->count, ql->fill))
+    {
+        quicklistNode *new_node = quicklistSplitNode(node, node->count / 2);
+        quicklistInsertNode(ql, node, new_node, 1);
+        quicklistCompress(ql, new_node);
+    } else {
+        quicklistCompress(ql, node);
+    }
+}
+
+/* --------------------------------- Push ----------------------------------- */
+
+/* Add a new entry at the head or at the tail of the quicklist, creating a
+ * new node if the one at that end is full. */
+void quicklistPush(quicklist *ql, void *value, const size_t sz, int where) {
+    quicklistNode *node = (where == QUICKLIST_HEAD) ? ql->head : ql->tail;
+    int zlwhere = (where == QUICKLIST_HEAD) ? ZIPLIST_HEAD : ZIPLIST_TAIL;
+
+    if (quicklistNodeAllowInsert(node, ql->fill, sz)) {
+        quicklistDecompressNodeForUse(node);
+        node->zl = ziplistPush(node->zl, value, sz, zlwhere);
+        node->count++;
+        quicklistNodeUpdateSz(node);
+        quicklistCompress(ql, node);
+    } else {
+        quicklistNode *new_node = quicklistCreateNode();
+
+        new_node->zl = ziplistPush(ziplistNew(), value, sz, zlwhere);
+        new_node->count = 1;
+        quicklistNodeUpdateSz(new_node);
+        quicklistInsertNode(ql, node, new_node, where != QUICKLIST_HEAD);
+    }
+    ql->count++;
+}
+
+/* Append every entry of the ziplist 'zl' at the tail, one by one. */
+static void quicklistAppendValuesFromZiplist(quicklist *ql,
+                                             unsigned char *zl) {
+    unsigned char *p = ziplistIndex(zl, 0);
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    char buf[32];
+
+    while (p != NULL) {
+        ziplistGet(p, &vstr, &vlen, &vlong);
+        if (vstr == NULL) {
+            vlen = ll2string(buf, sizeof(buf), vlong);
+            vstr = (unsigned char*)buf;
+        }
+        quicklistPush(ql, vstr, vlen, QUICKLIST_TAIL);
+        p = ziplistNext(zl, p);
+    }
+}
+
+/* Append the ziplist 'zl' as a new node at the tail of the quicklist. The
+ * quicklist takes ownership of 'zl'. This is used to load lists from RDB
+ * files, where every ziplist was saved as a node of a quicklist, and the
+ * sizes are trusted as long as they are within the limits. */
+void quicklistAppendZiplist(quicklist *ql, unsigned char *zl) {
+    unsigned int count = ziplistLen(zl);
+    size_t sz = ziplistBlobLen(zl);
+    quicklistNode *node;
+
+    if (count == 0) {
+        zfree(zl);
+        return;
+    }
+    if (count > 1 && !quicklistWithinLimits(sz, count, ql->fill)) {
+        quicklistAppendValuesFromZiplist(ql, zl);
+        zfree(zl);
+        return;
+    }
+    node = quicklistCreateNode();
+    node->zl = zl;
+    node->count = count;
+    node->sz = sz;
+    quicklistInsertNode(ql, ql->tail, node, 1);
+    ql->count += count;
+}
+
+/* Create a quicklist holding the entries of the ziplist 'zl', that is
+ * consumed. When possible the ziplist itself becomes the first node. */
+quicklist *quicklistCreateFromZiplist(int fill, int compress,
+                                      unsigned char *zl) {
+    quicklist *ql = quicklistCreate(fill, compress);
+
+    quicklistAppendZiplist(ql, zl);
+    return ql;
+}
+
+/* -------------------------------- Insert ---------------------------------- */
+
+/* Insert a new entry before or after the entry returned by an iterator. */
+static void quicklistInsert(quicklist *ql, quicklistEntry *entry,
+                            void *value, const size_t sz, int after) {
+    quicklistNode *node = entry->node;
+    unsigned char *next;
+
+    quicklistDecompressNodeForUse(node);
+    if (after) {
+        next = ziplistNext(node->zl, entry->zi);
+        if (next == NULL)
+            node->zl = ziplistPush(node->zl, value, sz, ZIPLIST_TAIL);
+        else
+            node->zl = ziplistInsert(node->zl, next, value, sz);
+    } else {
+        node->zl = ziplistInsert(node->zl, entry->zi, value, sz);
+    }
+    node->count++;
+    quicklistNodeUpdateSz(node);
+    ql->count++;
+    quicklistNodeGrew(ql, node);
+}
+
+void quicklistInsertAfter(quicklist *ql, quicklistEntry *entry,
+                          void *value, const size_t sz) {
+    quicklistInsert(ql, entry, value, sz, 1);
+}
+
+void quicklistInsertBefore(quicklist *ql, quicklistEntry *entry,
+                           void *value, const size_t sz) {
+    quicklistInsert(ql, entry, value, sz, 0);
+}
+
+/* -------------------------------- Lookup ---------------------------------- */
+
+static void quicklistInitEntry(quicklistEntry *entry) {
+    entry->quicklist = NULL;
+    entry->node = NULL;
+    entry->zi = NULL;
+    entry->value = NULL;
+    entry->longval = -123456789;
+    entry->sz = 0;
+    entry->offset = 0;
+}
+
+/* Populate 'entry' with the element at index 'idx', that is negative when
+ * counting from the tail. The node holding it is decompressed for use.
+ * Returns 0 if the index is out of range. */
+static int quicklistIndex(const quicklist *ql, long long idx,
+                          quicklistEntry *entry) {
+    quicklistNode *n;
+    unsigned long long index, accum = 0;
+    int forward = idx >= 0;
+
+    quicklistInitEntry(entry);
+    entry->quicklist = ql;
+    index = forward ? (unsigned long long)idx : (unsigned long long)(-idx) - 1;
+    if (index >= ql->count) return 0;
+
+    /* Walk from the nearest end of the list. */
+    if (index > ql->count / 2) {
+        forward = !forward;
+        index = ql->count - 1 - index;
+    }
+    n = forward ? ql->head : ql->tail;
+    while (n) {
+        if (accum + n->count > index) break;
+        accum += n->count;
+        n = forward ? n->next : n->prev;
+    }
+    if (n == NULL) return 0;
+
+    entry->node = n;
+    if (forward) entry->offset = index - accum;
+    else entry->offset = (-(long)(index - accum)) - 1;
+    quicklistDecompressNodeForUse(n);
+    entry->zi = ziplistIndex(n->zl, entry->offset);
+    ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+    return 1;
+}
+
+/* Replace the element at 'index' with 'data'. Returns 0 if the index is out
+ * of range. */
+int quicklistReplaceAtIndex(quicklist *ql, long index, void *data,
+                            size_t sz) {
+    quicklistEntry entry;
+
+    if (!quicklistIndex(ql, index, &entry)) return 0;
+    /* After the deletion 'zi' points to the next element, or to the end of
+     * the ziplist, so the insertion puts the new element in the same place. */
+    entry.node->zl = ziplistDelete(entry.node->zl, &entry.zi);
+    entry.node->zl = ziplistInsert(entry.node->zl, entry.zi, data, sz);
+    quicklistNodeUpdateSz(entry.node);
+    quicklistNodeGrew(ql, entry.node);
+    return 1;
+}
+
+/* -------------------------------- Delete ---------------------------------- */
+
+/* Delete the entry returned by quicklistNext(). The iterator can still be
+ * used to continue the iteration, but 'entry' is no longer valid. */
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
+    quicklistNode *prev = entry->node->prev;
+    quicklistNode *next = entry->node->next;
+    int deleted_node = quicklistDelIndex((quicklist*)entry->quicklist,
+                                         entry->node, &entry->zi);
+
+    /* The next call to quicklistNext() looks up the element at the current
+     * offset again, that is now the one after the deleted element when going
+     * forward, or the one before it when going backward. */
+    iter->zi = NULL;
+    if (deleted_node) {
+        if (iter->direction == AL_START_HEAD) {
+            iter->current = next;
+            iter->offset = 0;
+        } else {
+            iter->current = prev;
+            iter->offset = -1;
+        }
+    }
+}
+
+/* Delete 'count' entries starting at index 'start', that is negative when
+ * counting from the tail. Nodes covered entirely by the range are freed
+ * without touching their ziplist. Returns 0 if nothing was deleted. */
+int quicklistDelRange(quicklist *ql, const long start, const long count) {
+    quicklistEntry entry;
+    quicklistNode *node;
+    unsigned long extent = count;
+    long offset;
+
+    if (count <= 0) return 0;
+    if (start >= 0 && extent > ql->count - start) {
+        extent = ql->count - start;
+    } else if (start < 0 && extent > (unsigned long)(-start)) {
+        extent = -start;
+    }
+    if (!quicklistIndex(ql, start, &entry)) return 0;
+
+    node = entry.node;
+    offset = entry.offset;
+    if (offset < 0) offset += node->count;
+    while (extent) {
+        quicklistNode *next = node->next;
+        unsigned long del;
+
+        if (offset == 0 && extent >= node->count) {
+            del = node->count;
+            quicklistDelNode(ql, node);
+        } else {
+            del = node->count - offset;
+            if (del > extent) del = extent;
+            quicklistDecompressNodeForUse(node);
+            node->zl = ziplistDeleteRange(node->zl, offset, del);
+            node->count -= del;
+            ql->count -= del;
+            if (node->count == 0) {
+                quicklistDelNode(ql, node);
+            } else {
+                quicklistNodeUpdateSz(node);
+                quicklistCompress(ql, node);
+            }
+        }
+        extent -= del;
+        node = next;
+        offset = 0;
+    }
+    return 1;
+}
+
+/* Pop an entry from the head or the tail. String entries are passed to
+ * 'saver', and the pointer it returns is stored in '*data', while integer
+ * entries are stored in '*sval' setting '*data' to NULL. Returns 0 if the
+ * list is empty. */
+int quicklistPopCustom(quicklist *ql, int where, unsigned char **data,
+                       unsigned int *sz, long long *sval,
+                       void *(*saver)(unsigned char *data, unsigned int sz)) {
+    quicklistNode *node;
+    unsigned char *p, *vstr;
+    unsigned int vlen;
+    long long vlong;
+
+    if (data) *data = NULL;
+    if (sz) *sz = 0;
+    if (sval) *sval = -123456789;
+    if (ql->count == 0) return 0;
+
+    node = (where == QUICKLIST_HEAD) ? ql->head : ql->tail;
+    quicklistDecompressNodeForUse(node);
+    p = ziplistIndex(node->zl, (where == QUICKLIST_HEAD) ? 0 : -1);
+    if (!ziplistGet(p, &vstr, &vlen, &vlong)) return 0;
+    if (vstr) {
+        if (data) *data = saver(vstr, vlen);
+        if (sz) *sz = vlen;
+    } else {
+        if (sval) *sval = vlong;
+    }
+    if (!quicklistDelIndex(ql, node, &p)) quicklistCompress(ql, node);
+    return 1;
+}
+
+/* Compare the ziplist entry 'p1' with the string 'p2'. */
+int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len) {
+    return ziplistCompare(p1, p2, p2_len);
+}
+
+/* ------------------------------- Iterators -------------------------------- */
+
+/* Return an iterator starting at the head (AL_START_HEAD) or at the tail
+ * (AL_START_TAIL) of the list. Elements can be deleted while iterating with
+ * quicklistDelEntry(), while any other change to the list invalidates the
+ * iterator. */
+quicklistIter *quicklistGetIterator(const quicklist *ql, int direction) {
+    quicklistIter *iter;
+
+    iter = zmalloc(sizeof(*iter));
+    iter->quicklist = ql;
+    iter->direction = direction;
+    iter->zi = NULL;
+    if (direction == AL_START_HEAD) {
+        iter->current = ql->head;
+        iter->offset = 0;
+    } else {
+        iter->current = ql->tail;
+        iter->offset = -1;
+    }
+    return iter;
+}
+
+/* Return an iterator starting at the element at index 'idx', or NULL if the
+ * index is out of range. */
+quicklistIter *quicklistGetIteratorAtIdx(const quicklist *ql, int direction,
+                                         const long idx) {
+    quicklistEntry entry;
+    quicklistIter *iter;
+
+    if (!quicklistIndex(ql, idx, &entry)) return NULL;
+    iter = quicklistGetIterator(ql, direction);
+    iter->current = entry.node;
+    iter->offset = entry.offset;
+    /* Offsets are positive going forward and negative going backward, so
+     * that deleting elements doesn't change the offset of the next one. */
+    if (direction == AL_START_HEAD && iter->offset < 0)
+        iter->offset += entry.node->count;
+    else if (direction == AL_START_TAIL && iter->offset >= 0)
+        iter->offset -= entry.node->count;
+    return iter;
+}
+
+/* Store the next element in 'entry' and return 1, or return 0 when the
+ * iteration is over. A NULL iterator is an empty iteration. */
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
+    quicklistInitEntry(entry);
+    if (iter == NULL) return 0;
+    entry->quicklist = iter->quicklist;
+
+    while (iter->current) {
+        quicklistNode *node = iter->current;
+
+        if (iter->zi == NULL) {
+            quicklistDecompressNodeForUse(node);
+            iter->zi = ziplistIndex(node->zl, iter->offset);
+        } else if (iter->direction == AL_START_HEAD) {
+            iter->zi = ziplistNext(node->zl, iter->zi);
+            iter->offset++;
+        } else {
+            iter->zi = ziplistPrev(node->zl, iter->zi);
+            iter->offset--;
+        }
+
+        if (iter->zi) {
+            entry->node = node;
+            entry->zi = iter->zi;
+            entry->offset = iter->offset;
+            ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+            return 1;
+        }
+
+        /* Done with this node, move to the next one. */
+        quicklistRecompressOnly(node);
+        if (iter->direction == AL_START_HEAD) {
+            iter->current = node->next;
+            iter->offset = 0;
+        } else {
+            iter->current = node->prev;
+            iter->offset = -1;
+        }
+    }
+    return 0;
+}
+
+void quicklistReleaseIterator(quicklistIter *iter) {
+    if (iter == NULL) return;
+    if (iter->current) quicklistRecompressOnly(iter->current);
+    zfree(iter);
+}
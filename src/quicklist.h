@@ -0,0 +1,109 @@
+/* quicklist.h - A doubly linked list of ziplists
+ *
+ * See quicklist.c for the description of the data structure.
+ */
+
+#ifndef __QUICKLIST_H__
+#define __QUICKLIST_H__
+
+/* quicklistNode holds a ziplist of at most 'fill' entries, or when the fill
+ * is negative of at most a given number of bytes, see quicklist.c. When
+ * 'encoding' is QUICKLIST_NODE_ENCODING_LZF, 'zl' points to a quicklistLZF
+ * instead of a ziplist. 'sz' is always the size of the uncompressed
+ * ziplist. */
+typedef struct quicklistNode {
+    struct quicklistNode *prev;
+    struct quicklistNode *next;
+    unsigned char *zl;
+    unsigned int sz;            /* ziplist size in bytes */
+    unsigned int count;         /* count of items in ziplist */
+    unsigned char encoding;     /* RAW==1 or LZF==2 */
+    unsigned char recompress;   /* was this node decompressed for use? */
+} quicklistNode;
+
+/* quicklistLZF is a ziplist compressed with LZF, 'sz' is the length of the
+ * compressed data. */
+typedef struct quicklistLZF {
+    unsigned int sz;
+    char compressed[];
+} quicklistLZF;
+
+/* 'count' is the number of entries of all the ziplists, 'len' the number of
+ * nodes. 'compress' is the number of nodes left uncompressed at each end of
+ * the quicklist, 0 disables compression. */
+typedef struct quicklist {
+    quicklistNode *head;
+    quicklistNode *tail;
+    unsigned long count;
+    unsigned int len;
+    int fill;
+    unsigned int compress;
+} quicklist;
+
+typedef struct quicklistIter {
+    const quicklist *quicklist;
+    quicklistNode *current;
+    unsigned char *zi;
+    long offset; /* offset in current ziplist */
+    int direction;
+} quicklistIter;
+
+typedef struct quicklistEntry {
+    const quicklist *quicklist;
+    quicklistNode *node;
+    unsigned char *zi;
+    unsigned char *value;
+    long long longval;
+    unsigned int sz;
+    long offset;
+} quicklistEntry;
+
+#define QUICKLIST_HEAD 0
+#define QUICKLIST_TAIL -1
+
+/* quicklist node encodings */
+#define QUICKLIST_NODE_ENCODING_RAW 1
+#define QUICKLIST_NODE_ENCODING_LZF 2
+
+/* quicklist compression disable */
+#define QUICKLIST_NOCOMPRESS 0
+
+/* Iteration directions, the same as in adlist.h */
+#ifndef AL_START_HEAD
+#define AL_START_HEAD 0
+#define AL_START_TAIL 1
+#endif
+
+#define quicklistNodeIsCompressed(node) \
+    ((node)->encoding == QUICKLIST_NODE_ENCODING_LZF)
+
+/* Prototypes */
+quicklist *quicklistCreate(int fill, int compress);
+quicklist *quicklistCreateFromZiplist(int fill, int compress,
+                                      unsigned char *zl);
+void quicklistRelease(quicklist *quicklist);
+void quicklistPush(quicklist *quicklist, void *value, const size_t sz,
+                   int where);
+void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl);
+void quicklistInsertAfter(quicklist *quicklist, quicklistEntry *entry,
+                          void *value, const size_t sz);
+void quicklistInsertBefore(quicklist *quicklist, quicklistEntry *entry,
+                           void *value, const size_t sz);
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry);
+int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
+                            size_t sz);
+int quicklistDelRange(quicklist *quicklist, const long start,
+                      const long count);
+quicklistIter *quicklistGetIterator(const quicklist *quicklist,
+                                    int direction);
+quicklistIter *quicklistGetIteratorAtIdx(const quicklist *quicklist,
+                                         int direction, const long idx);
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry);
+void quicklistReleaseIterator(quicklistIter *iter);
+int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data,
+                       unsigned int *sz, long long *sval,
+                       void *(*saver)(unsigned char *data, unsigned int sz));
+unsigned long quicklistCount(const quicklist *quicklist);
+int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len);
+
+#endif /* __QUICKLIST_H__ */
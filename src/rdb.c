@@ -210,10 +210,31 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
-int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
-    size_t comprlen, outlen;
+/* Save 'comprlen' bytes of data already compressed with LZF, that were
+ * 'len' bytes long before the compression. */
+int rdbSaveLzfBlob(rio *rdb, void *data, size_t comprlen, size_t len) {
     unsigned char byte;
     int n, nwritten = 0;
+
+    byte = (REDIS_RDB_ENCVAL<<6)|REDIS_RDB_ENC_LZF;
+    if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) return -1;
+    nwritten += n;
+
+    if ((n = rdbSaveLen(rdb,comprlen)) == -1) return -1;
+    nwritten += n;
+
+    if ((n = rdbSaveLen(rdb,len)) == -1) return -1;
+    nwritten += n;
+
+    if ((n = rdbWriteRaw(rdb,data,comprlen)) == -1) return -1;
+    nwritten += n;
+
+    return nwritten;
+}
+
+int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
+    size_t comprlen, outlen;
+    int nwritten;
     void *out;
 
     /* We require at least four bytes compression for this to be worth it */
@@ -226,25 +247,9 @@ int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
         return 0;
     }
     /* Data compressed! Let's save it on disk */
-    byte = (REDIS_RDB_ENCVAL<<6)|REDIS_RDB_ENC_LZF;
-    if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
-    nwritten += n;
-
-    if ((n = rdbSaveLen(rdb,comprlen)) == -1) goto writeerr;
-    nwritten += n;
-
-    if ((n = rdbSaveLen(rdb,len)) == -1) goto writeerr;
-    nwritten += n;
-
-    if ((n = rdbWriteRaw(rdb,out,comprlen)) == -1) goto writeerr;
-    nwritten += n;
-
+    nwritten = rdbSaveLzfBlob(rdb,out,comprlen,len);
     zfree(out);
     return nwritten;
-
-writeerr:
-    zfree(out);
-    return -1;
 }
 
 robj *rdbLoadLzfStringObject(rio *rdb) {
@@ -436,8 +441,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
     case REDIS_LIST:
         if (o->encoding == REDIS_ENCODING_ZIPLIST)
             return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST_ZIPLIST);
-        else if (o->encoding == REDIS_ENCODING_LINKEDLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST);
+        else if (o->encoding == REDIS_ENCODING_QUICKLIST)
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST_QUICKLIST);
         else
             redisPanic("Unknown list encoding");
     case REDIS_SET:
@@ -462,13 +467,278 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         else
             redisPanic("Unknown hash encoding");
     case REDIS_INFQ:
-        return rdbSaveType(rdb, REDIS_RDB_TYPE_INFQ);
+        if (rdbInfqHasSections(o))
+            return rdbSaveType(rdb, REDIS_RDB_TYPE_INFQ_EXT);
+        else if (o->encoding == REDIS_ENCODING_INFQ_RAW)
+            return rdbSaveType(rdb, REDIS_RDB_TYPE_INFQ_RAW);
+        else if (o->encoding == REDIS_ENCODING_INFQ)
+            return rdbSaveType(rdb, REDIS_RDB_TYPE_INFQ);
+        else
+            redisPanic("Unknown infq encoding");
     default:
         redisPanic("Unknown object type");
     }
     return -1; /* avoid warning */
 }
 
+/* Return the RDB type of the elements of the InfQ, saved by itself for the
+ * InfQs without sections, or after REDIS_RDB_TYPE_INFQ_EXT. */
+static int rdbInfqElementType(robj *o) {
+    switch(o->encoding) {
+    case REDIS_ENCODING_INFQ_RAW: return REDIS_RDB_TYPE_INFQ_RAW;
+    case REDIS_ENCODING_INFQ_LZF: return REDIS_RDB_TYPE_INFQ_LZF;
+    case REDIS_ENCODING_INFQ: return REDIS_RDB_TYPE_INFQ;
+    default: redisPanic("Unknown infq encoding");
+    }
+    return -1; /* avoid warning */
+}
+
+/* Return true if the InfQ has state out of infQ to save, so it has to be
+ * saved as REDIS_RDB_TYPE_INFQ_EXT. The elements compressed with LZF are
+ * only known to the versions loading REDIS_RDB_TYPE_INFQ_EXT. */
+int rdbInfqHasSections(robj *o) {
+    infqObject *qo = o->ptr;
+
+    return qo->conf_set || qo->expiring || infqLeasesLength(o) > 0 || infqHasLanes(o) ||
+        infqGroupsLength(o) > 0 || o->encoding == REDIS_ENCODING_INFQ_LZF;
+}
+
+/* Save the sections of REDIS_RDB_TYPE_INFQ_EXT before the dump of infQ,
+ * terminated by REDIS_RDB_INFQ_OPCODE_DUMP. */
+int rdbSaveInfqHeadSections(rio *rdb, robj *o) {
+    infqObject  *qo = o->ptr;
+    int         n, nwritten = 0;
+
+    if (qo->conf_set) {
+        // Block Size + Push Blocks + Pop Blocks + Dump Usage
+        if ((n = rdbSaveType(rdb, REDIS_RDB_INFQ_OPCODE_CONFIG)) == -1) return -1;
+        nwritten += n;
+        if ((n = rdbSaveLen(rdb, qo->conf.mem_block_size)) == -1) return -1;
+        nwritten += n;
+        if ((n = rdbSaveLen(rdb, qo->conf.pushq_blocks_num)) == -1) return -1;
+        nwritten += n;
+        if ((n = rdbSaveLen(rdb, qo->conf.popq_blocks_num)) == -1) return -1;
+        nwritten += n;
+        if ((n = rdbSaveDoubleValue(rdb, qo->conf.dump_blocks_usage)) == -1) return -1;
+        nwritten += n;
+    }
+
+    if (qo->expiring) {
+        if ((n = rdbSaveType(rdb, REDIS_RDB_INFQ_OPCODE_EXPIRING)) == -1) return -1;
+        nwritten += n;
+    }
+
+    if ((n = rdbSaveType(rdb, REDIS_RDB_INFQ_OPCODE_DUMP)) == -1) return -1;
+    nwritten += n;
+    return nwritten;
+}
+
+/* Save the sections of REDIS_RDB_TYPE_INFQ_EXT after the dump of infQ,
+ * terminated by REDIS_RDB_INFQ_OPCODE_EOF. */
+int rdbSaveInfqTailSections(rio *rdb, robj *o) {
+    infqObject      *qo = o->ptr;
+    infqLeases      *leases = qo->leases;
+    zskiplistNode   *ln;
+    infqLease       *lease;
+    dictIterator    *di;
+    dictEntry       *de;
+    long long       id;
+    char            buf[1024];
+    int             n, nwritten = 0, size, j, lanes = 0;
+
+    if (infqLeasesLength(o) > 0) {
+        // Next Id + Lease Num + [Id + Deadline + Value] ...
+        if ((n = rdbSaveType(rdb, REDIS_RDB_INFQ_OPCODE_LEASES)) == -1) return -1;
+        nwritten += n;
+        if ((n = rdbSaveLongLongAsStringObject(rdb, leases->next_id)) == -1) return -1;
+        nwritten += n;
+        if ((n = rdbSaveLen(rdb, dictSize(leases->dict))) == -1) return -1;
+        nwritten += n;
+
+        for (ln = leases->zsl->header->level[0].forward; ln != NULL; ln = ln->level[0].forward) {
+            lease = dictFetchValue(leases->dict, ln->obj);
+            redisAssert(getLongLongFromObject(ln->obj, &id) == REDIS_OK);
+
+            if ((n = rdbSaveLongLongAsStringObject(rdb, id)) == -1) return -1;
+            nwritten += n;
+            if ((n = rdbSaveMillisecondTime(rdb, lease->deadline)) == -1) return -1;
+            nwritten += n;
+            if ((n = rdbSaveStringObject(rdb, lease->value)) == -1) return -1;
+            nwritten += n;
+        }
+    }
+
+    if (infqHasLanes(o)) {
+        // Lane Num + [Priority + Len + Data] ...
+        for (j = 1; j < REDIS_INFQ_PRIORITIES; j++) {
+            if (qo->lanes[j]) lanes++;
+        }
+        if ((n = rdbSaveType(rdb, REDIS_RDB_INFQ_OPCODE_LANES)) == -1) return -1;
+        nwritten += n;
+        if ((n = rdbSaveLen(rdb, lanes)) == -1) return -1;
+        nwritten += n;
+
+        for (j = REDIS_INFQ_PRIORITIES - 1; j > 0; j--) {
+            if (qo->lanes[j] == NULL) continue;
+
+            if (infq_dump(qo->lanes[j]->q, buf, 1024, &size) == INFQ_ERR) {
+                redisLog(REDIS_WARNING, "failed to dump lane of infq, priority: %d", j);
+                return -1;
+            }
+            if ((n = rdbSaveLen(rdb, j)) == -1) return -1;
+            nwritten += n;
+            if ((n = rdbSaveLen(rdb, size)) == -1) return -1;
+            nwritten += n;
+            if ((n = rdbSaveRawString(rdb, (unsigned char *)buf, size)) == -1) return -1;
+            nwritten += n;
+        }
+    }
+
+    if (infqGroupsLength(o) > 0) {
+        // Group Num + [Name + Offset from the head] ...
+        if ((n = rdbSaveType(rdb, REDIS_RDB_INFQ_OPCODE_GROUPS)) == -1) return -1;
+        nwritten += n;
+        if ((n = rdbSaveLen(rdb, infqGroupsLength(o))) == -1) return -1;
+        nwritten += n;
+
+        di = dictGetIterator(qo->groups);
+        while ((de = dictNext(di)) != NULL) {
+            sds name = dictGetKey(de);
+
+            if ((n = rdbSaveRawString(rdb, (unsigned char *)name, sdslen(name))) == -1) break;
+            nwritten += n;
+            if ((n = rdbSaveLongLongAsStringObject(rdb, infqGroupOffset(o, de))) == -1) break;
+            nwritten += n;
+        }
+        dictReleaseIterator(di);
+        if (n == -1) return -1;
+    }
+
+    if ((n = rdbSaveType(rdb, REDIS_RDB_INFQ_OPCODE_EOF)) == -1) return -1;
+    nwritten += n;
+    return nwritten;
+}
+
+// load a long long saved by rdbSaveLongLongAsStringObject()
+int rdbLoadLongLongValue(rio *rdb, long long *val) {
+    robj    *o;
+    int     ret;
+
+    if ((o = rdbLoadStringObject(rdb)) == NULL) return REDIS_ERR;
+    ret = getLongLongFromObject(o, val);
+    decrRefCount(o);
+    return ret;
+}
+
+/* Load the sections of REDIS_RDB_TYPE_INFQ_EXT before the dump of infQ.
+ * 'conf_set' is set to 1 if the InfQ has its own config in 'conf', and
+ * 'expiring' to 1 if its elements are prefixed by their expire time. */
+int rdbLoadInfqHeadSections(rio *rdb, infqConfig *conf, int *conf_set, int *expiring) {
+    uint32_t    len[3];
+    double      usage;
+    int         type, j;
+
+    *conf_set = 0;
+    *expiring = 0;
+    while (1) {
+        if ((type = rdbLoadType(rdb)) == -1) return REDIS_ERR;
+        if (type == REDIS_RDB_INFQ_OPCODE_DUMP) break;
+
+        if (type == REDIS_RDB_INFQ_OPCODE_CONFIG) {
+            for (j = 0; j < 3; j++) {
+                if ((len[j] = rdbLoadLen(rdb, NULL)) == REDIS_RDB_LENERR) return REDIS_ERR;
+            }
+            if (rdbLoadDoubleValue(rdb, &usage) == -1) return REDIS_ERR;
+
+            conf->mem_block_size = len[0];
+            conf->pushq_blocks_num = len[1];
+            conf->popq_blocks_num = len[2];
+            conf->dump_blocks_usage = usage;
+            *conf_set = 1;
+        } else if (type == REDIS_RDB_INFQ_OPCODE_EXPIRING) {
+            *expiring = 1;
+        } else {
+            redisLog(REDIS_WARNING, "unknown section of infq, opcode: %d", type);
+            return REDIS_ERR;
+        }
+    }
+
+    return REDIS_OK;
+}
+
+/* Load the sections of REDIS_RDB_TYPE_INFQ_EXT after the dump of infQ to the
+ * InfQ 'o'. The lanes loaded are named by infqNameLanes() once the key of the
+ * InfQ is known. */
+int rdbLoadInfqTailSections(rio *rdb, robj *o) {
+    infqObject  *qo = o->ptr;
+    infqLane    *lane;
+    long long   next_id, id, deadline;
+    uint32_t    len, priority, size;
+    robj        *value;
+    int         type;
+
+    while (1) {
+        if ((type = rdbLoadType(rdb)) == -1) return REDIS_ERR;
+        if (type == REDIS_RDB_INFQ_OPCODE_EOF) break;
+
+        if (type == REDIS_RDB_INFQ_OPCODE_LEASES) {
+            if (rdbLoadLongLongValue(rdb, &next_id) == REDIS_ERR) return REDIS_ERR;
+            if ((len = rdbLoadLen(rdb, NULL)) == REDIS_RDB_LENERR) return REDIS_ERR;
+
+            while (len--) {
+                if (rdbLoadLongLongValue(rdb, &id) == REDIS_ERR) return REDIS_ERR;
+                if ((deadline = rdbLoadMillisecondTime(rdb)) == -1) return REDIS_ERR;
+                if ((value = rdbLoadStringObject(rdb)) == NULL) return REDIS_ERR;
+
+                infqLeaseAdd(o, id, value, deadline);
+                decrRefCount(value);
+            }
+            if (qo->leases && qo->leases->next_id < next_id) {
+                qo->leases->next_id = next_id;
+            }
+        } else if (type == REDIS_RDB_INFQ_OPCODE_LANES) {
+            if ((len = rdbLoadLen(rdb, NULL)) == REDIS_RDB_LENERR) return REDIS_ERR;
+
+            while (len--) {
+                if ((priority = rdbLoadLen(rdb, NULL)) == REDIS_RDB_LENERR) return REDIS_ERR;
+                if (priority == 0 || priority >= REDIS_INFQ_PRIORITIES ||
+                        qo->lanes[priority] != NULL) {
+                    redisLog(REDIS_WARNING, "bad lane of infq, priority: %u", priority);
+                    return REDIS_ERR;
+                }
+                if ((size = rdbLoadLen(rdb, NULL)) == REDIS_RDB_LENERR) return REDIS_ERR;
+                if ((value = rdbLoadStringObject(rdb)) == NULL) return REDIS_ERR;
+
+                if ((lane = createInfqLane(o, NULL, priority)) == NULL ||
+                        infq_load(lane->q, value->ptr, size) == INFQ_ERR) {
+                    redisLog(REDIS_WARNING, "failed to load lane of infq, priority: %u", priority);
+                    decrRefCount(value);
+                    return REDIS_ERR;
+                }
+                decrRefCount(value);
+                lane->pushed = infq_size(lane->q);
+            }
+        } else if (type == REDIS_RDB_INFQ_OPCODE_GROUPS) {
+            if ((len = rdbLoadLen(rdb, NULL)) == REDIS_RDB_LENERR) return REDIS_ERR;
+
+            while (len--) {
+                if ((value = rdbLoadStringObject(rdb)) == NULL) return REDIS_ERR;
+                if (rdbLoadLongLongValue(rdb, &id) == REDIS_ERR ||
+                        infqGroupAdd(o, value->ptr, id) == REDIS_ERR) {
+                    decrRefCount(value);
+                    return REDIS_ERR;
+                }
+                decrRefCount(value);
+            }
+        } else {
+            redisLog(REDIS_WARNING, "unknown section of infq, opcode: %d", type);
+            return REDIS_ERR;
+        }
+    }
+
+    return REDIS_OK;
+}
+
 /* Use rdbLoadType() to load a TYPE in RDB format, but returns -1 if the
  * type is not specifically a valid Object Type. */
 int rdbLoadObjectType(rio *rdb) {
@@ -493,19 +763,26 @@ int rdbSaveObject(rio *rdb, robj *o) {
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
-        } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-            list *list = o->ptr;
-            listIter li;
-            listNode *ln;
+        } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            quicklistNode *node = ql->head;
 
-            if ((n = rdbSaveLen(rdb,listLength(list))) == -1) return -1;
+            /* Every node is saved as its ziplist. Compressed nodes are
+             * saved as they are, without decompressing them. */
+            if ((n = rdbSaveLen(rdb,ql->len)) == -1) return -1;
             nwritten += n;
 
-            listRewind(list,&li);
-            while((ln = listNext(&li))) {
-                robj *eleobj = listNodeValue(ln);
-                if ((n = rdbSaveStringObject(rdb,eleobj)) == -1) return -1;
+            while(node) {
+                if (quicklistNodeIsCompressed(node)) {
+                    quicklistLZF *lzf = (quicklistLZF*)node->zl;
+                    if ((n = rdbSaveLzfBlob(rdb,lzf->compressed,lzf->sz,
+                                            node->sz)) == -1) return -1;
+                } else {
+                    if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1)
+                        return -1;
+                }
                 nwritten += n;
+                node = node->next;
             }
         } else {
             redisPanic("Unknown list encoding");
@@ -592,9 +869,17 @@ int rdbSaveObject(rio *rdb, robj *o) {
             redisPanic("Unknown hash encoding");
         }
     } else if (o->type == REDIS_INFQ) {
-        infq_t  *q = o->ptr;
+        infq_t  *q = infqPtr(o);
         char    buf[1024];
-        int     size;
+        int     size, ext;
+
+        // REDIS_RDB_TYPE_INFQ_EXT: Element Type + Sections + DUMP + Len + Data + Sections
+        ext = rdbInfqHasSections(o);
+        if (ext) {
+            nwritten += rdbSaveType(rdb, rdbInfqElementType(o));
+            if ((n = rdbSaveInfqHeadSections(rdb, o)) == -1) return -1;
+            nwritten += n;
+        }
 
         redisLog(REDIS_DEBUG, "infq dump started ...");
         if (infq_dump(q, buf, 1024, &size) == INFQ_ERR) {
@@ -605,6 +890,11 @@ int rdbSaveObject(rio *rdb, robj *o) {
         // Len + Data
         nwritten += rdbSaveLen(rdb, size);
         nwritten += rdbSaveRawString(rdb, (unsigned char *)buf, size);
+
+        if (ext) {
+            if ((n = rdbSaveInfqTailSections(rdb, o)) == -1) return -1;
+            nwritten += n;
+        }
     } else {
         redisPanic("Unknown object type");
     }
@@ -777,16 +1067,19 @@ werr:
     return REDIS_ERR;
 }
 
-int iter_infq_jump_callback(infq_t *q, sds key, void *arg1, void *arg2) {
-    REDIS_NOTUSED(key);
-    REDIS_NOTUSED(arg1);
-    REDIS_NOTUSED(arg2);
+/* Make the InfQs ready for a snapshot by a child, see infqJumpPushQueues(),
+ * recording the cost for INFO. */
+int rdbPrepareInfqForSnapshot(void) {
+    long long start = ustime();
+    int jumped;
 
-    if (infq_push_queue_jump(q) == INFQ_ERR) {
-        redisLog(REDIS_WARNING, "failed to jump push queue");
+    jumped = infqJumpPushQueues(&server.rdb_last_infq_jumps_skipped);
+    server.rdb_last_prepare_usec = ustime()-start;
+    if (jumped == -1) {
+        redisLog(REDIS_WARNING, "failed to jump all infq");
         return REDIS_ERR;
     }
-
+    server.rdb_last_infq_jumps = jumped;
     return REDIS_OK;
 }
 
@@ -798,12 +1091,7 @@ int rdbSaveBackground(char *filename) {
 
     // check to see if InfQ object exists, make its push queue jump to next memory
     // block if it exists
-    if (dictSize(server.infq_keys) != 0) {
-        if (iterateInfQ(iter_infq_jump_callback, NULL, NULL, 1) == REDIS_ERR) {
-            redisLog(REDIS_WARNING, "failed to jump all infq");
-            return REDIS_ERR;
-        }
-    }
+    if (rdbPrepareInfqForSnapshot() == REDIS_ERR) return REDIS_ERR;
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
@@ -883,9 +1171,9 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* Read list value */
         if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
 
-        /* Use a real list when there are too many entries */
+        /* Use a quicklist when there are too many entries */
         if (len > server.list_max_ziplist_entries) {
-            o = createListObject();
+            o = createQuicklistObject();
         } else {
             o = createZiplistObject();
         }
@@ -895,21 +1183,20 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
 
             /* If we are using a ziplist and the value is too big, convert
-             * the object to a real list. */
+             * the object to a quicklist. */
             if (o->encoding == REDIS_ENCODING_ZIPLIST &&
                 sdsEncodedObject(ele) &&
                 sdslen(ele->ptr) > server.list_max_ziplist_value)
-                    listTypeConvert(o,REDIS_ENCODING_LINKEDLIST);
+                    listTypeConvert(o,REDIS_ENCODING_QUICKLIST);
 
+            dec = getDecodedObject(ele);
             if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-                dec = getDecodedObject(ele);
                 o->ptr = ziplistPush(o->ptr,dec->ptr,sdslen(dec->ptr),REDIS_TAIL);
-                decrRefCount(dec);
-                decrRefCount(ele);
             } else {
-                ele = tryObjectEncoding(ele);
-                listAddNodeTail(o->ptr,ele);
+                quicklistPush(o->ptr,dec->ptr,sdslen(dec->ptr),QUICKLIST_TAIL);
             }
+            decrRefCount(dec);
+            decrRefCount(ele);
         }
     } else if (rdbtype == REDIS_RDB_TYPE_SET) {
         /* Read list/set value */
@@ -1047,6 +1334,24 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* All pairs should be read by now */
         redisAssert(len == 0);
 
+    } else if (rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST) {
+        /* Read the ziplist of every node */
+        if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
+        o = createQuicklistObject();
+
+        while(len--) {
+            robj *aux = rdbLoadStringObject(rdb);
+            unsigned char *zl;
+
+            if (aux == NULL) {
+                decrRefCount(o);
+                return NULL;
+            }
+            zl = zmalloc(sdslen(aux->ptr));
+            memcpy(zl,aux->ptr,sdslen(aux->ptr));
+            decrRefCount(aux);
+            quicklistAppendZiplist(o->ptr,zl);
+        }
     } else if (rdbtype == REDIS_RDB_TYPE_HASH_ZIPMAP  ||
                rdbtype == REDIS_RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == REDIS_RDB_TYPE_SET_INTSET   ||
@@ -1101,7 +1406,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 o->type = REDIS_LIST;
                 o->encoding = REDIS_ENCODING_ZIPLIST;
                 if (ziplistLen(o->ptr) > server.list_max_ziplist_entries)
-                    listTypeConvert(o,REDIS_ENCODING_LINKEDLIST);
+                    listTypeConvert(o,REDIS_ENCODING_QUICKLIST);
                 break;
             case REDIS_RDB_TYPE_SET_INTSET:
                 o->type = REDIS_SET;
@@ -1125,12 +1430,35 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 redisPanic("Unknown encoding");
                 break;
         }
-    } else if (rdbtype == REDIS_RDB_TYPE_INFQ) {
-        o = createInfqObject(NULL);
+    } else if (rdbIsInfqType(rdbtype)) {
+        infqConfig  conf;
+        int         conf_set = 0, expiring = 0, eletype = rdbtype;
+
+        if (rdbtype == REDIS_RDB_TYPE_INFQ_EXT) {
+            if ((eletype = rdbLoadType(rdb)) == -1) {
+                redisLog(REDIS_WARNING, "failed to read element type of infq");
+                return NULL;
+            }
+            if (rdbLoadInfqHeadSections(rdb, &conf, &conf_set, &expiring) == REDIS_ERR) {
+                redisLog(REDIS_WARNING, "failed to load sections of infq");
+                return NULL;
+            }
+        }
+
+        o = createInfqObject(NULL, conf_set ? &conf : NULL);
         if (o == NULL) {
             redisLog(REDIS_WARNING, "failed to create robj of infQ");
             return NULL;
         }
+        // the elements already stored keep their own encoding
+        if (eletype == REDIS_RDB_TYPE_INFQ_RAW) {
+            o->encoding = REDIS_ENCODING_INFQ_RAW;
+        } else if (eletype == REDIS_RDB_TYPE_INFQ_LZF) {
+            o->encoding = REDIS_ENCODING_INFQ_LZF;
+        } else {
+            o->encoding = REDIS_ENCODING_INFQ;
+        }
+        ((infqObject *)o->ptr)->expiring = expiring;
 
         unsigned int    buf_len = rdbLoadLen(rdb, NULL);
         if (buf_len == REDIS_RDB_LENERR) {
@@ -1144,10 +1472,17 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             return NULL;
         }
 
-        if (infq_load(o->ptr, buf->ptr, buf_len) == INFQ_ERR) {
+        if (infq_load(infqPtr(o), buf->ptr, buf_len) == INFQ_ERR) {
             redisLog(REDIS_WARNING, "failed to load infq");
             return NULL;
         }
+        // QSCAN cursors restart from the loaded elements
+        ((infqObject *)o->ptr)->pushed = infq_size(infqPtr(o));
+
+        if (rdbtype == REDIS_RDB_TYPE_INFQ_EXT && rdbLoadInfqTailSections(rdb, o) == REDIS_ERR) {
+            redisLog(REDIS_WARNING, "failed to load sections of infq");
+            return NULL;
+        }
     } else {
         redisPanic("Unknown object type");
     }
@@ -1284,10 +1619,11 @@ int rdbLoad(char *filename) {
         /* Add the new object in the hash table */
         dbAdd(db,key,val);
 
-        if (type == REDIS_RDB_TYPE_INFQ) {
+        if (rdbIsInfqType(type)) {
             dictEntry   *de;
             de = dictFind(db->dict, key->ptr);
             dictReplace(server.infq_keys, dictGetKey(de), db);
+            infqNameLanes(val, dictGetKey(de));
             redisLog(REDIS_NOTICE, "load infq from rdb, key: %s", (char *)key->ptr);
         }
 
@@ -1360,8 +1696,12 @@ void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
             server.lastbgsave_status = REDIS_ERR;
     }
 
-    // continue unlinker which is suspended by rdb
-    if (server.infq_unlinker_suspend_type == REDIS_INFQ_UNLINKER_SUSPEND_RDB) {
+    // continue unlinker which is suspended by rdb, or leave it to the running
+    // AOF rewrite
+    if (server.infq_unlinker_suspend_type == REDIS_INFQ_UNLINKER_SUSPEND_RDB &&
+            server.aof_child_pid != -1) {
+        server.infq_unlinker_suspend_type = REDIS_INFQ_UNLINKER_SUSPEND_AOF;
+    } else if (server.infq_unlinker_suspend_type == REDIS_INFQ_UNLINKER_SUSPEND_RDB) {
         if (iterateInfQ(iter_infq_continue_unlinker, NULL, NULL, 1) == REDIS_ERR) {
             redisLog(REDIS_WARNING, "failed to continue unlinker");
         }
@@ -1475,6 +1815,12 @@ void backgroundSaveDoneHandlerSocket(int exitcode, int bysignal) {
     }
     zfree(ok_slaves);
 
+    // The child dumped the InfQs as well, make meta data index point to the
+    // right one as for the RDB on disk.
+    if (iterateInfQ(iter_infq_done_dump_callback, NULL, NULL, 1) == REDIS_ERR) {
+        redisLog(REDIS_WARNING, "failed to finish dump for all the InfQ");
+    }
+
     updateSlavesWaitingBgsave((!bysignal && exitcode == 0) ? REDIS_OK : REDIS_ERR, REDIS_RDB_CHILD_TYPE_SOCKET);
 }
 
@@ -1503,10 +1849,15 @@ int rdbSaveToSlavesSockets(void) {
     listIter li;
     pid_t childpid;
     long long start;
-    int pipefds[2];
+    int pipefds[2], infq_crc;
 
     if (server.rdb_child_pid != -1) return REDIS_ERR;
 
+    // make the push queue of the InfQs jump to the next memory block, as
+    // for rdbSaveBackground(), the child streams the dumped files after the
+    // RDB
+    if (rdbPrepareInfqForSnapshot() == REDIS_ERR) return REDIS_ERR;
+
     /* Before to fork, create a pipe that will be used in order to
      * send back to the parent the IDs of the slaves that successfully
      * received all the writes. */
@@ -1522,6 +1873,9 @@ int rdbSaveToSlavesSockets(void) {
      * (sent via unix pipe) that will be sent to the parent. */
     clientids = zmalloc(sizeof(uint64_t)*listLength(server.slaves));
     numfds = 0;
+    /* The slaves share the stream, the crc64 of the InfQ files is only
+     * sent if all of them check it. */
+    infq_crc = server.repl_infq_checksum;
 
     listRewind(server.slaves,&li);
     while((ln = listNext(&li))) {
@@ -1530,6 +1884,7 @@ int rdbSaveToSlavesSockets(void) {
         if (slave->replstate == REDIS_REPL_WAIT_BGSAVE_START) {
             clientids[numfds] = slave->id;
             fds[numfds++] = slave->fd;
+            if (!(slave->slave_capa & REDIS_SLAVE_CAPA_INFQ_CRC)) infq_crc = 0;
             slave->replstate = REDIS_REPL_WAIT_BGSAVE_END;
             /* Put the socket in non-blocking mode to simplify RDB transfer.
              * We'll restore it when the children returns (since duped socket
@@ -1553,6 +1908,8 @@ int rdbSaveToSlavesSockets(void) {
         redisSetProcTitle("redis-rdb-to-slaves");
 
         retval = rdbSaveRioWithEOFMark(&slave_sockets,NULL);
+        if (retval == REDIS_OK)
+            retval = replicationWriteInfQFiles(&slave_sockets,infq_crc);
         if (retval == REDIS_OK && rioFlush(&slave_sockets) == 0)
             retval = REDIS_ERR;
 
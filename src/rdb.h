@@ -38,7 +38,7 @@
 
 /* The current RDB version. When the format changes in a way that is no longer
  * backward compatible this number gets incremented. */
-#define REDIS_RDB_VERSION 6
+#define REDIS_RDB_VERSION 7
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -75,6 +75,9 @@
 #define REDIS_RDB_TYPE_ZSET   3
 #define REDIS_RDB_TYPE_HASH   4
 #define REDIS_RDB_TYPE_INFQ   5
+#define REDIS_RDB_TYPE_INFQ_RAW 6
+#define REDIS_RDB_TYPE_INFQ_EXT 7  /* InfQ with the state kept out of infQ */
+#define REDIS_RDB_TYPE_INFQ_LZF 8  /* Element type of INFQ_EXT only */
 
 /* Object types for encoded objects. */
 #define REDIS_RDB_TYPE_HASH_ZIPMAP    9
@@ -82,9 +85,24 @@
 #define REDIS_RDB_TYPE_SET_INTSET    11
 #define REDIS_RDB_TYPE_ZSET_ZIPLIST  12
 #define REDIS_RDB_TYPE_HASH_ZIPLIST  13
+#define REDIS_RDB_TYPE_LIST_QUICKLIST 14
 
 /* Test if a type is an object type. */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 13))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 4) || (t >= 9 && t <= 14))
+
+/* Test if a type is an InfQ type. */
+#define rdbIsInfqType(t) (t == REDIS_RDB_TYPE_INFQ || t == REDIS_RDB_TYPE_INFQ_RAW || \
+                          t == REDIS_RDB_TYPE_INFQ_EXT)
+
+/* Sections of REDIS_RDB_TYPE_INFQ_EXT. The sections before DUMP are needed to
+ * create the infQ, the ones after DUMP are restored to the loaded InfQ. */
+#define REDIS_RDB_INFQ_OPCODE_LEASES 1
+#define REDIS_RDB_INFQ_OPCODE_CONFIG 2
+#define REDIS_RDB_INFQ_OPCODE_EXPIRING 3
+#define REDIS_RDB_INFQ_OPCODE_LANES 4
+#define REDIS_RDB_INFQ_OPCODE_GROUPS 5
+#define REDIS_RDB_INFQ_OPCODE_DUMP 254
+#define REDIS_RDB_INFQ_OPCODE_EOF 255
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
 #define REDIS_RDB_OPCODE_EXPIRETIME_MS 252
@@ -103,9 +121,11 @@ int rdbLoadObjectType(rio *rdb);
 int rdbLoad(char *filename);
 int rdbSaveBackground(char *filename);
 int rdbSaveToSlavesSockets(void);
+int replicationWriteInfQFiles(rio *r, int crc);
 void rdbRemoveTempFile(pid_t childpid);
 int rdbSave(char *filename);
 int rdbSaveObject(rio *rdb, robj *o);
+int rdbInfqHasSections(robj *o);
 off_t rdbSavedObjectLen(robj *o);
 off_t rdbSavedObjectPages(robj *o);
 robj *rdbLoadObject(int type, rio *rdb);
@@ -598,6 +598,8 @@ usage:
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
 " Fill a list with 10000 random elements:\n"
 "   $ redis-benchmark -r 10000 -n 10000 lpush mylist __rand_int__\n\n"
+" Peek random elements of an InfQ spanning memory and file blocks:\n"
+"   $ redis-benchmark -t qat -n 1000000 -d 1024 -r 1000000\n\n"
 " On user specified command lines __rand_int__ is replaced with a random integer\n"
 " with a range of values selected by the -r option.\n"
     );
@@ -826,6 +828,19 @@ int main(int argc, const char **argv) {
             free(cmd);
         }
 
+        if (test_is_selected("qat")) {
+            len = redisFormatCommand(&cmd,"QPUSH myqueue %s",data);
+            benchmark("QPUSH (needed to benchmark QAT)",cmd,len);
+            free(cmd);
+
+            /* Random indexes are only used with -r, which should not be
+             * larger than the queue for every QAT to hit an element. */
+            len = redisFormatCommand(&cmd,"QAT myqueue %s",
+                config.randomkeys ? "__rand_int__" : "0");
+            benchmark("QAT (random index)",cmd,len);
+            free(cmd);
+        }
+
         if (test_is_selected("mset")) {
             const char *argv[21];
             argv[0] = "MSET";
@@ -53,6 +53,7 @@
 #define REDIS_SET_INTSET 11
 #define REDIS_ZSET_ZIPLIST 12
 #define REDIS_HASH_ZIPLIST 13
+#define REDIS_LIST_QUICKLIST 14
 
 /* Objects encoding. Some kind of objects like Strings and Hashes can be
  * internally represented in multiple ways. The 'encoding' field of the object
@@ -148,7 +149,7 @@ int checkType(unsigned char t) {
     /* In case a new object type is added, update the following
      * condition as necessary. */
     return
-        (t >= REDIS_HASH_ZIPMAP && t <= REDIS_HASH_ZIPLIST) ||
+        (t >= REDIS_HASH_ZIPMAP && t <= REDIS_LIST_QUICKLIST) ||
         t <= REDIS_HASH ||
         t >= REDIS_EXPIRETIME_MS;
 }
@@ -182,7 +183,7 @@ int processHeader(void) {
     }
 
     dump_version = (int)strtol(buf + 5, NULL, 10);
-    if (dump_version < 1 || dump_version > 6) {
+    if (dump_version < 1 || dump_version > 7) {
         ERROR("Unknown RDB format version: %d\n", dump_version);
     }
     return dump_version;
@@ -418,6 +419,7 @@ int loadPair(entry *e) {
 
     uint32_t length = 0;
     if (e->type == REDIS_LIST ||
+        e->type == REDIS_LIST_QUICKLIST ||
         e->type == REDIS_SET  ||
         e->type == REDIS_ZSET ||
         e->type == REDIS_HASH) {
@@ -440,6 +442,7 @@ int loadPair(entry *e) {
         }
     break;
     case REDIS_LIST:
+    case REDIS_LIST_QUICKLIST:
     case REDIS_SET:
         for (i = 0; i < length; i++) {
             offset = CURR_OFFSET;
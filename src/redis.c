@@ -286,20 +286,30 @@ struct redisCommand redisCommandTable[] = {
     {"pfdebug",pfdebugCommand,-3,"w",0,NULL,0,0,0,0,0},
     {"latency",latencyCommand,-2,"arslt",0,NULL,0,0,0,0,0},
     {"qpush",qpushCommand,-3,"wmF",0,NULL,1,1,1,0,0},
-    {"qpop",qpopCommand,2,"wmF",0,NULL,1,1,1,0,0},
-    {"qjpop",qjpopCommand,2,"wmF",0,NULL,1,1,1,0,0},
-    {"qlen",qlenCommand,2,"rF",0,NULL,1,1,1,0,0},
+    {"qpop",qpopCommand,-2,"wmF",0,NULL,1,1,1,0,0},
+    {"qjpop",qjpopCommand,-2,"wmF",0,NULL,1,1,1,0,0},
+    {"qlen",qlenCommand,-2,"rF",0,NULL,1,1,1,0,0},
     {"qtop",qtopCommand,2,"rF",0,NULL,1,1,1,0,0},
     {"qdel",qdelCommand,2,"wF",0,NULL,1,1,1,0,0},
     {"qat",qatCommand,3,"r",0,NULL,1,1,1,0,0},
     {"qrange",qrangeCommand,4,"r",0,NULL,1,1,1,0,0},
+    {"qscan",qscanCommand,-3,"rR",0,NULL,1,1,1,0,0},
+    {"qcreate",qcreateCommand,-2,"wm",0,NULL,1,1,1,0,0},
+    {"qconfig",qconfigCommand,-3,"w",0,NULL,1,1,1,0,0},
     {"qpoprpush",qpoprpushCommand,3,"wm",0,NULL,1,2,1,0,0},
     {"qpoplpush",qpoplpushCommand,3,"wm",0,NULL,1,2,1,0,0},
     {"lpopqpush",lpopqpushCommand,3,"wm",0,NULL,1,2,1,0,0},
     {"rpopqpush",rpopqpushCommand,3,"wm",0,NULL,1,2,1,0,0},
     {"qrpoplpush",qrpoplpushCommand,3,"wm",0,NULL,1,2,1,0,0},
-    {"qpushx",qpushxCommand,3,"wmF",0,NULL,1,1,1,0,0},
-    {"qinspect",qinspectCommand,2,"rF",0,NULL,1,1,1,0,0}
+    {"qpushx",qpushxCommand,-3,"wmF",0,NULL,1,1,1,0,0},
+    {"qinspect",qinspectCommand,2,"rF",0,NULL,1,1,1,0,0},
+    {"bqpop",bqpopCommand,-3,"ws",0,NULL,1,-2,1,0,0},
+    {"bqpoprpush",bqpoprpushCommand,4,"wms",0,NULL,1,2,1,0,0},
+    {"qreserve",qreserveCommand,-4,"wmR",0,NULL,1,1,1,0,0},
+    {"qack",qackCommand,-3,"wF",0,NULL,1,1,1,0,0},
+    {"qrestoreleases",qrestoreleasesCommand,-3,"wm",0,NULL,1,1,1,0,0},
+    {"qgroup",qgroupCommand,-3,"w",0,NULL,2,2,1,0,0},
+    {"qread",qreadCommand,4,"w",0,NULL,1,1,1,0,0}
 };
 
 struct evictionPoolEntry *evictionPoolAlloc(void);
@@ -495,6 +505,36 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+void dictInfqLeaseDestructor(void *privdata, void *val)
+{
+    infqLease *lease = val;
+
+    DICT_NOTUSED(privdata);
+
+    decrRefCount(lease->value);
+    zfree(lease);
+}
+
+void dictInfqHeldFileDestructor(void *privdata, void *val)
+{
+    infqHeldFile *f = val;
+
+    DICT_NOTUSED(privdata);
+
+    if (f->path) sdsfree(f->path);
+    zfree(f);
+}
+
+void dictReplInfqFileDestructor(void *privdata, void *val)
+{
+    replInfqFile *f = val;
+
+    DICT_NOTUSED(privdata);
+
+    sdsfree(f->path);
+    zfree(f);
+}
+
 void dictInfqMetaDestructor(void *privdata, void *val)
 {
     size_t  s = (size_t)privdata;
@@ -585,6 +625,46 @@ dictType zsetDictType = {
     NULL                       /* val destructor */
 };
 
+/* In flight elements of InfQ, lease ids => infqLease */
+dictType infqLeaseDictType = {
+    dictEncObjHash,            /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictEncObjKeyCompare,      /* key compare */
+    dictRedisObjectDestructor, /* key destructor */
+    dictInfqLeaseDestructor    /* val destructor */
+};
+
+/* InfQ files being sent to slaves, the key is the path of the value. */
+dictType replInfqFileDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    NULL,                       /* key destructor */
+    dictReplInfqFileDestructor  /* val destructor */
+};
+
+/* Consumer groups of an InfQ, sds strings => sequences as signed integers */
+dictType infqGroupDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    NULL                        /* val destructor */
+};
+
+/* InfQ file blocks held by slaves, sds strings => infqHeldFile */
+dictType infqHeldFileDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    dictInfqHeldFileDestructor  /* val destructor */
+};
+
 /* Db->dict, keys are sds strings, vals are Redis objects. */
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
@@ -1286,7 +1366,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     run_with_period(server.infq_unlinker_check_period * 1000) {
         // only continue unlinker which is suspended by replication
         if (server.infq_unlinker_suspend_type == REDIS_INFQ_UNLINKER_SUSPEND_REPL &&
-                !server.repl_diskless_sync && dictSize(server.infq_keys) > 0) {
+                dictSize(server.infq_keys) > 0) {
             listNode *ln;
             listIter li;
 
@@ -1343,6 +1423,14 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         if (server.sentinel_mode) sentinelTimer();
     }
 
+    /* Keep the memory of InfQs in infq-max-memory, and drop the expired
+     * elements at their heads. */
+    run_with_period(1000) {
+        infqCron();
+        infqExpireCron();
+        infqUnlinkerCron();
+    }
+
     /* Cleanup expired MIGRATE cached sockets. */
     run_with_period(1000) {
         migrateCloseTimedoutSockets();
@@ -1358,6 +1446,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 void beforeSleep(struct aeEventLoop *eventLoop) {
     REDIS_NOTUSED(eventLoop);
 
+    /* Read, and parse, the queries of the clients postponed for the I/O
+     * threads, then execute the parsed commands. */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1395,6 +1487,11 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
+
+    /* Send the replies accumulated in this event loop iteration. This is
+     * done after the AOF write so that clients are only answered once the
+     * effects of their commands were written. */
+    handleClientsWithPendingWritesUsingThreads();
 }
 
 /* =========================== Server initialization ======================== */
@@ -1471,6 +1568,9 @@ void createSharedObjects(void) {
     shared.rpop = createStringObject("RPOP",4);
     shared.lpop = createStringObject("LPOP",4);
     shared.lpush = createStringObject("LPUSH",5);
+    shared.qpop = createStringObject("QPOP",4);
+    shared.qjpop = createStringObject("QJPOP",5);
+    shared.qpoprpush = createStringObject("QPOPRPUSH",9);
     for (j = 0; j < REDIS_SHARED_INTEGERS; j++) {
         shared.integers[j] = createObject(REDIS_STRING,(void*)(long)j);
         shared.integers[j]->encoding = REDIS_ENCODING_INT;
@@ -1499,6 +1599,8 @@ void initServerConfig(void) {
     server.arch_bits = (sizeof(long) == 8) ? 64 : 32;
     server.port = REDIS_SERVERPORT;
     server.tcp_backlog = REDIS_TCP_BACKLOG;
+    server.io_threads_num = REDIS_DEFAULT_IO_THREADS;
+    server.io_threads_do_reads = REDIS_DEFAULT_IO_THREADS_DO_READS;
     server.bindaddr_count = 0;
     server.unixsocket = NULL;
     server.unixsocketperm = REDIS_DEFAULT_UNIX_SOCKET_PERM;
@@ -1552,6 +1654,7 @@ void initServerConfig(void) {
     server.hash_max_ziplist_value = REDIS_HASH_MAX_ZIPLIST_VALUE;
     server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
     server.list_max_ziplist_value = REDIS_LIST_MAX_ZIPLIST_VALUE;
+    server.list_compress_depth = REDIS_LIST_COMPRESS_DEPTH;
     server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
     server.zset_max_ziplist_entries = REDIS_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = REDIS_ZSET_MAX_ZIPLIST_VALUE;
@@ -1559,6 +1662,7 @@ void initServerConfig(void) {
     server.shutdown_asap = 0;
     server.repl_ping_slave_period = REDIS_REPL_PING_SLAVE_PERIOD;
     server.repl_timeout = REDIS_REPL_TIMEOUT;
+    server.repl_send_max_time = REDIS_DEFAULT_REPL_SEND_MAX_TIME;
     server.repl_min_slaves_to_write = REDIS_DEFAULT_MIN_SLAVES_TO_WRITE;
     server.repl_min_slaves_max_lag = REDIS_DEFAULT_MIN_SLAVES_MAX_LAG;
     server.cluster_enabled = 0;
@@ -1594,6 +1698,7 @@ void initServerConfig(void) {
     server.repl_slave_ro = REDIS_DEFAULT_SLAVE_READ_ONLY;
     server.repl_down_since = 0; /* Never connected, repl is down since EVER. */
     server.repl_disable_tcp_nodelay = REDIS_DEFAULT_REPL_DISABLE_TCP_NODELAY;
+    server.repl_infq_checksum = REDIS_DEFAULT_REPL_INFQ_CHECKSUM;
     server.repl_diskless_sync = REDIS_DEFAULT_REPL_DISKLESS_SYNC;
     server.repl_diskless_sync_delay = REDIS_DEFAULT_REPL_DISKLESS_SYNC_DELAY;
     server.slave_priority = REDIS_DEFAULT_SLAVE_PRIORITY;
@@ -1629,6 +1734,9 @@ void initServerConfig(void) {
     server.lpushCommand = lookupCommandByCString("lpush");
     server.lpopCommand = lookupCommandByCString("lpop");
     server.rpopCommand = lookupCommandByCString("rpop");
+    server.qpopCommand = lookupCommandByCString("qpop");
+    server.qjpopCommand = lookupCommandByCString("qjpop");
+    server.qpoprpushCommand = lookupCommandByCString("qpoprpush");
 
     /* Slow log */
     server.slowlog_log_slower_than = REDIS_SLOWLOG_LOG_SLOWER_THAN;
@@ -1650,6 +1758,11 @@ void initServerConfig(void) {
     server.infq_pushq_blocks_num = 20;
     server.infq_mem_block_size = 32 * 1024 * 1024;
     server.infq_dump_blocks_usage = 0.5;
+    server.infq_element_encoding = REDIS_ENCODING_INFQ_RAW;
+    server.infq_max_memory = 0;
+    server.infq_max_bg_unlinkers = 0;
+    server.infq_unlinker_rr = 0;
+    server.infq_used_memory = 0;
     server.infq_unlinker_check_period = 5;
 }
 
@@ -1834,6 +1947,10 @@ void resetServerStats(void) {
     server.stat_sync_full = 0;
     server.stat_sync_partial_ok = 0;
     server.stat_sync_partial_err = 0;
+    server.stat_infq_spilled = 0;
+    server.stat_infq_expired = 0;
+    server.stat_infq_files_sent = 0;
+    server.stat_infq_files_kept = 0;
     for (j = 0; j < REDIS_METRIC_COUNT; j++) {
         server.inst_metric[j].idx = 0;
         server.inst_metric[j].last_sample_time = mstime();
@@ -1843,6 +1960,8 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
 }
 
 void initServer(void) {
@@ -1861,6 +1980,8 @@ void initServer(void) {
     server.current_client = NULL;
     server.clients = listCreate();
     server.clients_to_close = listCreate();
+    server.clients_pending_read = listCreate();
+    server.clients_pending_write = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
@@ -1923,6 +2044,9 @@ void initServer(void) {
     server.lastbgsave_try = 0;    /* At startup we never tried to BGSAVE. */
     server.rdb_save_time_last = -1;
     server.rdb_save_time_start = -1;
+    server.rdb_last_infq_jumps = 0;
+    server.rdb_last_infq_jumps_skipped = 0;
+    server.rdb_last_prepare_usec = 0;
     server.dirty = 0;
     resetServerStats();
     /* A few stats we don't want to reset: server startup time, and peak mem. */
@@ -1938,10 +2062,15 @@ void initServer(void) {
     server.infq_unlinker_suspend_type = REDIS_INFQ_UNLINKER_SUSPEND_NONE;
     server.infq_keys = dictCreate(&keyptrDictType, NULL);
     server.repl_infq_temp_dirs = dictCreate(&dbDictType, NULL);
+    server.repl_infq_held_files = dictCreate(&infqHeldFileDictType, NULL);
+    server.repl_infq_open_files = dictCreate(&replInfqFileDictType, NULL);
+    server.repl_infq_file_crcs = dictCreate(&infqHeldFileDictType, NULL);
+    server.repl_infq_file_kept = 0;
     server.repl_infq_file_prefix = NULL;
     server.repl_infq_dir = NULL;
     server.repl_infq_temp_dir = NULL;
     server.repl_infq_data_path = NULL;
+    server.repl_infq_priority = 0;
     server.repl_infq_file_num = -1;
     server.repl_infq_file_cur_num = -1;
     server.repl_infq_keys = NULL;
@@ -1995,6 +2124,7 @@ void initServer(void) {
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    initThreadedIO();
 }
 
 /* Populates the Redis Command Table starting from the hard coded list
@@ -2852,6 +2982,9 @@ sds genRedisInfoString(char *section) {
             "rdb_last_bgsave_status:%s\r\n"
             "rdb_last_bgsave_time_sec:%jd\r\n"
             "rdb_current_bgsave_time_sec:%jd\r\n"
+            "rdb_last_bgsave_infq_jumps:%d\r\n"
+            "rdb_last_bgsave_infq_jumps_skipped:%d\r\n"
+            "rdb_last_bgsave_prepare_usec:%lld\r\n"
             "aof_enabled:%d\r\n"
             "aof_rewrite_in_progress:%d\r\n"
             "aof_rewrite_scheduled:%d\r\n"
@@ -2867,6 +3000,9 @@ sds genRedisInfoString(char *section) {
             (intmax_t)server.rdb_save_time_last,
             (intmax_t)((server.rdb_child_pid == -1) ?
                 -1 : time(NULL)-server.rdb_save_time_start),
+            server.rdb_last_infq_jumps,
+            server.rdb_last_infq_jumps_skipped,
+            server.rdb_last_prepare_usec,
             server.aof_state != REDIS_AOF_OFF,
             server.aof_child_pid != -1,
             server.aof_rewrite_scheduled,
@@ -2949,7 +3085,10 @@ sds genRedisInfoString(char *section) {
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
             "latest_fork_usec:%lld\r\n"
-            "migrate_cached_sockets:%ld\r\n",
+            "migrate_cached_sockets:%ld\r\n"
+            "io_threads_active:%d\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(REDIS_METRIC_COMMAND),
@@ -2968,7 +3107,10 @@ sds genRedisInfoString(char *section) {
             dictSize(server.pubsub_channels),
             listLength(server.pubsub_patterns),
             server.stat_fork_time,
-            dictSize(server.migrate_cached_sockets));
+            dictSize(server.migrate_cached_sockets),
+            server.io_threads_active,
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed);
     }
 
     /* Replication */
@@ -3156,11 +3298,40 @@ sds genRedisInfoString(char *section) {
         if (dictSize(server.infq_keys) == 0) {
             info = sdscatprintf(info, "# InfQ\r\nempty\r\n");
         } else {
+            infqSummary sum;
+
+            getInfqSummary(&sum);
             info = sdscatprintf(info, "# InfQ\r\nmem_block_size:%d, pushq_blocks_num:%d, "
-                    "popq_blocks_num:%d\r\n",
+                    "popq_blocks_num:%d\r\n"
+                    "infq_max_memory:%lld\r\n"
+                    "infq_used_memory:%lld\r\n"
+                    "infq_reserved_memory:%lld\r\n"
+                    "infq_spilled:%lld\r\n"
+                    "infq_expired_elements:%lld\r\n"
+                    "infq_busy_bg_executors:%lld\r\n"
+                    "infq_dump_jobs:%lld\r\n"
+                    "infq_load_jobs:%lld\r\n"
+                    "infq_unlink_jobs:%lld\r\n"
+                    "infq_max_bg_unlinkers:%d\r\n"
+                    "infq_suspended_unlinkers:%lld\r\n"
+                    "infq_repl_files_sent:%lld\r\n"
+                    "infq_repl_files_kept:%lld\r\n",
                     server.infq_mem_block_size,
                     server.infq_pushq_blocks_num,
-                    server.infq_popq_blocks_num);
+                    server.infq_popq_blocks_num,
+                    server.infq_max_memory,
+                    sum.used_memory,
+                    sum.reserved_memory,
+                    server.stat_infq_spilled,
+                    server.stat_infq_expired,
+                    sum.busy_executors,
+                    sum.dump_jobs,
+                    sum.load_jobs,
+                    sum.unlink_jobs,
+                    server.infq_max_bg_unlinkers,
+                    sum.suspended_unlinkers,
+                    server.stat_infq_files_sent,
+                    server.stat_infq_files_kept);
             di = dictGetIterator(server.infq_keys);
             while ((de = dictNext(di)) != NULL) {
                 robj            key, *qobj;
@@ -3174,7 +3345,7 @@ sds genRedisInfoString(char *section) {
                     continue;
                 }
 
-                if (infq_fetch_stats(qobj->ptr, &stats) == INFQ_ERR) {
+                if (infq_fetch_stats(infqPtr(qobj), &stats) == INFQ_ERR) {
                     info = sdscatprintf(info, "%s: Failed to fetch stats\r\n", (char *)key.ptr);
                     continue;
                 }
@@ -3743,17 +3914,32 @@ int iterateInfQ(infq_iter_callback_t cb, void *arg1, void *arg2, int err_stop) {
     di = dictGetIterator(server.infq_keys);
     while ((de = dictNext(di)) != NULL) {
         robj    key, *qobj;
+        infqLane *lane;
+        int     j;
 
         initStaticStringObject(key, dictGetKey(de));
         qobj = lookupKeyRead(dictGetVal(de), &key);
         redisAssert(qobj != NULL && qobj->type == REDIS_INFQ);
 
-        if (cb(qobj->ptr, key.ptr, arg1, arg2) == REDIS_ERR) {
+        if (cb(infqPtr(qobj), key.ptr, arg1, arg2) == REDIS_ERR) {
             redisLog(REDIS_WARNING, "failed to callback on InfQ, key: %s", (char *)key.ptr);
             if (err_stop) {
                 return REDIS_ERR;
             }
         }
+
+        /* The lanes of an InfQ with priorities are infQs of their own. */
+        for (j = 1; j < REDIS_INFQ_PRIORITIES; j++) {
+            if ((lane = ((infqObject *)qobj->ptr)->lanes[j]) == NULL) continue;
+
+            if (cb(lane->q, lane->name ? lane->name : key.ptr, arg1, arg2) == REDIS_ERR) {
+                redisLog(REDIS_WARNING, "failed to callback on lane of InfQ, key: %s, "
+                        "priority: %d", (char *)key.ptr, j);
+                if (err_stop) {
+                    return REDIS_ERR;
+                }
+            }
+        }
     }
 
     return REDIS_OK;
@@ -57,6 +57,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "quicklist.h" /* Lists of ziplists */
 #include "intset.h"  /* Compact integer set structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
@@ -79,6 +80,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_CONFIGLINE_MAX    1024
 #define REDIS_DBCRON_DBS_PER_CALL 16
 #define REDIS_MAX_WRITE_PER_EVENT (1024*64)
+#define REDIS_DEFAULT_IO_THREADS 1
+#define REDIS_IO_THREADS_MAX_NUM 128
+#define REDIS_DEFAULT_IO_THREADS_DO_READS 0
+
+/* Make sure we have enough stack to perform all the things we do in the
+ * main thread. */
+#define REDIS_THREAD_STACK_SIZE (1024*1024*4)
 #define REDIS_SHARED_SELECT_CMDS 10
 #define REDIS_SHARED_INTEGERS 10000
 #define REDIS_SHARED_BULKHDR_LEN 32
@@ -93,6 +101,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_DEFAULT_SLAVE_PRIORITY 100
 #define REDIS_REPL_TIMEOUT 60
 #define REDIS_REPL_PING_SLAVE_PERIOD 10
+#define REDIS_DEFAULT_REPL_SEND_MAX_TIME 2 /* ms */
+#define REDIS_REPL_SEND_CHUNK_LEN (1024*1024)  /* 1mb */
 #define REDIS_RUN_ID_SIZE 40
 #define REDIS_EOF_MARK_SIZE 40
 #define REDIS_DEFAULT_REPL_BACKLOG_SIZE (1024*1024)    /* 1mb */
@@ -116,6 +126,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_DEFAULT_SLAVE_SERVE_STALE_DATA 1
 #define REDIS_DEFAULT_SLAVE_READ_ONLY 1
 #define REDIS_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
+#define REDIS_DEFAULT_REPL_INFQ_CHECKSUM 1
 #define REDIS_DEFAULT_MAXMEMORY 0
 #define REDIS_DEFAULT_MAXMEMORY_SAMPLES 5
 #define REDIS_DEFAULT_AOF_FILENAME "appendonly.aof"
@@ -197,7 +208,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_ENCODING_INTSET 6  /* Encoded as intset */
 #define REDIS_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define REDIS_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
-#define REDIS_ENCODING_INFQ 9
+#define REDIS_ENCODING_INFQ 9  /* InfQ of rdb serialized elements */
+#define REDIS_ENCODING_INFQ_RAW 10 /* InfQ of raw element bytes */
+#define REDIS_ENCODING_QUICKLIST 11 /* Encoded as linked list of ziplists */
+#define REDIS_ENCODING_INFQ_LZF 12 /* InfQ of raw element bytes with a crc64,
+                                      compressed with LZF */
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -252,12 +267,18 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_PRE_PSYNC (1<<16)   /* Instance don't understand PSYNC. */
 #define REDIS_READONLY (1<<17)    /* Cluster client is in read-only state. */
 #define REDIS_PUBSUB (1<<18)      /* Client is in Pub/Sub mode. */
+#define REDIS_PENDING_READ (1<<19) /* Socket to be read by the I/O threads. */
+#define REDIS_PENDING_WRITE (1<<20) /* Replies to be written before sleep. */
+#define REDIS_PENDING_COMMAND (1<<21) /* Command parsed by an I/O thread. */
+#define REDIS_IO_FREE (1<<22)     /* Free once the I/O threads are done. */
+#define REDIS_PROTOCOL_ERROR (1<<23) /* Protocol error to log after reads. */
 
 /* Client block type (btype field in client structure)
  * if REDIS_BLOCKED flag is set. */
 #define REDIS_BLOCKED_NONE 0    /* Not blocked, no REDIS_BLOCKED flag set. */
 #define REDIS_BLOCKED_LIST 1    /* BLPOP & co. */
 #define REDIS_BLOCKED_WAIT 2    /* WAIT for synchronous replication. */
+#define REDIS_BLOCKED_INFQ 3    /* BQPOP & co. */
 
 /* Client request types */
 #define REDIS_REQ_INLINE 1
@@ -289,6 +310,9 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_REPL_ONLINE 9 /* RDB file transmitted, sending just updates. */
 #define REDIS_REPL_SEND_INFQ 10 /* Sending files of InfQ to slave */
 
+/* Capabilities of the slave, advertised with REPLCONF capa. */
+#define REDIS_SLAVE_CAPA_INFQ_CRC (1<<0) /* Checks the crc64 of InfQ files */
+
 /* Synchronous read timeout - slave side */
 #define REDIS_REPL_SYNCIO_TIMEOUT 5
 
@@ -327,6 +351,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_HASH_MAX_ZIPLIST_VALUE 64
 #define REDIS_LIST_MAX_ZIPLIST_ENTRIES 512
 #define REDIS_LIST_MAX_ZIPLIST_VALUE 64
+#define REDIS_LIST_COMPRESS_DEPTH 0
 #define REDIS_SET_MAX_INTSET_ENTRIES 512
 #define REDIS_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define REDIS_ZSET_MAX_ZIPLIST_VALUE 64
@@ -487,11 +512,11 @@ typedef struct blockingState {
     mstime_t timeout;       /* Blocking operation timeout. If UNIX current time
                              * is > timeout then the operation timed out. */
 
-    /* REDIS_BLOCK_LIST */
+    /* REDIS_BLOCK_LIST, REDIS_BLOCK_INFQ */
     dict *keys;             /* The keys we are waiting to terminate a blocking
                              * operation such as BLPOP. Otherwise NULL. */
     robj *target;           /* The key that should receive the element,
-                             * for BRPOPLPUSH. */
+                             * for BRPOPLPUSH and BQPOPRPUSH. */
 
     /* REDIS_BLOCK_WAIT */
     int numreplicas;        /* Number of replicas we are waiting for ACK. */
@@ -532,6 +557,8 @@ typedef struct redisClient {
     long bulklen;           /* length of bulk argument in multi bulk request */
     list *reply;
     unsigned long reply_bytes; /* Tot bytes of objects in reply list */
+    unsigned long reply_written; /* Objects written by an I/O thread, still
+                                    at the head of the reply list. */
     int sentlen;            /* Amount of bytes already sent in the current
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time */
@@ -550,6 +577,7 @@ typedef struct redisClient {
     long long repl_ack_time;/* replication ack time, if this is a slave */
     char replrunid[REDIS_RUN_ID_SIZE+1]; /* master run id if this is a master */
     int slave_listening_port; /* As configured with: SLAVECONF listening-port */
+    int slave_capa;         /* REDIS_SLAVE_CAPA_* advertised by the slave */
     multiState mstate;      /* MULTI/EXEC state */
     int btype;              /* Type of blocking op if REDIS_BLOCKED. */
     blockingState bpop;     /* blocking state */
@@ -569,7 +597,16 @@ typedef struct redisClient {
     int repl_infq_file_suffix;
     listIter *repl_infq_keys_iter; /* at the master, record the order of infq to send to slave */
     sds repl_infq_cur_key;   /* at the master, specify the current infq to send to slave */
+    int repl_infq_cur_priority; /* at the master, lane of the current infq */
     list *repl_infq_files;  /* temporary store the files for master to send to slave */
+    dict *repl_infq_held;   /* at the master, file blocks the slave holds,
+                               "priority:key/block" => infqHeldFile */
+    int repl_infq_checksum; /* at the master, checksumming the file to send */
+    int repl_infq_held_file; /* at the master, the slave holds the file */
+    struct replInfqFile *repl_infq_file; /* at the master, InfQ file being sent,
+                                            shared with other slaves */
+    uint64_t repl_infq_crc; /* checksum of the file being checksummed */
+    uint64_t repl_infq_held_crc; /* checksum of the block held by the slave */
 } redisClient;
 
 struct saveparam {
@@ -585,7 +622,7 @@ struct sharedObjectsStruct {
     *masterdownerr, *roslaveerr, *execaborterr, *noautherr, *noreplicaserr,
     *busykeyerr, *oomerr, *plus, *messagebulk, *pmessagebulk, *subscribebulk,
     *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *del, *rpop, *lpop,
-    *lpush, *emptyscan, *minstring, *maxstring,
+    *lpush, *qpop, *qjpop, *qpoprpush, *emptyscan, *minstring, *maxstring,
     *select[REDIS_SHARED_SELECT_CMDS],
     *integers[REDIS_SHARED_INTEGERS],
     *mbulkhdr[REDIS_SHARED_BULKHDR_LEN], /* "*<value>\r\n" */
@@ -662,6 +699,7 @@ struct clusterState;
 #define REDIS_INFQ_UNLINKER_SUSPEND_NONE    0
 #define REDIS_INFQ_UNLINKER_SUSPEND_REPL    1
 #define REDIS_INFQ_UNLINKER_SUSPEND_RDB     2
+#define REDIS_INFQ_UNLINKER_SUSPEND_AOF     3
 struct redisServer {
     /* General */
     pid_t pid;                  /* Main process pid. */
@@ -694,6 +732,8 @@ struct redisServer {
     int cfd_count;              /* Used slots in cfd[] */
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
+    list *clients_pending_read; /* Clients to read with the I/O threads */
+    list *clients_pending_write; /* Clients with replies to write */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     redisClient *current_client; /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
@@ -701,6 +741,9 @@ struct redisServer {
     char neterr[ANET_ERR_LEN];   /* Error buffer for anet.c */
     dict *migrate_cached_sockets;/* MIGRATE cached sockets */
     uint64_t next_client_id;    /* Next client unique ID. Incremental. */
+    int io_threads_num;         /* Number of I/O threads, main included */
+    int io_threads_do_reads;    /* Also read and parse with the I/O threads */
+    int io_threads_active;      /* True if the I/O threads are running */
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
     off_t loading_total_bytes;
@@ -709,7 +752,8 @@ struct redisServer {
     off_t loading_process_events_interval_bytes;
     /* Fast pointers to often looked up command */
     struct redisCommand *delCommand, *multiCommand, *lpushCommand, *lpopCommand,
-                        *rpopCommand;
+                        *rpopCommand, *qpopCommand, *qjpopCommand,
+                        *qpoprpushCommand;
     /* Fields used only for stats */
     time_t stat_starttime;          /* Server start time */
     long long stat_numcommands;     /* Number of processed commands */
@@ -725,6 +769,8 @@ struct redisServer {
     long long stat_sync_full;       /* Number of full resyncs with slaves. */
     long long stat_sync_partial_ok; /* Number of accepted PSYNC requests. */
     long long stat_sync_partial_err;/* Number of unaccepted PSYNC requests. */
+    long long stat_infq_spilled;    /* InfQs spilled for infq-max-memory */
+    long long stat_infq_expired;    /* InfQ elements dropped as expired */
     list *slowlog;                  /* SLOWLOG list of commands */
     long long slowlog_entry_id;     /* SLOWLOG current entry ID */
     long long slowlog_log_slower_than; /* SLOWLOG time limit (to get logged) */
@@ -732,6 +778,8 @@ struct redisServer {
     size_t resident_set_size;       /* RSS sampled in serverCron(). */
     long long stat_net_input_bytes; /* Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_io_reads_processed; /* Reads done with the I/O threads */
+    long long stat_io_writes_processed; /* Writes done with the I/O threads */
     /* The following two are used to track instantaneous metrics, like
      * number of operations per second, network traffic. */
     struct {
@@ -797,6 +845,9 @@ struct redisServer {
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
     time_t rdb_save_time_start;     /* Current RDB save start time. */
+    int rdb_last_infq_jumps;        /* InfQs jumped before last BGSAVE */
+    int rdb_last_infq_jumps_skipped; /* InfQs with nothing to jump */
+    long long rdb_last_prepare_usec; /* InfQ jump and suspension before fork */
     int rdb_child_type;             /* Type of save by active child. */
     int lastbgsave_status;          /* REDIS_OK or REDIS_ERR */
     int stop_writes_on_bgsave_err;  /* Don't allow writes if can't BGSAVE */
@@ -813,6 +864,8 @@ struct redisServer {
     int slaveseldb;                 /* Last SELECTed DB in replication output */
     long long master_repl_offset;   /* Global replication offset */
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
+    int repl_send_max_time;         /* Max milliseconds sending files to a
+                                       slave in a single writable event */
     char *repl_backlog;             /* Replication backlog for partial syncs */
     long long repl_backlog_size;    /* Backlog circular buffer size */
     long long repl_backlog_histlen; /* Backlog actual data length */
@@ -848,6 +901,7 @@ struct redisServer {
     int repl_slave_ro;          /* Slave is read only? */
     time_t repl_down_since; /* Unix time at which link with master went down */
     int repl_disable_tcp_nodelay;   /* Disable TCP_NODELAY after SYNC? */
+    int repl_infq_checksum;         /* Send crc64 of InfQ files to slaves? */
     int slave_priority;             /* Reported in INFO and used by Sentinel. */
     char repl_master_runid[REDIS_RUN_ID_SIZE+1];  /* Master run id for PSYNC. */
     long long repl_master_initial_offset;         /* Master PSYNC offset. */
@@ -878,6 +932,7 @@ struct redisServer {
     size_t hash_max_ziplist_value;
     size_t list_max_ziplist_entries;
     size_t list_max_ziplist_value;
+    int list_compress_depth;
     size_t set_max_intset_entries;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
@@ -930,9 +985,16 @@ struct redisServer {
     int infq_popq_blocks_num;
     float infq_dump_blocks_usage; /* trigger dump job when blocks used exceed
                                      'infq_dump_blocks_usage'*/
+    int infq_element_encoding; /* encoding of elements for new InfQs,
+                                  REDIS_ENCODING_INFQ, REDIS_ENCODING_INFQ_RAW or
+                                  REDIS_ENCODING_INFQ_LZF */
+    long long infq_max_memory; /* memory budget of the blocks of all InfQs, 0 for no limit */
+    long long infq_used_memory; /* memory used by all InfQs, sampled by infqCron() */
     int infq_unlinker_check_period; /* period(seconds) for check and continue of suspended
                                        unlinker */
     int infq_unlinker_suspend_type; /* unlinker suspend reason. RDB, REPLICATION, NONE */
+    int infq_max_bg_unlinkers; /* InfQs unlinking files at a time, 0 for no limit */
+    unsigned long infq_unlinker_rr; /* round robin of the unlinker slots */
 
     /* Replication for InfQ */
     dict *infq_keys;  /* dict specify InfQ keys => DB(InfQ reside in) */
@@ -941,6 +1003,7 @@ struct redisServer {
     sds repl_infq_data_path;
     sds repl_infq_dir;
     sds repl_infq_key;
+    int repl_infq_priority; /* lane of the InfQ being received, 0 for the InfQ */
     int repl_infq_file_cur_num;
     sds repl_infq_file_prefix;
     int repl_infq_file_suffix;
@@ -950,6 +1013,18 @@ struct redisServer {
     list *repl_infq_keys;   /* temporary store the infq keys for master to send to slave */
     int repl_infq_key_num;  /* count of infq keys need to receive from master */
     int repl_infq_cur_key_num;  /* count of infq key have received from master */
+    dict *repl_infq_file_crcs;  /* at the master, crc64 of the InfQ file
+                                   blocks, path => infqHeldFile */
+    dict *repl_infq_open_files; /* at the master, InfQ files being sent to
+                                   slaves, path => replInfqFile */
+    dict *repl_infq_held_files; /* at the slave, file blocks received from master,
+                                   "priority:key/block" => infqHeldFile */
+    uint64_t repl_infq_file_crc; /* checksum of the file being received */
+    int repl_infq_file_crc_sent; /* the master sent the checksum of the file */
+    uint64_t repl_infq_file_sent_crc;
+    int repl_infq_file_kept;    /* the file is linked from the one held, not received */
+    long long stat_infq_files_sent; /* InfQ files sent to slaves */
+    long long stat_infq_files_kept; /* InfQ files held by slaves, not sent */
     dict *repl_infq_temp_dirs;  /* infq dist dir => infq temp dir.
                                    延迟重命名，在rdb load前，清空db前进行数据文件夹的重命名
                                 */
@@ -1007,14 +1082,14 @@ typedef struct {
     unsigned char encoding;
     unsigned char direction; /* Iteration direction */
     unsigned char *zi;
-    listNode *ln;
+    quicklistIter *iter;
 } listTypeIterator;
 
 /* Structure for an entry while iterating over a list. */
 typedef struct {
     listTypeIterator *li;
     unsigned char *zi;  /* Entry in ziplist */
-    listNode *ln;       /* Entry in linked list */
+    quicklistEntry entry; /* Entry in quicklist */
 } listTypeEntry;
 
 /* Structure to hold set iteration abstraction. */
@@ -1056,6 +1131,10 @@ extern dictType dbDictType;
 extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
+extern dictType infqLeaseDictType;
+extern dictType infqGroupDictType;
+extern dictType infqHeldFileDictType;
+extern dictType replInfqFileDictType;
 extern dictType replScriptCacheDictType;
 
 /*-----------------------------------------------------------------------------
@@ -1077,6 +1156,8 @@ void closeTimedoutClients(void);
 void freeClient(redisClient *c);
 void freeClientAsync(redisClient *c);
 void resetClient(redisClient *c);
+int clientHasPendingReplies(redisClient *c);
+int writeToClient(int fd, redisClient *c, int handler_installed);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *addDeferredMultiBulkLength(redisClient *c);
 void setDeferredMultiBulkLength(redisClient *c, void *node, long length);
@@ -1118,6 +1199,10 @@ int listenToPort(int port, int *fds, int *count);
 void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
+void initThreadedIO(void);
+int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+int handleClientsWithPendingWritesUsingThreads(void);
 
 #ifdef __GNUC__
 void addReplyErrorFormat(redisClient *c, const char *fmt, ...)
@@ -1142,6 +1227,7 @@ void listTypeInsert(listTypeEntry *entry, robj *value, int where);
 int listTypeEqual(listTypeEntry *entry, robj *o);
 void listTypeDelete(listTypeEntry *entry);
 void listTypeConvert(robj *subject, int enc);
+void blockForKeys(redisClient *c, robj **keys, int numkeys, mstime_t timeout, robj *target, int btype);
 void unblockClientWaitingData(redisClient *c);
 void handleClientsBlockedOnLists(void);
 void popGenericCommand(redisClient *c, int where);
@@ -1178,7 +1264,7 @@ robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
-robj *createListObject(void);
+robj *createQuicklistObject(void);
 robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
@@ -1225,6 +1311,7 @@ int replicationCountAcksByOffset(long long offset);
 void replicationSendNewlineToMaster(void);
 long long replicationGetSlaveOffset(void);
 char *replicationGetSlaveName(redisClient *c);
+void closeInfQFileForSlave(redisClient *slave);
 
 /* Generic persistence functions */
 void startLoading(FILE *fp);
@@ -1239,6 +1326,7 @@ void flushAppendOnlyFile(int force);
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
+void continueInfqUnlinkerSuspendedByAof(void);
 int loadAppendOnlyFile(char *filename);
 void stopAppendOnly(void);
 int startAppendOnly(void);
@@ -1589,7 +1677,165 @@ void pfdebugCommand(redisClient *c);
 void latencyCommand(redisClient *c);
 
 /* Support for InfQ */
-robj *createInfqObject(robj *key);
+
+/* An element reserved by QRESERVE, waiting to be acked before 'deadline'. */
+typedef struct infqLease {
+    mstime_t deadline;
+    robj *value;
+} infqLease;
+
+/* In flight elements of an InfQ. 'dict' maps lease ids to infqLease, and
+ * 'zsl' orders the lease ids by deadline to find the expired ones. */
+typedef struct infqLeases {
+    long long next_id;
+    dict *dict;
+    zskiplist *zsl;
+} infqLeases;
+
+/* Memory settings of an InfQ. The server.infq_* options are the defaults of
+ * the InfQs created without their own settings. */
+typedef struct infqConfig {
+    int mem_block_size;
+    int pushq_blocks_num;
+    int popq_blocks_num;
+    float dump_blocks_usage;
+} infqConfig;
+
+/* Elements pushed one after another to an InfQ with expiring elements,
+ * in ('end' - 'len', 'end'] of the push sequence. The run can be dropped at
+ * once without reading its elements when 'max_expire' is reached. */
+typedef struct infqExpireRun {
+    long long end;          /* 'pushed' after the last element of the run */
+    long len;
+    mstime_t max_expire;    /* 0 if an element of the run never expires */
+} infqExpireRun;
+
+/* A lane of an InfQ with priorities, pushed by QPUSH PRIORITY. The lane
+ * is an infQ of its own, named <key>#<priority>. */
+typedef struct infqLane {
+    infq_t *q;
+    sds name;               /* NULL until the key is known when loading */
+    long long pushed;       /* Like 'pushed' of infqObject for the lane */
+    long long jumped_at;
+} infqLane;
+
+/* An InfQ or one of its lanes, as sent to the slaves. The priority is kept
+ * apart from the key as a key may be named like the lane of another InfQ. */
+typedef struct infqQueueName {
+    sds key;                /* Owned by server.infq_keys */
+    int priority;           /* 0 for the InfQ itself */
+} infqQueueName;
+
+#define REDIS_INFQ_PRIORITIES 10        /* Lanes of an InfQ, 0 to 9 */
+#define REDIS_INFQ_LANES_SUFFIX ".lanes" /* Lanes dir: the data path + suffix */
+
+#define REDIS_INFQ_EXPIRE_LEN 8         /* Expire time before each element */
+#define REDIS_INFQ_EXPIRE_RUN_LEN 1024  /* Max elements of infqExpireRun */
+#define REDIS_INFQ_EXPIRE_CRON_MAX 100000 /* Max elements dropped by a cron */
+#define REDIS_INFQ_EXPIRE_BUF_MAX (1024*64) /* Max buffer kept for pushes */
+#define REDIS_INFQ_LZF_HDR_LEN 9        /* Type and crc64 of lzf elements */
+#define REDIS_INFQ_LZF_MIN_LEN 20       /* Shorter elements are not compressed */
+
+/* Value of InfQ keys. The elements are kept by infQ, all the other state
+ * of the queue is kept here. */
+typedef struct infqObject {
+    infq_t *q;
+    infqConfig conf;        /* Settings to create 'q' */
+    int conf_set;           /* 'conf' was given by QCREATE or QCONFIG */
+    int expiring;           /* Elements are prefixed by their expire time */
+    list *expire_runs;      /* infqExpireRun of the pushes to lane 0 since the
+                               InfQ is created or loaded, from the head */
+    infqLane *lanes[REDIS_INFQ_PRIORITIES]; /* Lanes of higher priorities than
+                               'q', the lane 0, NULL until pushed */
+    infqLeases *leases;     /* NULL until QRESERVE is used */
+    dict *groups;           /* Consumer groups, name => sequence of the next
+                               element to read, NULL until QGROUP CREATE */
+    long long pushed;       /* Elements ever pushed to lane 0, the sequence
+                               of QSCAN */
+    long long jumped_at;    /* 'pushed' when the push queue jumped last time,
+                               to spill or before a snapshot */
+    time_t last_push;       /* Time of the last push */
+} infqObject;
+
+#define infqPtr(o) (((infqObject *)(o)->ptr)->q)
+
+/* A file block of InfQ with its checksum. The slave remembers the blocks
+ * it holds, so they are not sent again on full resynchronization if the
+ * checksum of the master's one is the same, and the master remembers the
+ * checksum of its own blocks. */
+typedef struct infqHeldFile {
+    sds path;       /* Path of the file, only at the slave */
+    off_t size;
+    time_t mtime;   /* Only at the slave, to detect the changed files */
+    uint64_t crc;   /* crc64 of the content */
+} infqHeldFile;
+
+/* An InfQ file being sent to slaves. Slaves streaming the same file block
+ * at the same time share the file descriptor and the read-ahead of the file.
+ * Pop blocks change as the InfQ is popped, each slave opens its own. */
+typedef struct replInfqFile {
+    sds path;
+    int fd;
+    off_t size;
+    int shared;         /* In server.repl_infq_open_files */
+    int refcount;       /* Slaves sending the file */
+    time_t mtime;
+    int crc_known;      /* The crc64 of the file is computed */
+    uint64_t crc;
+    off_t readahead;    /* The file is read ahead up to this offset */
+    int next_readahead; /* The next file of the InfQ was read ahead */
+} replInfqFile;
+
+/* Stats of all the InfQs, see getInfqSummary(). */
+typedef struct infqSummary {
+    long long used_memory;      /* Memory used by the blocks */
+    long long reserved_memory;  /* Memory of the blocks allowed by the settings */
+    long long dump_jobs;
+    long long load_jobs;
+    long long unlink_jobs;
+    long long busy_executors;   /* Dumpers, loaders and unlinkers with jobs */
+    long long suspended_unlinkers;
+} infqSummary;
+
+/* Sequential iterator over a range of InfQ elements. */
+typedef struct infqIterator {
+    robj *subject;
+    long index;     /* Index of the next element */
+    long end;       /* Index of the last element, inclusive */
+} infqIterator;
+
+void initInfqConfig(infqConfig *conf);
+void getInfqSummary(infqSummary *sum);
+void infqCron(void);
+int infqJumpPushQueues(int *skipped);
+void infqUnlinkerCron(void);
+robj *createInfqObject(robj *key, infqConfig *conf);
+infq_t *createInfq(const char *dir, const char *subdir, const char *name,
+                   infqConfig *qconf);
+unsigned long infqLength(robj *q);
+int infqHasLanes(robj *o);
+infq_t *infqLaneQueue(robj *o, int priority);
+infq_t *infqHeadQueue(robj *o);
+infqLane *createInfqLane(robj *o, sds key, int priority);
+void freeInfqLane(infqLane *lane);
+void infqNameLanes(robj *o, sds key);
+void infqListQueueNames(list *names);
+infqLeases *createInfqLeases(void);
+void freeInfqLeases(infqLeases *leases);
+unsigned long infqLeasesLength(robj *q);
+long long infqLeaseAdd(robj *q, long long id, robj *value, mstime_t deadline);
+int infqLeaseAck(robj *q, robj *id);
+unsigned long infqGroupsLength(robj *q);
+int infqGroupAdd(robj *q, sds name, long long offset);
+long long infqGroupOffset(robj *q, dictEntry *de);
+robj *infqElementToObject(robj *qobj, const void *dataptr, int size);
+robj *deserialize(const void *dataptr, int size);
+mstime_t infqElementPayload(robj *qobj, const void **dataptr, int *size);
+int infqElementDecode(robj *qobj, const void **dataptr, int *size);
+long infqExpireHead(redisDb *db, robj *key, robj *q);
+void infqExpireCron(void);
+void infqInitIterator(infqIterator *it, robj *subject, long start, long end);
+int infqNext(infqIterator *it, const void **dataptr, int *size);
 void qpushCommand(redisClient *c);
 void qpopCommand(redisClient *c);
 void qlenCommand(redisClient *c);
@@ -1598,6 +1844,9 @@ void qjpopCommand(redisClient *c);
 void qdelCommand(redisClient *c);
 void qatCommand(redisClient *c);
 void qrangeCommand(redisClient *c);
+void qscanCommand(redisClient *c);
+void qcreateCommand(redisClient *c);
+void qconfigCommand(redisClient *c);
 void qpoprpushCommand(redisClient *c);
 void qpoplpushCommand(redisClient *c);
 void rpopqpushCommand(redisClient *c);
@@ -1605,6 +1854,14 @@ void lpopqpushCommand(redisClient *c);
 void qinspectCommand(redisClient *c);
 void qrpoplpushCommand(redisClient *c);
 void qpushxCommand(redisClient *c);
+void qreserveCommand(redisClient *c);
+void qackCommand(redisClient *c);
+void qrestoreleasesCommand(redisClient *c);
+void qgroupCommand(redisClient *c);
+void qreadCommand(redisClient *c);
+void bqpopCommand(redisClient *c);
+void bqpoprpushCommand(redisClient *c);
+int serveClientBlockedOnInfQ(redisClient *receiver, robj *key, robj *dstkey, redisDb *db, robj *q);
 
 /* 用于遍历、回调每一个InfQ实例 */
 typedef int infq_iter_callback_t(infq_t *q, sds key, void *arg1, void* arg2);
@@ -1614,7 +1871,7 @@ int iterateInfQ(infq_iter_callback_t cb, void *arg1, void *arg2, int err_stop);
 void* createInfQMeta();
 int iter_infq_continue_unlinker(infq_t *q, sds key, void *arg1, void *arg2);
 int iter_infq_suspend_callback(infq_t *q, sds key, void *arg1, void *arg2);
-infq_dump_meta_t* fetch_infq_dump_meta(sds infq_key);
+infq_dump_meta_t* fetch_infq_dump_meta(sds infq_key, int priority);
 /* Support for InfQ */
 
 #if defined(__GNUC__)
@@ -0,0 +1,3 @@
+#define REDIS_GIT_SHA1 "09579aa6"
+#define REDIS_GIT_DIRTY "466"
+#define REDIS_BUILD_ID "vm-1792203671"
@@ -37,6 +37,9 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
 
 struct infqFileInfo {
     const char *prefix;
@@ -466,19 +469,20 @@ int startBgsaveForReplication(void) {
     redisLog(REDIS_NOTICE,"Starting BGSAVE for SYNC with target: %s",
         server.repl_diskless_sync ? "slaves sockets" : "disk");
 
+    // check to see if InfQ object exists, suspend its background
+    // unlinker if it exists, the files are sent to the slaves from disk or
+    // streamed by the child
+    if (dictSize(server.infq_keys) > 0) {
+        if (iterateInfQ(iter_infq_suspend_callback, NULL, NULL, 1) == REDIS_ERR) {
+            redisLog(REDIS_WARNING, "failed to suspend infq");
+            return REDIS_ERR;
+        }
+        server.infq_unlinker_suspend_type = REDIS_INFQ_UNLINKER_SUSPEND_REPL;
+    }
+
     if (server.repl_diskless_sync) {
         retval = rdbSaveToSlavesSockets();
     } else {
-        // check to see if InfQ object exists, suspend its background
-        // unlinker if it exists
-        if (dictSize(server.infq_keys) > 0) {
-            if (iterateInfQ(iter_infq_suspend_callback, NULL, NULL, 1) == REDIS_ERR) {
-                redisLog(REDIS_WARNING, "failed to suspend infq");
-                return REDIS_ERR;
-            }
-            server.infq_unlinker_suspend_type = REDIS_INFQ_UNLINKER_SUSPEND_REPL;
-        }
-
         retval = rdbSaveBackground(server.rdb_filename);
     }
     /* Flush the script cache, since we need that slave differences are
@@ -626,6 +630,31 @@ void syncCommand(redisClient *c) {
  * In the future the same command can be used in order to configure
  * the replication to initiate an incremental replication instead of a
  * full resync. */
+/* Parse a file block reported by REPLCONF infq-file, in the form of
+ * <size>:<crc>:<priority>:<key>/<block>, and record it in c->repl_infq_held
+ * by <priority>:<key>/<block>. */
+int addSlaveHeldInfQFile(redisClient *c, sds val) {
+    infqHeldFile *f;
+    long long size;
+    unsigned long long crc;
+    int priority, n, m;
+
+    if (sscanf(val,"%lld:%llu:%n%d:%n",&size,&crc,&n,&priority,&m) != 3 ||
+        size < 0 || priority < 0 || priority >= REDIS_INFQ_PRIORITIES ||
+        strchr(val+m,'/') == NULL) return REDIS_ERR;
+
+    if (c->repl_infq_held == NULL)
+        c->repl_infq_held = dictCreate(&infqHeldFileDictType,NULL);
+
+    f = zmalloc(sizeof(*f));
+    f->path = NULL;
+    f->size = size;
+    f->mtime = 0;
+    f->crc = crc;
+    dictReplace(c->repl_infq_held,sdsnew(val+n),f);
+    return REDIS_OK;
+}
+
 void replconfCommand(redisClient *c) {
     int j;
 
@@ -645,6 +674,11 @@ void replconfCommand(redisClient *c) {
                     &port,NULL) != REDIS_OK))
                 return;
             c->slave_listening_port = port;
+        } else if (!strcasecmp(c->argv[j]->ptr,"capa")) {
+            /* REPLCONF capa <capability> is used by slave to advertise
+             * what it supports, unknown capabilities are ignored. */
+            if (!strcasecmp(c->argv[j+1]->ptr,"infq-crc"))
+                c->slave_capa |= REDIS_SLAVE_CAPA_INFQ_CRC;
         } else if (!strcasecmp(c->argv[j]->ptr,"ack")) {
             /* REPLCONF ACK is used by slave to inform the master the amount
              * of replication stream that it processed so far. It is an
@@ -664,6 +698,15 @@ void replconfCommand(redisClient *c) {
                 putSlaveOnline(c);
             /* Note: this command does not reply anything! */
             return;
+        } else if (!strcasecmp(c->argv[j]->ptr,"infq-file")) {
+            /* REPLCONF infq-file <size>:<crc>:<priority>:<key>/<block> is used by slave
+             * to report a file block of InfQ it holds, so the block is not
+             * sent again on full resynchronization. */
+            if (addSlaveHeldInfQFile(c,c->argv[j+1]->ptr) == REDIS_ERR) {
+                addReplyErrorFormat(c,"Invalid InfQ file: %s",
+                    (char*)c->argv[j+1]->ptr);
+                return;
+            }
         } else if (!strcasecmp(c->argv[j]->ptr,"getack")) {
             /* REPLCONF GETACK is used in order to request an ACK ASAP
              * to the slave. */
@@ -708,38 +751,297 @@ void putSlaveOnline(redisClient *slave) {
     addReplyBulkCString(slave, "\n");
 }
 
-int openAndFillState(redisClient *slave) {
-    struct redis_stat buf;
-    sds path = sdsempty();
+/* Path of the file 'prefix'_'suffix' of the lane 'priority' of the InfQ
+ * 'key' at the master. */
+sds infqFilePath(sds key, int priority, const char *prefix, int suffix) {
     infq_dump_meta_t *dmeta;
 
-    dmeta = fetch_infq_dump_meta(slave->repl_infq_cur_key);
+    dmeta = fetch_infq_dump_meta(key, priority);
     // 'dmeta == NULL' never happens in normal case
     redisAssert(dmeta != NULL);
 
     // TODO: support relative path
-    path = sdscatprintf(path, "%s/%s_%d",
-            dmeta->file_path,
+    return sdscatprintf(sdsempty(), "%s/%s_%d", dmeta->file_path, prefix, suffix);
+}
+
+/* Open the current InfQ file to send to the slave. If other slaves are
+ * sending the same file block, the file descriptor is shared so the data
+ * read from disk for a slave is in the page cache for the others. The file
+ * blocks never change, but a pop block is rewritten as the InfQ is popped,
+ * so its size, mtime and crc are never reused from another slave. */
+int openAndFillState(redisClient *slave) {
+    struct redis_stat buf;
+    replInfqFile *f = NULL;
+    sds path;
+    int fd, shared;
+
+    path = infqFilePath(slave->repl_infq_cur_key,
+            slave->repl_infq_cur_priority,
             slave->repl_infq_file_prefix,
             slave->repl_infq_file_suffix);
-    // NOTICE: each slave may open the file.
-    if ((slave->repldbfd = open(path, O_RDONLY)) == -1 ||
-            redis_fstat(slave->repldbfd, &buf) == -1) {
-        redisLog(REDIS_WARNING, "SYNC failed. Can't open/stat InfQ Files, path: %s, prefix: %s, suffix: %d, err: %s",
-                path,
-                slave->repl_infq_file_prefix,
-                slave->repl_infq_file_suffix,
-                strerror(errno));
-        return REDIS_ERR;
+    shared = !strcmp(slave->repl_infq_file_prefix, INFQ_FILE_BLOCK_PREFIX);
+    if (shared) f = dictFetchValue(server.repl_infq_open_files, path);
+    if (f != NULL) {
+        sdsfree(path);
+    } else {
+        if ((fd = open(path, O_RDONLY)) == -1 ||
+                redis_fstat(fd, &buf) == -1) {
+            redisLog(REDIS_WARNING, "SYNC failed. Can't open/stat InfQ Files, path: %s, prefix: %s, suffix: %d, err: %s",
+                    path,
+                    slave->repl_infq_file_prefix,
+                    slave->repl_infq_file_suffix,
+                    strerror(errno));
+            if (fd != -1) close(fd);
+            sdsfree(path);
+            return REDIS_ERR;
+        }
+#ifdef HAVE_FADVISE
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        f = zmalloc(sizeof(*f));
+        f->path = path;
+        f->fd = fd;
+        f->size = buf.st_size;
+        f->mtime = buf.st_mtime;
+        f->shared = shared;
+        f->crc_known = 0;
+        f->crc = 0;
+        f->refcount = 0;
+        f->readahead = 0;
+        f->next_readahead = 0;
+
+        // the file blocks never change, their checksum may be known already
+        if (shared) {
+            infqHeldFile *c = dictFetchValue(server.repl_infq_file_crcs, path);
+
+            if (c != NULL && c->size == f->size && c->mtime == f->mtime) {
+                f->crc_known = 1;
+                f->crc = c->crc;
+            }
+            dictAdd(server.repl_infq_open_files, f->path, f);
+        }
     }
+    f->refcount++;
+    slave->repl_infq_file = f;
+    slave->repldbfd = f->fd;
     slave->repldboff = 0;
-    slave->repldbsize = buf.st_size;
+    slave->repldbsize = f->size;
 
+    return REDIS_OK;
+}
+
+/* Release the InfQ file the slave is sending, the file is closed once no
+ * slave is sending it. */
+void closeInfQFileForSlave(redisClient *slave) {
+    replInfqFile *f = slave->repl_infq_file;
+
+    if (f == NULL) return;
+    if (--f->refcount == 0) {
+        close(f->fd);
+        if (f->shared) {
+            dictDelete(server.repl_infq_open_files, f->path);
+        } else {
+            sdsfree(f->path);
+            zfree(f);
+        }
+    }
+    slave->repl_infq_file = NULL;
+    slave->repldbfd = -1;
+}
+
+/* Ask the kernel to read ahead the InfQ file the slave is sending, up to
+ * REPL_INFQ_READAHEAD bytes past the slave's offset. As the slaves sending
+ * the same file share the read-ahead, only the one in front triggers it.
+ * Once the whole file is read ahead, the next file of the InfQ is read
+ * ahead too, so that the disk reads are pipelined with the transfer. */
+#define REPL_INFQ_READAHEAD (8*1024*1024)
+void readAheadInfQFile(redisClient *slave) {
+#ifdef HAVE_FADVISE
+    replInfqFile *f = slave->repl_infq_file;
+    listNode *next;
+    sds path;
+    int fd;
+
+    if (f->readahead < f->size &&
+        slave->repldboff + REPL_INFQ_READAHEAD/2 >= f->readahead)
+    {
+        posix_fadvise(f->fd, f->readahead, REPL_INFQ_READAHEAD,
+                POSIX_FADV_WILLNEED);
+        f->readahead += REPL_INFQ_READAHEAD;
+    }
+    if (f->readahead < f->size || f->next_readahead) return;
+
+    f->next_readahead = 1;
+    next = slave->repl_infq_file_iter->next;
+    if (next == NULL) return;
+    path = infqFilePath(slave->repl_infq_cur_key,
+            slave->repl_infq_cur_priority,
+            ((struct infqFileInfo*)next->value)->prefix,
+            ((struct infqFileInfo*)next->value)->suffix);
+    if ((fd = open(path, O_RDONLY)) != -1) {
+        posix_fadvise(fd, 0, REPL_INFQ_READAHEAD, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
     sdsfree(path);
+#else
+    REDIS_NOTUSED(slave);
+#endif
+}
+
+/* Set 'crc' to the crc64 of the file 'fd' at 'path', using the checksum of
+ * the file block remembered by the master if any, since this is called by
+ * the child this doesn't remember the new ones. */
+int checksumFile(int fd, sds path, struct redis_stat *st, uint64_t *crc) {
+    char buf[REDIS_IOBUF_LEN*4];
+    infqHeldFile *c;
+    off_t off;
+    ssize_t nread;
+
+    c = dictFetchValue(server.repl_infq_file_crcs, path);
+    if (c != NULL && c->size == st->st_size && c->mtime == st->st_mtime) {
+        *crc = c->crc;
+        return REDIS_OK;
+    }
 
+    *crc = 0;
+    for (off = 0; off < st->st_size; off += nread) {
+        if ((nread = pread(fd, buf, sizeof(buf), off)) <= 0) {
+            redisLog(REDIS_WARNING, "Read error checksumming InfQ file, "
+                    "path: %s, err: %s", path,
+                    nread == 0 ? "premature EOF" : strerror(errno));
+            return REDIS_ERR;
+        }
+        *crc = crc64(*crc, (unsigned char *)buf, nread);
+    }
     return REDIS_OK;
 }
 
+/* Write the file 'prefix'_'suffix' of the lane 'priority' of the InfQ 'key'
+ * to 'r', preceded by the same file header sendInfQFilesToSlave() sends,
+ * with the crc64 of the file if 'crc' is true. */
+int writeInfQFile(rio *r, sds key, int priority, const char *prefix, int suffix,
+                  int crc) {
+    char buf[REDIS_IOBUF_LEN*4];
+    struct redis_stat st;
+    sds path, header;
+    off_t left;
+    ssize_t nread;
+    int fd, retval = REDIS_ERR;
+
+    path = infqFilePath(key, priority, prefix, suffix);
+    if ((fd = open(path, O_RDONLY)) == -1 || redis_fstat(fd, &st) == -1) {
+        redisLog(REDIS_WARNING, "Can't open/stat InfQ file to stream to slaves, "
+                "path: %s, err: %s", path, strerror(errno));
+        goto end;
+    }
+#ifdef HAVE_FADVISE
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // File Header: File Prefix + File Suffix + File Size [+ crc:<crc64>]
+    header = sdscatprintf(sdsempty(), "$%s %d %lld",
+            prefix, suffix, (long long)st.st_size);
+    if (crc) {
+        uint64_t file_crc;
+
+        if (checksumFile(fd, path, &st, &file_crc) == REDIS_ERR) {
+            sdsfree(header);
+            goto end;
+        }
+        header = sdscatprintf(header, " crc:%llu", (unsigned long long)file_crc);
+    }
+    header = sdscatlen(header, "\r\n", 2);
+    if (rioWrite(r, header, sdslen(header)) == 0) {
+        sdsfree(header);
+        goto end;
+    }
+    sdsfree(header);
+
+    for (left = st.st_size; left > 0; left -= nread) {
+        nread = read(fd, buf, left < (off_t)sizeof(buf) ? left : (off_t)sizeof(buf));
+        if (nread <= 0) {
+            redisLog(REDIS_WARNING, "Read error streaming InfQ file to slaves, "
+                    "path: %s, err: %s", path,
+                    nread == 0 ? "premature EOF" : strerror(errno));
+            goto end;
+        }
+        if (rioWrite(r, buf, nread) == 0) goto end;
+    }
+    retval = REDIS_OK;
+
+end:
+    if (fd != -1) close(fd);
+    sdsfree(path);
+    return retval;
+}
+
+/* Write the files of all the InfQs to 'r', using the same framing the
+ * slave expects after the RDB when the files are sent from disk by
+ * sendInfQFilesToSlave(). This is called by the child streaming the RDB
+ * to the slaves sockets in diskless replication, right after the RDB, so
+ * the files dumped by the child are sent to the slaves in the same stream.
+ * The crc64 of the files is sent if 'crc' is true, which all the slaves
+ * must support. Return REDIS_ERR if the files can't be read or no slave
+ * is left. */
+int replicationWriteInfQFiles(rio *r, int crc) {
+    list *names;
+    listIter li;
+    listNode *ln;
+    infq_dump_meta_t *dmeta;
+    infqQueueName *name;
+    sds header;
+    int i, file_num, retval = REDIS_OK;
+
+    // the lanes of InfQs are sent like InfQs of their own
+    names = listCreate();
+    infqListQueueNames(names);
+
+    // Header: infq_keys_to_send + InfQ Key Num
+    header = sdscatprintf(sdsempty(), "$infq_keys_to_send %lu\r\n",
+            listLength(names));
+    if (rioWrite(r, header, sdslen(header)) == 0) retval = REDIS_ERR;
+    sdsfree(header);
+
+    listRewind(names, &li);
+    while (retval == REDIS_OK && (ln = listNext(&li)) != NULL) {
+        name = listNodeValue(ln);
+        dmeta = fetch_infq_dump_meta(name->key, name->priority);
+        if (dmeta == NULL) {
+            retval = REDIS_ERR;
+            break;
+        }
+
+        // Header: InfQ key + Priority + Data Path + File Num
+        file_num = dmeta->file_meta.file_range.end - dmeta->file_meta.file_range.start
+                + dmeta->popq_meta.file_range.end - dmeta->popq_meta.file_range.start;
+        if (file_num == 0) {
+            header = sdsnew("$# 0 # 0\r\n");
+        } else {
+            header = sdscatprintf(sdsempty(), "$%s %d %s %d\r\n",
+                    name->key, name->priority, dmeta->file_path, file_num);
+        }
+        if (rioWrite(r, header, sdslen(header)) == 0) retval = REDIS_ERR;
+        sdsfree(header);
+
+        for (i = dmeta->file_meta.file_range.start;
+                retval == REDIS_OK && i < dmeta->file_meta.file_range.end; i++) {
+            retval = writeInfQFile(r, name->key, name->priority,
+                    INFQ_FILE_BLOCK_PREFIX, i, crc);
+        }
+        for (i = dmeta->popq_meta.file_range.start;
+                retval == REDIS_OK && i < dmeta->popq_meta.file_range.end; i++) {
+            retval = writeInfQFile(r, name->key, name->priority,
+                    INFQ_POP_BLOCK_PREFIX, i, crc);
+        }
+    }
+    listRelease(names);
+
+    // Make the slave finish recv InfQ files at once, a newline is just a
+    // ping once the slave is online.
+    if (retval == REDIS_OK && rioWrite(r, "\n", 1) == 0) retval = REDIS_ERR;
+    return retval;
+}
+
 void infq_files_free(void *val) {
     if (val != NULL)
         zfree(val);
@@ -797,12 +1099,186 @@ void prepareSendInfQFiles(redisClient *slave, infq_dump_meta_t *dmeta) {
     slave->repldboff = -1;
 }
 
+/* Set when sendfile() turned out not to be supported, so that we don't try
+ * it again for every chunk. */
+static int repl_sendfile_unsupported = 0;
+
+/* Send up to 'len' bytes of 'filefd' at offset 'off' to the socket 'fd'.
+ * sendfile() avoids copying the data to user space, if it is not available
+ * or not supported for these files we fall back to pread() + write().
+ * Returns the number of bytes sent, 0 on premature EOF, -1 on error. */
+ssize_t sendFileChunk(int fd, int filefd, off_t off, size_t len) {
+    char buf[REDIS_IOBUF_LEN];
+    ssize_t nread;
+
+#ifdef HAVE_SENDFILE
+    if (!repl_sendfile_unsupported) {
+        ssize_t nwritten = sendfile(fd,filefd,&off,len);
+
+        if (nwritten != -1 || (errno != EINVAL && errno != ENOSYS))
+            return nwritten;
+        redisLog(REDIS_NOTICE,"sendfile() not supported, falling back to "
+            "read() + write() to send files to slaves: %s", strerror(errno));
+        repl_sendfile_unsupported = 1;
+    }
+#endif
+    if (len > sizeof(buf)) len = sizeof(buf);
+    if ((nread = pread(filefd,buf,len,off)) <= 0) return nread;
+    return write(fd,buf,nread);
+}
+
+/* Send the file open at slave->repldbfd from slave->repldboff onwards, in
+ * chunks of REDIS_REPL_SEND_CHUNK_LEN bytes, until the socket buffer is
+ * full, the whole file is sent or repl-send-max-ms milliseconds elapsed.
+ * Returns REDIS_ERR on error, with errno set to zero on premature EOF. */
+int sendFileToSlave(redisClient *slave) {
+    long long start = ustime();
+    ssize_t nwritten;
+    size_t len;
+
+    while (slave->repldboff < slave->repldbsize) {
+        len = slave->repldbsize - slave->repldboff;
+        if (len > REDIS_REPL_SEND_CHUNK_LEN) len = REDIS_REPL_SEND_CHUNK_LEN;
+        nwritten = sendFileChunk(slave->fd,slave->repldbfd,slave->repldboff,
+                                 len);
+        if (nwritten == -1) {
+            if (errno == EAGAIN) break;
+            return REDIS_ERR;
+        } else if (nwritten == 0) {
+            errno = 0;
+            return REDIS_ERR;
+        }
+        slave->repldboff += nwritten;
+        server.stat_net_output_bytes += nwritten;
+        if ((ustime()-start)/1000 >= server.repl_send_max_time) break;
+    }
+    return REDIS_OK;
+}
+
+/* Return true if the slave reported to hold the current file of the InfQ
+ * transfer with the same size, its checksum is set in
+ * slave->repl_infq_held_crc. Only file blocks are checked, they never change
+ * once written, the pop blocks are always sent. */
+int slaveHoldsInfQFile(redisClient *slave) {
+    infqHeldFile *f;
+    sds name;
+
+    if (slave->repl_infq_held == NULL ||
+        strcmp(slave->repl_infq_file_prefix,INFQ_FILE_BLOCK_PREFIX)) return 0;
+
+    name = sdscatprintf(sdsempty(),"%d:%s/%s_%d",
+            slave->repl_infq_cur_priority,
+            slave->repl_infq_cur_key,
+            slave->repl_infq_file_prefix,
+            slave->repl_infq_file_suffix);
+    f = dictFetchValue(slave->repl_infq_held,name);
+    sdsfree(name);
+    if (f == NULL || f->size != slave->repldbsize) return 0;
+
+    slave->repl_infq_held_crc = f->crc;
+    return 1;
+}
+
+/* Prepare the header of the current file of the InfQ transfer. The slave is
+ * told to keep its own block if it holds one with the same checksum,
+ * otherwise the file is sent, with its checksum if known. */
+void prepareInfQFileHeader(redisClient *slave) {
+    replInfqFile *f = slave->repl_infq_file;
+
+    if (slave->repl_infq_held_file && f->crc_known &&
+        f->crc == slave->repl_infq_held_crc)
+    {
+        // File Header: File Prefix + File Suffix + File Size + keep
+        server.stat_infq_files_kept++;
+        slave->replpreamble = sdscatprintf(sdsempty(), "$%s %d %lld keep\r\n",
+                slave->repl_infq_file_prefix,
+                slave->repl_infq_file_suffix,
+                (long long)slave->repldbsize);
+        closeInfQFileForSlave(slave);
+        slave->repldboff = -1;
+        return;
+    }
+
+    // File Header: File Prefix + File Suffix + File Size [+ crc:<crc64>]
+    // the crc may be known to check a block held by the slave, it is only
+    // sent if enabled and the slave checks it
+    server.stat_infq_files_sent++;
+    slave->replpreamble = sdscatprintf(sdsempty(), "$%s %d %lld",
+            slave->repl_infq_file_prefix,
+            slave->repl_infq_file_suffix,
+            (long long)slave->repldbsize);
+    if (f->crc_known && server.repl_infq_checksum &&
+        (slave->slave_capa & REDIS_SLAVE_CAPA_INFQ_CRC))
+    {
+        slave->replpreamble = sdscatprintf(slave->replpreamble, " crc:%llu",
+                (unsigned long long)f->crc);
+    }
+    slave->replpreamble = sdscatlen(slave->replpreamble, "\r\n", 2);
+    slave->repldboff = 0;
+}
+
+/* Checksum the next part of the current file of the InfQ transfer before
+ * sending it. Once the whole file is read, the checksum is remembered for
+ * the other slaves, and for the next transfers if it is a file block, and
+ * the header of the file is prepared. */
+void checksumInfQFile(redisClient *slave) {
+    unsigned char buf[REDIS_IOBUF_LEN*4];
+    replInfqFile *f = slave->repl_infq_file;
+    ssize_t nread;
+    int j;
+
+    for (j = 0; j < 16 && slave->repldboff < slave->repldbsize; j++) {
+        nread = pread(slave->repldbfd,buf,sizeof(buf),slave->repldboff);
+        if (nread <= 0) {
+            redisLog(REDIS_WARNING, "Read file error checksumming InfQ file for slave, "
+                    "key: %s, prefix: %s, suffix: %d, err: %s",
+                    slave->repl_infq_cur_key,
+                    slave->repl_infq_file_prefix,
+                    slave->repl_infq_file_suffix,
+                    nread == 0 ? "premature EOF" : strerror(errno));
+            freeClient(slave);
+            return;
+        }
+        slave->repl_infq_crc = crc64(slave->repl_infq_crc,buf,nread);
+        slave->repldboff += nread;
+    }
+    if (slave->repldboff < slave->repldbsize) return;
+
+    slave->repl_infq_checksum = 0;
+    f->crc_known = 1;
+    f->crc = slave->repl_infq_crc;
+    if (!strcmp(slave->repl_infq_file_prefix,INFQ_FILE_BLOCK_PREFIX)) {
+        infqHeldFile *c = zmalloc(sizeof(*c));
+
+        c->path = NULL;
+        c->size = f->size;
+        c->mtime = f->mtime;
+        c->crc = f->crc;
+        dictReplace(server.repl_infq_file_crcs,sdsdup(f->path),c);
+    }
+    prepareInfQFileHeader(slave);
+}
+
+/* Forget the checksums of the InfQ file blocks removed since, called from
+ * time to time by replicationCron() while no slave is receiving files. */
+void pruneInfQFileChecksums(void) {
+    dictIterator *di;
+    dictEntry *de;
+    struct redis_stat st;
+
+    di = dictGetSafeIterator(server.repl_infq_file_crcs);
+    while ((de = dictNext(di)) != NULL) {
+        if (redis_stat(dictGetKey(de),&st) == -1)
+            dictDelete(server.repl_infq_file_crcs,dictGetKey(de));
+    }
+    dictReleaseIterator(di);
+}
+
 void sendInfQFilesToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     redisClient *slave = privdata;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
-    char buf[REDIS_IOBUF_LEN];
-    ssize_t nwritten, buflen;
+    ssize_t nwritten;
 
     // Header: infq_keys_to_send + InfQ Key Num
     if (slave->replpreamble) {
@@ -837,10 +1313,11 @@ void sendInfQFilesToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 
     // prepare to send file of next InfQ key
-    // Header: InfQ key + Data Path + File Num
+    // Header: InfQ key + Priority + Data Path + File Num
     if (slave->repl_infq_cur_key == NULL) {
         listNode            *node;
         infq_dump_meta_t    *dmeta;
+        infqQueueName       *name;
         int                 file_num;
 
         node = listNext(slave->repl_infq_keys_iter);
@@ -849,28 +1326,33 @@ void sendInfQFilesToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
             doneSendAllInfQ(slave);
             return;
         }
-        slave->repl_infq_cur_key = node->value;
+        name = node->value;
+        slave->repl_infq_cur_key = name->key;
+        slave->repl_infq_cur_priority = name->priority;
 
         // prepare all files belong the infq to send to slave
-        dmeta = fetch_infq_dump_meta(slave->repl_infq_cur_key);
+        dmeta = fetch_infq_dump_meta(slave->repl_infq_cur_key,
+                slave->repl_infq_cur_priority);
         // 'fmeta == NULL' never happend in normal case
         redisAssert(dmeta != NULL);
 
         file_num = dmeta->file_meta.file_range.end - dmeta->file_meta.file_range.start
                 + dmeta->popq_meta.file_range.end - dmeta->popq_meta.file_range.start;
-        redisLog(REDIS_DEBUG, "start to send InfQ, key: %s, file num: %d",
+        redisLog(REDIS_DEBUG, "start to send InfQ, key: %s, priority: %d, file num: %d",
                 slave->repl_infq_cur_key,
+                slave->repl_infq_cur_priority,
                 file_num);
 
         if (file_num == 0) {
-            slave->replpreamble = sdsnew("$# # 0\r\n");
+            slave->replpreamble = sdsnew("$# 0 # 0\r\n");
             // no files to send, jump to next infq key
             slave->repl_infq_cur_key = NULL;
             return;
         }
 
-        slave->replpreamble = sdscatprintf(sdsempty(), "$%s %s %d\r\n",
+        slave->replpreamble = sdscatprintf(sdsempty(), "$%s %d %s %d\r\n",
                 slave->repl_infq_cur_key,
+                slave->repl_infq_cur_priority,
                 dmeta->file_path,
                 file_num);
         prepareSendInfQFiles(slave, dmeta);
@@ -904,45 +1386,44 @@ void sendInfQFilesToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
             freeClient(slave);
             return;
         }
-        slave->replpreamble = sdscatprintf(sdsempty(), "$%s %d %lld\r\n",
-                slave->repl_infq_file_prefix,
-                slave->repl_infq_file_suffix,
-                (long long)slave->repldbsize);
+
+        // the slave may hold the block already, and the checksum is sent
+        // with the file, checksum the file first if not known yet
+        slave->repl_infq_held_file = slaveHoldsInfQFile(slave);
+        if (!slave->repl_infq_file->crc_known &&
+            (slave->repl_infq_held_file ||
+             (server.repl_infq_checksum &&
+              (slave->slave_capa & REDIS_SLAVE_CAPA_INFQ_CRC)))) {
+            slave->repl_infq_checksum = 1;
+            slave->repl_infq_crc = 0;
+            slave->repldboff = 0;
+            return;
+        }
+        prepareInfQFileHeader(slave);
         return;
     }
 
-    lseek(slave->repldbfd, slave->repldboff, SEEK_SET);
-    buflen = read(slave->repldbfd, buf, REDIS_IOBUF_LEN);
-    if (buflen <= 0) {
-        redisLog(REDIS_WARNING, "Read file error sending InfQ files to slave, "
+    if (slave->repl_infq_checksum) {
+        checksumInfQFile(slave);
+        return;
+    }
+
+    readAheadInfQFile(slave);
+    if (sendFileToSlave(slave) == REDIS_ERR) {
+        redisLog(REDIS_WARNING, "Error sending InfQ file block to slave, "
                 "key: %s, prefix: %s, suffix: %d, err: %s",
                 slave->repl_infq_cur_key,
                 slave->repl_infq_file_prefix,
                 slave->repl_infq_file_suffix,
-                strerror(errno));
+                (errno == 0) ? "premature EOF" : strerror(errno));
         freeClient(slave);
         return;
     }
-    if ((nwritten = write(fd, buf, buflen)) == -1) {
-        if (errno != EAGAIN) {
-            redisLog(REDIS_WARNING, "Write error sending InfQ file block to slave, "
-                    "key: %s, prefix: %s, suffix: %d, err: %s",
-                    slave->repl_infq_cur_key,
-                    slave->repl_infq_file_prefix,
-                    slave->repl_infq_file_suffix,
-                    strerror(errno));
-            freeClient(slave);
-            return;
-        }
-    }
 
-    slave->repldboff += nwritten;
-    server.stat_net_output_bytes += nwritten;
     // finish one file transfer
     if (slave->repldboff == slave->repldbsize) {
-        close(slave->repldbfd);
+        closeInfQFileForSlave(slave);
         slave->repldboff = -1;
-        slave->repldbfd = -1;
     }
 }
 
@@ -950,8 +1431,7 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     redisClient *slave = privdata;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
-    char buf[REDIS_IOBUF_LEN];
-    ssize_t nwritten, buflen;
+    ssize_t nwritten;
 
     /* Before sending the RDB file, we send the preamble as configured by the
      * replication process. Currently the preamble is just the bulk count of
@@ -976,29 +1456,14 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 
     /* If the preamble was already transfered, send the RDB bulk data. */
-    lseek(slave->repldbfd,slave->repldboff,SEEK_SET);
-    buflen = read(slave->repldbfd,buf,REDIS_IOBUF_LEN);
-    if (buflen <= 0) {
-        redisLog(REDIS_WARNING,"Read error sending DB to slave: %s",
-            (buflen == 0) ? "premature EOF" : strerror(errno));
+    if (sendFileToSlave(slave) == REDIS_ERR) {
+        redisLog(REDIS_WARNING,"Error sending DB to slave: %s",
+            (errno == 0) ? "premature EOF" : strerror(errno));
         freeClient(slave);
         return;
     }
-    if ((nwritten = write(fd,buf,buflen)) == -1) {
-        if (errno != EAGAIN) {
-            redisLog(REDIS_WARNING,"Write error sending DB to slave: %s",
-                strerror(errno));
-            freeClient(slave);
-        }
-        return;
-    }
-    slave->repldboff += nwritten;
-    server.stat_net_output_bytes += nwritten;
     // finish rdb file transferring
     if (slave->repldboff == slave->repldbsize) {
-        dictIterator    *di;
-        dictEntry       *de;
-
         close(slave->repldbfd);
         slave->repldbfd = -1;
         aeDeleteFileEvent(server.el,slave->fd,AE_WRITABLE);
@@ -1006,11 +1471,21 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
         // start to transfer InfQ's files if the instance holds InfQ
         // file meta info of InfQ has loaded by rdb process
         // initial state of the slave client
-        if (dictSize(server.infq_keys) == 0) {
+        // NOTICE: fetch the snapshot of current InfQs, avoid to add or remove InfQ
+        //      during the process of file transfer
+        // generate the list of infq keys which need to send to slave, the
+        // lanes of InfQs are sent like InfQs of their own
+        if (server.repl_infq_keys != NULL) {
+            listRelease(server.repl_infq_keys);
+        }
+        server.repl_infq_keys = listCreate();
+        infqListQueueNames(server.repl_infq_keys);
+
+        if (listLength(server.repl_infq_keys) == 0) {
             slave->replpreamble = sdsnew("$infq_keys_to_send 0\r\n");
         } else {
             slave->replpreamble = sdscatprintf(sdsempty(), "$infq_keys_to_send %lu\r\n",
-                    dictSize(server.infq_keys));
+                    listLength(server.repl_infq_keys));
         }
 
         if (aeCreateFileEvent(server.el, slave->fd, AE_WRITABLE, sendInfQFilesToSlave, slave) == AE_ERR) {
@@ -1021,18 +1496,6 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
         slave->repldboff = -1;
         slave->reploff = -1;
 
-        // NOTICE: fetch the snapshot of current InfQs, avoid to add or remove InfQ
-        //      during the process of file transfer
-        // generate the list of infq keys which need to send to slave
-        if (server.repl_infq_keys != NULL) {
-            listRelease(server.repl_infq_keys);
-        }
-        server.repl_infq_keys = listCreate();
-        di = dictGetIterator(server.infq_keys);
-        while ((de = dictNext(di)) != NULL) {
-            listAddNodeTail(server.repl_infq_keys, dictGetKey(de));
-        }
-
         // each slave has own process info of InfQ transfer
         slave->repl_infq_keys_iter = listGetIterator(server.repl_infq_keys, AL_START_HEAD);
     }
@@ -1254,6 +1717,8 @@ void replicationAbortRecvInfQ() {
     clearSds(&server.repl_infq_dir);
     clearSds(&server.repl_infq_data_path);
     clearSds(&server.repl_infq_file_prefix);
+    // the files held may be partially replaced, do a full transfer next time
+    dictEmpty(server.repl_infq_held_files, NULL);
 
     server.repl_state = REDIS_REPL_CONNECT;
 }
@@ -1303,7 +1768,8 @@ int readInfQKeyNumHeader(int fd) {
 
 int readInfQHeader(int fd) {
     char buf[4096], *cp;
-    sds line, *argv, tmp_dir;
+    sds line, *argv, tmp_dir, name;
+    long priority;
     int argc;
 
     if (syncReadLine(fd, buf, 4096, server.repl_syncio_timeout * 1000) == -1) {
@@ -1323,21 +1789,29 @@ int readInfQHeader(int fd) {
         redisLog(REDIS_WARNING, "failed to load InfQ Header");
         return REDIS_ERR;
     }
-    if (argc != 3) {
-        redisLog(REDIS_WARNING, "arg count error, expect 3 args, actual: %d", argc);
+    if (argc != 4) {
+        redisLog(REDIS_WARNING, "arg count error, expect 4 args, actual: %d", argc);
         return REDIS_ERR;
     }
 
-    server.repl_infq_file_num = strtol(argv[2], NULL, 10);
-    // expected: $# # 0\r\n
+    server.repl_infq_file_num = strtol(argv[3], NULL, 10);
+    // expected: $# 0 # 0\r\n
     if (server.repl_infq_file_num == 0) {
         return REDIS_OK;
     }
 
+    if (!string2l(argv[1], sdslen(argv[1]), &priority) ||
+        priority < 0 || priority >= REDIS_INFQ_PRIORITIES)
+    {
+        redisLog(REDIS_WARNING, "invalid priority of InfQ, key: %s, priority: %s",
+                argv[0], argv[1]);
+        return REDIS_ERR;
+    }
     server.repl_infq_key = sdsdup(argv[0]);
+    server.repl_infq_priority = priority;
 
     // Data path that master transfered consists of Data Path + Key, here remove the key.
-    server.repl_infq_data_path = sdsdup(argv[1]);
+    server.repl_infq_data_path = sdsdup(argv[2]);
     cp = server.repl_infq_data_path + (strlen(server.repl_infq_data_path) - 1);
     while (cp >= server.repl_infq_data_path && *cp != '/') {
         cp--;
@@ -1352,19 +1826,28 @@ int readInfQHeader(int fd) {
     }
 
     redisLog(REDIS_NOTICE,
-            "MASTER <-> SLAVE sync: receiving %d InfQ files from master, data path: %s, key: %s",
+            "MASTER <-> SLAVE sync: receiving %d InfQ files from master, data path: %s, key: %s, priority: %d",
             server.repl_infq_file_num,
             server.repl_infq_data_path,
-            server.repl_infq_key);
+            server.repl_infq_key,
+            server.repl_infq_priority);
+
+    // the lanes are kept as <key>#<priority> in the directory of the lanes
+    if (priority == 0) {
+        name = sdsdup(server.repl_infq_key);
+    } else {
+        name = sdscatprintf(sdsempty(), "%s#%ld", server.repl_infq_key, priority);
+    }
 
     // make sure of Data_Path/Key dirs' existence
     tmp_dir = sdscatprintf(sdsempty(), "temp-%s-%d.%ld",
-            server.repl_infq_key, (int)server.unixtime, (long int)getpid());
+            name, (int)server.unixtime, (long int)getpid());
     if (make_sure_dirs(
                 server.repl_infq_data_path,
                 tmp_dir) == REDIS_ERR) {
         redisLog(REDIS_WARNING, "failed to make sure dir, data path: %s, sud dir: %s",
-                server.repl_infq_data_path, server.repl_infq_key);
+                server.repl_infq_data_path, name);
+        sdsfree(name);
         return REDIS_ERR;
     }
 
@@ -1375,11 +1858,12 @@ int readInfQHeader(int fd) {
     server.repl_infq_temp_dir = sdscatprintf(sdsempty(), "%s%s/",
             server.repl_infq_data_path, tmp_dir);
     server.repl_infq_dir = sdscatprintf(sdsempty(), "%s%s/",
-            server.repl_infq_data_path, server.repl_infq_key);
+            server.repl_infq_data_path, name);
     redisLog(REDIS_DEBUG, "[INFQ] tmp dir: %s, dir: %s", server.repl_infq_temp_dir,
             server.repl_infq_dir);
     sdsfreesplitres(argv,argc);
     sdsfree(tmp_dir);
+    sdsfree(name);
     sdsfree(line);
 
     return REDIS_OK;
@@ -1406,7 +1890,9 @@ int readInfQFileHeader(int fd) {
         redisLog(REDIS_WARNING, "failed to load InfQ Header");
         return REDIS_ERR;
     }
-    if (argc != 3) {
+    // the 4th argument is "keep" for the files we hold, or the checksum
+    if (argc != 3 && !(argc == 4 && (!strcmp(argv[3], "keep") ||
+            !strncmp(argv[3], "crc:", 4)))) {
         redisLog(REDIS_WARNING, "arg count error, expect 3, actual: %d", argc);
         return REDIS_ERR;
     }
@@ -1414,14 +1900,33 @@ int readInfQFileHeader(int fd) {
     server.repl_infq_file_prefix = sdsdup(argv[0]);
     server.repl_infq_file_suffix = strtol(argv[1], NULL, 10);
     server.repl_transfer_size = strtol(argv[2], NULL, 10);
+    server.repl_infq_file_crc = 0;
+    server.repl_infq_file_kept = (argc == 4 && !strcmp(argv[3], "keep"));
+    server.repl_infq_file_crc_sent = (argc == 4 && !server.repl_infq_file_kept);
+    if (server.repl_infq_file_crc_sent)
+        server.repl_infq_file_sent_crc = strtoull(argv[3] + 4, NULL, 10);
 
     // create tmp file according to prefix and suffix
     path = sdscatprintf(sdsempty(), "%s%s_%d", server.repl_infq_temp_dir,
             server.repl_infq_file_prefix, server.repl_infq_file_suffix);
-    server.repl_transfer_fd = open(path, O_CREAT | O_WRONLY | O_EXCL, 0644);
-    if (server.repl_transfer_fd == -1) {
-        redisLog(REDIS_WARNING, "failed to create temp file for MASTER <-> SLAVE, err: %s", strerror(errno));
-        return REDIS_ERR;
+    if (server.repl_infq_file_kept) {
+        // the master has the same file as we hold, link it instead
+        sds held = sdscatprintf(sdsempty(), "%s%s_%d", server.repl_infq_dir,
+                server.repl_infq_file_prefix, server.repl_infq_file_suffix);
+        int ret = link(held, path);
+
+        if (ret == -1)
+            redisLog(REDIS_WARNING, "failed to link held InfQ file for MASTER <-> SLAVE, "
+                    "path: %s, err: %s", held, strerror(errno));
+        sdsfree(held);
+        if (ret == -1) return REDIS_ERR;
+        server.repl_transfer_fd = -1;
+    } else {
+        server.repl_transfer_fd = open(path, O_CREAT | O_WRONLY | O_EXCL, 0644);
+        if (server.repl_transfer_fd == -1) {
+            redisLog(REDIS_WARNING, "failed to create temp file for MASTER <-> SLAVE, err: %s", strerror(errno));
+            return REDIS_ERR;
+        }
     }
     sdsfreesplitres(argv, argc);
     sdsfree(path);
@@ -1593,6 +2098,69 @@ void doneReadAllInfQFiles() {
     }
 }
 
+/* Remember a file block received from master, it is reported to the master
+ * on the next full resynchronization so that the same block is not sent
+ * again. Pop blocks are consumed in place and never reported. */
+void holdInfQFile() {
+    struct redis_stat buf;
+    infqHeldFile *f;
+
+    if (strcmp(server.repl_infq_file_prefix, INFQ_FILE_BLOCK_PREFIX)) return;
+    if (server.repl_infq_file_kept || redis_fstat(server.repl_transfer_fd, &buf) == -1) {
+        // kept files are held already, only the path changes after rename
+        sds name = sdscatprintf(sdsempty(), "%d:%s/%s_%d", server.repl_infq_priority,
+                server.repl_infq_key, server.repl_infq_file_prefix,
+                server.repl_infq_file_suffix);
+        if (!server.repl_infq_file_kept) dictDelete(server.repl_infq_held_files, name);
+        sdsfree(name);
+        return;
+    }
+
+    f = zmalloc(sizeof(*f));
+    f->path = sdscatprintf(sdsempty(), "%s%s_%d", server.repl_infq_dir,
+            server.repl_infq_file_prefix, server.repl_infq_file_suffix);
+    f->size = buf.st_size;
+    f->mtime = buf.st_mtime;
+    f->crc = server.repl_infq_file_crc;
+    dictReplace(server.repl_infq_held_files,
+            sdscatprintf(sdsempty(), "%d:%s/%s_%d", server.repl_infq_priority,
+                server.repl_infq_key, server.repl_infq_file_prefix,
+                server.repl_infq_file_suffix), f);
+}
+
+int doneReadOneInfQFile() {
+    if (server.repl_infq_file_crc_sent &&
+        server.repl_infq_file_crc != server.repl_infq_file_sent_crc) {
+        redisLog(REDIS_WARNING, "MASTER <-> SLAVE sync: wrong checksum of a file of InfQ, key: %s, "
+                "prefix: %s, suffix: %d, expected: %llu, actual: %llu",
+                server.repl_infq_key,
+                server.repl_infq_file_prefix,
+                server.repl_infq_file_suffix,
+                (unsigned long long)server.repl_infq_file_sent_crc,
+                (unsigned long long)server.repl_infq_file_crc);
+        return REDIS_ERR;
+    }
+    redisLog(REDIS_NOTICE, "MASTER <-> SLAVE sync: finishing to %s a file of InfQ, key: %s, "
+            "prefix: %s, suffix: %d, size: %lld",
+            server.repl_infq_file_kept ? "keep" : "read",
+            server.repl_infq_key,
+            server.repl_infq_file_prefix,
+            server.repl_infq_file_suffix,
+            (long long)server.repl_transfer_size);
+    holdInfQFile();
+    if (server.repl_transfer_fd != -1) close(server.repl_transfer_fd);
+    server.repl_transfer_size = -1;
+    clearSds(&server.repl_infq_file_prefix);
+
+    // read all files belong to current infq
+    if (server.repl_infq_file_cur_num == server.repl_infq_file_num) {
+        server.repl_infq_cur_key_num++;
+        server.repl_infq_file_num = -1;
+        doneReadOneInfQFiles();
+    }
+    return REDIS_OK;
+}
+
 void readInfQFiles(aeEventLoop *el, int fd, void *privdata, int mask) {
     char buf[4096];
     ssize_t nread, readlen;
@@ -1651,6 +2219,9 @@ void readInfQFiles(aeEventLoop *el, int fd, void *privdata, int mask) {
         server.repl_transfer_read = 0;
         server.repl_transfer_last_fsync_off = 0;
         server.repl_infq_file_cur_num++;
+        if (server.repl_infq_file_kept && doneReadOneInfQFile() == REDIS_ERR) {
+            goto error;
+        }
         return;
     }
 
@@ -1674,6 +2245,8 @@ void readInfQFiles(aeEventLoop *el, int fd, void *privdata, int mask) {
                 strerror(errno));
         goto error;
     }
+    server.repl_infq_file_crc = crc64(server.repl_infq_file_crc,
+            (unsigned char*)buf, nread);
     server.repl_transfer_read += nread;
     if (server.repl_transfer_read >=
         server.repl_transfer_last_fsync_off + REPL_MAX_WRITTEN_BEFORE_FSYNC)
@@ -1686,24 +2259,9 @@ void readInfQFiles(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 
     // finish reading a whole file
-    if (server.repl_transfer_read == server.repl_transfer_size) {
-        redisLog(REDIS_NOTICE, "MASTER <-> SLAVE sync: finishing to read a file of InfQ, key: %s, "
-                "prefix: %s, suffix: %d, size: %lld",
-                server.repl_infq_key,
-                server.repl_infq_file_prefix,
-                server.repl_infq_file_suffix,
-                server.repl_transfer_size);
-        close(server.repl_transfer_fd);
-        server.repl_transfer_size = -1;
-        clearSds(&server.repl_infq_file_prefix);
-
-        // read all files belong to current infq
-        if (server.repl_infq_file_cur_num == server.repl_infq_file_num) {
-            server.repl_infq_cur_key_num++;
-            server.repl_infq_file_num = -1;
-            doneReadOneInfQFiles();
-            return;
-        }
+    if (server.repl_transfer_read == server.repl_transfer_size &&
+        doneReadOneInfQFile() == REDIS_ERR) {
+        goto error;
     }
 
     // 1) need to read the reset part of a file
@@ -1715,6 +2273,28 @@ error:
     return;
 }
 
+/* Return the number of bytes of 'buf' up to the end of the EOF mark, if the
+ * mark ends in 'buf', otherwise 'len'. 'lastbytes' are the last bytes
+ * received before 'buf', as the mark may start there. */
+size_t eofMarkEnd(char *buf, size_t len, char *lastbytes, char *eofmark) {
+    char window[REDIS_RUN_ID_SIZE*2];
+    size_t j, n;
+
+    /* The mark ending in the first REDIS_RUN_ID_SIZE bytes of 'buf'. */
+    n = len < REDIS_RUN_ID_SIZE ? len : REDIS_RUN_ID_SIZE;
+    memcpy(window,lastbytes,REDIS_RUN_ID_SIZE);
+    memcpy(window+REDIS_RUN_ID_SIZE,buf,n);
+    for (j = 1; j <= n; j++) {
+        if (memcmp(window+j,eofmark,REDIS_RUN_ID_SIZE) == 0) return j;
+    }
+    /* The mark ending later, all in 'buf'. */
+    for (j = REDIS_RUN_ID_SIZE+1; j <= len; j++) {
+        if (memcmp(buf+j-REDIS_RUN_ID_SIZE,eofmark,REDIS_RUN_ID_SIZE) == 0)
+            return j;
+    }
+    return len;
+}
+
 void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
     char buf[4096];
     ssize_t nread, readlen;
@@ -1792,7 +2372,15 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         readlen = (left < (signed)sizeof(buf)) ? left : (signed)sizeof(buf);
     }
 
-    nread = read(fd,buf,readlen);
+    if (usemark) {
+        /* The InfQ files follow the EOF mark in the same stream, so we peek
+         * the data first and only consume it up to the mark. */
+        nread = recv(fd,buf,readlen,MSG_PEEK);
+        if (nread > 0)
+            nread = read(fd,buf,eofMarkEnd(buf,nread,lastbytes,eofmark));
+    } else {
+        nread = read(fd,buf,readlen);
+    }
     if (nread <= 0) {
         redisLog(REDIS_WARNING,"I/O error trying to sync with MASTER: %s",
             (nread == -1) ? strerror(errno) : "connection lost");
@@ -1922,6 +2510,77 @@ char *sendSynchronousCommand(int fd, ...) {
     return sdsnew(buf);
 }
 
+/* Send a batch of 'count' infq-file pairs, return non zero on error with
+ * the error message in 'buf'. */
+int slaveSendInfQHeldFilesBatch(int fd, sds args, int count, char *buf,
+                                size_t buflen)
+{
+    sds cmd = sdscatprintf(sdsempty(),"*%d\r\n$8\r\nREPLCONF\r\n",
+                           count*2+1);
+    int err;
+
+    cmd = sdscatlen(cmd,args,sdslen(args));
+    if (syncWrite(fd,cmd,sdslen(cmd),server.repl_syncio_timeout*1000) == -1 ||
+        syncReadLine(fd,buf,buflen,server.repl_syncio_timeout*1000) == -1)
+    {
+        snprintf(buf,buflen,"-I/O error with master: %s",strerror(errno));
+        err = 1;
+    } else {
+        err = buf[0] == '-';
+    }
+    sdsfree(cmd);
+    return err;
+}
+
+/* Send REPLCONF infq-file for every InfQ file block received from master
+ * in a previous synchronization which is still unchanged on disk. Files
+ * which were removed or modified in the meantime are forgotten. The blocks
+ * are reported in batches to avoid a round trip per file. */
+#define REPL_INFQ_FILES_PER_REPLCONF 64
+void slaveSendInfQHeldFiles(int fd) {
+    dictIterator *di;
+    dictEntry *de;
+    struct redis_stat st;
+    sds cmd = sdsempty(), arg;
+    int count = 0, err = 0;
+    char buf[256];
+
+    di = dictGetSafeIterator(server.repl_infq_held_files);
+    while (!err && (de = dictNext(di)) != NULL) {
+        infqHeldFile *f = dictGetVal(de);
+
+        if (redis_stat(f->path,&st) == -1 || st.st_size != f->size ||
+            st.st_mtime != f->mtime)
+        {
+            dictDelete(server.repl_infq_held_files,dictGetKey(de));
+            continue;
+        }
+
+        arg = sdscatprintf(sdsempty(),"%lld:%llu:%s",(long long)f->size,
+                (unsigned long long)f->crc,(char*)dictGetKey(de));
+        cmd = sdscatprintf(cmd,"$9\r\ninfq-file\r\n$%lu\r\n",
+                (unsigned long)sdslen(arg));
+        cmd = sdscatlen(cmd,arg,sdslen(arg));
+        cmd = sdscatlen(cmd,"\r\n",2);
+        sdsfree(arg);
+
+        if (++count == REPL_INFQ_FILES_PER_REPLCONF) {
+            err = slaveSendInfQHeldFilesBatch(fd,cmd,count,buf,sizeof(buf));
+            sdsclear(cmd);
+            count = 0;
+        }
+    }
+    dictReleaseIterator(di);
+    if (!err && count)
+        err = slaveSendInfQHeldFilesBatch(fd,cmd,count,buf,sizeof(buf));
+    sdsfree(cmd);
+    if (err) {
+        /* Not critical, the blocks will just be sent again. */
+        redisLog(REDIS_NOTICE,"(Non critical) Master does not accept the InfQ "
+            "files held: %s", buf);
+    }
+}
+
 /* Try a partial resynchronization with the master if we are about to reconnect.
  * If there is no cached master structure, at least try to issue a
  * "PSYNC ? -1" command in order to trigger a full resync using the PSYNC
@@ -2138,6 +2797,18 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         sdsfree(err);
     }
 
+    /* Tell the master we check the crc64 of the InfQ files, so it can
+     * send it in the header of the files. */
+    err = sendSynchronousCommand(fd,"REPLCONF","capa","infq-crc",NULL);
+    if (err[0] == '-') {
+        redisLog(REDIS_NOTICE,"(Non critical) Master does not understand REPLCONF capa: %s", err);
+    }
+    sdsfree(err);
+
+    /* Report the InfQ file blocks we hold, so that on full resync the
+     * master only sends the blocks we don't have. */
+    slaveSendInfQHeldFiles(fd);
+
     /* Try a partial resynchonization. If we don't have a cached master
      * slaveTryPartialResynchronization() will at least try to use PSYNC
      * to start a full resynchronization so that we get the master run id
@@ -2431,6 +3102,15 @@ void replicationCacheMaster(redisClient *c) {
     redisAssert(ln != NULL);
     listDelNode(server.clients,ln);
 
+    /* Its socket is closed below, so don't try to write the replies that
+     * are still pending. */
+    if (c->flags & REDIS_PENDING_WRITE) {
+        ln = listSearchKey(server.clients_pending_write,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_write,ln);
+        c->flags &= ~REDIS_PENDING_WRITE;
+    }
+
     /* Save the master. Server.master will be set to null later by
      * replicationHandleMasterDisconnection(). */
     server.cached_master = server.master;
@@ -2762,6 +3442,8 @@ long long replicationGetSlaveOffset(void) {
 
 /* Replication cron function, called 1 time per second. */
 void replicationCron(void) {
+    static time_t infq_crcs_pruned = 0;
+
     /* Non blocking connection timeout? */
     if (server.masterhost &&
         (server.repl_state == REDIS_REPL_CONNECTING ||
@@ -2925,6 +3607,16 @@ void replicationCron(void) {
         }
     }
 
+    /* Forget the checksums of the InfQ file blocks removed in the meantime,
+     * once per minute while no file is being sent. */
+    if (dictSize(server.repl_infq_file_crcs) &&
+        dictSize(server.repl_infq_open_files) == 0 &&
+        server.unixtime - infq_crcs_pruned >= 60)
+    {
+        pruneInfQFileChecksums();
+        infq_crcs_pruned = server.unixtime;
+    }
+
     /* Refresh the number of slaves with lag <= min-slaves-max-lag. */
     refreshGoodSlavesCount();
 }
@@ -7,45 +7,234 @@
 
 #include "redis.h"
 #include "infq.h"
+#include "endianconv.h"
+#include "lzf.h"
 
 #include <sys/mman.h>
 
-#define INFQ_AT_MAX_BUF_SIZE    100 * 1024
-
-infq_dump_meta_t* fetch_infq_dump_meta(sds infq_key) {
+/* Fetch the dump meta of the InfQ 'infq_key', or of its lane 'priority'
+ * if 'priority' is not 0. */
+infq_dump_meta_t* fetch_infq_dump_meta(sds infq_key, int priority) {
     redisDb *db;
     robj    *qobj;
     infq_t  *q;
 
     db = (redisDb *)dictFetchValue(server.infq_keys, infq_key);
+    qobj = db ? dictFetchValue(db->dict, infq_key) : NULL;
+
     if (db == NULL) {
         redisLog(REDIS_WARNING, "no db attached to infq, key: %s", infq_key);
         return NULL;
     }
-
-    qobj = dictFetchValue(db->dict, infq_key);
     if (qobj == NULL || qobj->type != REDIS_INFQ) {
         redisLog(REDIS_WARNING, "no object or not a infq obj specified by key, key: %s", infq_key);
         return NULL;
     }
 
-    q = (infq_t *)qobj->ptr;
+    if ((q = infqLaneQueue(qobj, priority)) == NULL) {
+        redisLog(REDIS_WARNING, "no lane of infq, key: %s, priority: %d", infq_key, priority);
+        return NULL;
+    }
     return infq_fetch_dump_meta(q);
 }
 
 unsigned long infqLength(robj *q) {
-    if (q->encoding == REDIS_ENCODING_INFQ) {
-        return infq_size(q->ptr);
+    unsigned long   len = 0;
+    int             j;
+
+    if (q->encoding == REDIS_ENCODING_INFQ || q->encoding == REDIS_ENCODING_INFQ_RAW ||
+            q->encoding == REDIS_ENCODING_INFQ_LZF) {
+        len = infq_size(infqPtr(q));
+        for (j = 1; j < REDIS_INFQ_PRIORITIES; j++) {
+            if (((infqObject *)q->ptr)->lanes[j]) {
+                len += infq_size(((infqObject *)q->ptr)->lanes[j]->q);
+            }
+        }
+        return len;
     } else {
         redisPanic("Not a infQ");
     }
 }
 
-robj* createInfQ(robj *key, redisDb *db) {
+// fetch the InfQ of an entry in server.infq_keys, without touching the LRU
+static robj *infqFromKeysEntry(dictEntry *de) {
+    redisDb     *db = dictGetVal(de);
+    dictEntry   *kde;
+
+    kde = dictFind(db->dict, dictGetKey(de));
+    return kde ? dictGetVal(kde) : NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Priority lanes of InfQ
+ *
+ * QPUSH PRIORITY p pushes to the lane p of an InfQ, an infQ of its own kept
+ * by the infqObject, and the pops always serve the highest non empty lane.
+ * The lane 0 is 'q' of the InfQ, pushed without priority. The elements are
+ * indexed in the order they are served, from the head of the highest lane to
+ * the tail of lane 0. A lane is created by its first push, and is saved,
+ * loaded and replicated with the InfQ under the name <key>#<priority>. As
+ * every key can have a directory named after it in the data path, the files
+ * of the lanes are kept next to it, in the data path with the suffix
+ * REDIS_INFQ_LANES_SUFFIX.
+ *----------------------------------------------------------------------------*/
+
+int infqHasLanes(robj *o) {
+    int j;
+
+    for (j = 1; j < REDIS_INFQ_PRIORITIES; j++) {
+        if (((infqObject *)o->ptr)->lanes[j]) return 1;
+    }
+    return 0;
+}
+
+// the infQ of the lane 'priority', NULL if nothing was pushed to it
+infq_t *infqLaneQueue(robj *o, int priority) {
+    infqObject  *qo = o->ptr;
+
+    if (priority == 0) {
+        return qo->q;
+    }
+    return qo->lanes[priority] ? qo->lanes[priority]->q : NULL;
+}
+
+// the infQ served by the next pop, the highest non empty lane or lane 0
+infq_t *infqHeadQueue(robj *o) {
+    infqObject  *qo = o->ptr;
+    int         j;
+
+    for (j = REDIS_INFQ_PRIORITIES - 1; j > 0; j--) {
+        if (qo->lanes[j] && infq_size(qo->lanes[j]->q) > 0) {
+            return qo->lanes[j]->q;
+        }
+    }
+    return qo->q;
+}
+
+// the elements ever pushed to the lane 'priority', the sequence of QSCAN
+static long long infqLanePushed(robj *o, int priority) {
+    infqObject  *qo = o->ptr;
+
+    return priority == 0 ? qo->pushed : qo->lanes[priority]->pushed;
+}
+
+// the directory of the lanes, the data path with REDIS_INFQ_LANES_SUFFIX
+static sds infqLanesPath(void) {
+    sds     path = sdsnew(server.infq_data_path);
+
+    while (sdslen(path) > 1 && path[sdslen(path) - 1] == '/') {
+        sdsrange(path, 0, -2);
+    }
+    return sdscat(path, REDIS_INFQ_LANES_SUFFIX);
+}
+
+/* Create the lane 'priority' of the InfQ 'o' of 'key' with the settings of
+ * the InfQ. When loading, 'key' is NULL and the lane is created like the
+ * InfQs loaded, to be named by infqNameLanes() once the key is known. */
+infqLane *createInfqLane(robj *o, sds key, int priority) {
+    infqObject  *qo = o->ptr;
+    infqLane    *lane;
+    sds         name = NULL, dir = NULL;
+    infq_t      *q;
+
+    if (key != NULL) {
+        name = sdscatprintf(sdsempty(), "%s#%d", key, priority);
+        dir = infqLanesPath();
+    }
+
+    q = createInfq(dir, name, name, &qo->conf);
+    sdsfree(dir);
+    if (q == NULL) {
+        redisLog(REDIS_WARNING, "failed to create lane of InfQ, key: %s, priority: %d",
+                key ? key : "", priority);
+        sdsfree(name);
+        return NULL;
+    }
+
+    lane = zmalloc(sizeof(*lane));
+    lane->q = q;
+    lane->name = name;
+    lane->pushed = 0;
+    lane->jumped_at = 0;
+    qo->lanes[priority] = lane;
+    return lane;
+}
+
+void freeInfqLane(infqLane *lane) {
+    infq_destroy_completely(lane->q);
+    sdsfree(lane->name);
+    zfree(lane);
+}
+
+// name the lanes of an InfQ loaded from rdb
+void infqNameLanes(robj *o, sds key) {
+    infqObject  *qo = o->ptr;
+    int         j;
+
+    for (j = 1; j < REDIS_INFQ_PRIORITIES; j++) {
+        if (qo->lanes[j] && qo->lanes[j]->name == NULL) {
+            qo->lanes[j]->name = sdscatprintf(sdsempty(), "%s#%d", key, j);
+        }
+    }
+}
+
+static void infqListQueueName(list *names, sds key, int priority) {
+    infqQueueName   *name = zmalloc(sizeof(*name));
+
+    name->key = key;
+    name->priority = priority;
+    listAddNodeTail(names, name);
+}
+
+/* Add an infqQueueName for all the InfQs and their lanes to 'names', which
+ * frees them. The keys are owned by the InfQs. See fetch_infq_dump_meta(). */
+void infqListQueueNames(list *names) {
+    dictIterator    *di;
+    dictEntry       *de;
+    robj            *qobj;
+    infqObject      *qo;
+    int             j;
+
+    listSetFreeMethod(names, zfree);
+    di = dictGetIterator(server.infq_keys);
+    while ((de = dictNext(di)) != NULL) {
+        infqListQueueName(names, dictGetKey(de), 0);
+        if ((qobj = infqFromKeysEntry(de)) == NULL) continue;
+
+        qo = qobj->ptr;
+        for (j = REDIS_INFQ_PRIORITIES - 1; j > 0; j--) {
+            if (qo->lanes[j] && qo->lanes[j]->name) {
+                infqListQueueName(names, dictGetKey(de), j);
+            }
+        }
+    }
+    dictReleaseIterator(di);
+}
+
+/* Fetch the element at 'index' in the order of the pops, across the lanes.
+ * Returns INFQ_OK or INFQ_ERR like infq_at_zero_cp(). */
+static int infqAt(robj *o, long index, const void **dataptr, int *size) {
+    infq_t  *q;
+    long    len;
+    int     j;
+
+    for (j = REDIS_INFQ_PRIORITIES - 1; j >= 0; j--) {
+        if ((q = infqLaneQueue(o, j)) == NULL) continue;
+
+        len = infq_size(q);
+        if (index < len) {
+            return infq_at_zero_cp(q, index, dataptr, size);
+        }
+        index -= len;
+    }
+    return INFQ_ERR;
+}
+
+robj* createInfQ(robj *key, redisDb *db, infqConfig *conf) {
     robj        *q;
     dictEntry   *de;
 
-    q = createInfqObject(key);
+    q = createInfqObject(key, conf);
     if (q == NULL) {
         redisLog(REDIS_WARNING, "failed to create InfQ, key: %s", (sds)key->ptr);
         return NULL;
@@ -61,36 +250,265 @@ robj* createInfQ(robj *key, redisDb *db) {
     return q;
 }
 
-int pushObj(robj *qobj, robj *val) {
+/* The elements of an expiring InfQ are prefixed by their expire time, an
+ * unix time in milliseconds in little endian, 0 if the element never
+ * expires. They are built here before being copied to InfQ. */
+static sds infq_expire_buf = NULL;
+
+// add an element pushed to an expiring InfQ to the last run of its pushes
+static void infqAddToExpireRuns(infqObject *qo, mstime_t expire) {
+    infqExpireRun   *run = NULL;
+    listNode        *ln;
+
+    if (qo->expire_runs == NULL) {
+        qo->expire_runs = listCreate();
+        listSetFreeMethod(qo->expire_runs, zfree);
+    }
+
+    if ((ln = listLast(qo->expire_runs)) != NULL) {
+        run = listNodeValue(ln);
+    }
+    if (run == NULL || run->len == REDIS_INFQ_EXPIRE_RUN_LEN) {
+        run = zmalloc(sizeof(*run));
+        run->len = 0;
+        run->max_expire = expire;
+        listAddNodeTail(qo->expire_runs, run);
+    }
+
+    if (run->max_expire != 0 && (expire == 0 || expire > run->max_expire)) {
+        run->max_expire = expire;
+    }
+    run->end = qo->pushed;
+    run->len++;
+}
+
+/* Push an element to the lane 'priority' of InfQ, counting the pushed
+ * elements for QSCAN. 'expire' is kept with the element if the InfQ is
+ * expiring, and ignored otherwise. The lane must have been created, see
+ * createInfqLane(). */
+int infqPushElement(robj *qobj, const void *data, size_t len, mstime_t expire, int priority) {
+    infqObject  *qo = qobj->ptr;
+    infqLane    *lane = priority ? qo->lanes[priority] : NULL;
+    uint64_t    header;
+
+    if (qo->expiring) {
+        header = expire;
+        memrev64ifbe(&header);
+        if (infq_expire_buf == NULL) {
+            infq_expire_buf = sdsempty();
+        }
+        sdsclear(infq_expire_buf);
+        infq_expire_buf = sdscatlen(infq_expire_buf, &header, sizeof(header));
+        infq_expire_buf = sdscatlen(infq_expire_buf, data, len);
+        data = infq_expire_buf;
+        len = sdslen(infq_expire_buf);
+    }
+
+    if (infq_push(lane ? lane->q : qo->q, (void *)data, len) == INFQ_ERR) {
+        return REDIS_ERR;
+    }
+
+    qo->last_push = server.unixtime;
+    if (lane) {
+        lane->pushed++;
+    } else {
+        qo->pushed++;
+    }
+    if (qo->expiring) {
+        // the runs are only tracked for lane 0, see infqDropExpiredRuns()
+        if (!lane) infqAddToExpireRuns(qo, expire);
+
+        // don't keep the memory of a large element
+        if (sdsAllocSize(infq_expire_buf) > REDIS_INFQ_EXPIRE_BUF_MAX) {
+            sdsfree(infq_expire_buf);
+            infq_expire_buf = NULL;
+        }
+    }
+    return REDIS_OK;
+}
+
+/* The elements of an InfQ of encoding REDIS_ENCODING_INFQ_LZF are prefixed,
+ * after their expire time if any, by their type and the crc64 of their
+ * bytes, in little endian. The elements longer than REDIS_INFQ_LZF_MIN_LEN
+ * are compressed with LZF if it saves space, and their length follows the
+ * crc64. The crc64 is checked when the element is read back from infQ, so
+ * a block corrupted on disk is never replied. */
+#define INFQ_LZF_PLAIN 0
+#define INFQ_LZF_COMPRESSED 1
+static sds infq_lzf_buf = NULL;     /* Element encoded for a push */
+static sds infq_lzf_dbuf = NULL;    /* Element decoded for a read */
+
+// return an empty buffer with room for 'len' bytes, a large one is freed
+static sds infqLzfBuffer(sds buf, size_t len) {
+    if (buf != NULL && len <= REDIS_INFQ_EXPIRE_BUF_MAX &&
+            sdsAllocSize(buf) > REDIS_INFQ_EXPIRE_BUF_MAX) {
+        sdsfree(buf);
+        buf = NULL;
+    }
+    if (buf == NULL) {
+        buf = sdsempty();
+    }
+    sdsclear(buf);
+    return sdsMakeRoomFor(buf, len);
+}
+
+// encode the bytes of an element of an lzf encoded InfQ, see above
+static void infqLzfEncode(const void **dataptr, size_t *len) {
+    uint64_t    crc = crc64(0, *dataptr, *len);
+    uint32_t    rawlen = *len;
+    size_t      comprlen = 0;
+    char        *p;
+
+    infq_lzf_buf = infqLzfBuffer(infq_lzf_buf, REDIS_INFQ_LZF_HDR_LEN + *len);
+    p = infq_lzf_buf;
+    memrev64ifbe(&crc);
+    memcpy(p + 1, &crc, sizeof(crc));
+
+    // the length takes 4 bytes, at least one more has to be saved
+    if (*len > REDIS_INFQ_LZF_MIN_LEN) {
+        comprlen = lzf_compress(*dataptr, *len, p + REDIS_INFQ_LZF_HDR_LEN + 4,
+                *len - 5);
+    }
+    if (comprlen > 0) {
+        p[0] = INFQ_LZF_COMPRESSED;
+        memrev32ifbe(&rawlen);
+        memcpy(p + REDIS_INFQ_LZF_HDR_LEN, &rawlen, sizeof(rawlen));
+        *len = REDIS_INFQ_LZF_HDR_LEN + 4 + comprlen;
+    } else {
+        p[0] = INFQ_LZF_PLAIN;
+        memcpy(p + REDIS_INFQ_LZF_HDR_LEN, *dataptr, *len);
+        *len += REDIS_INFQ_LZF_HDR_LEN;
+    }
+    *dataptr = p;
+}
+
+/* Decode an element fetched from an lzf encoded InfQ, after its expire time
+ * is skipped, and check its crc64. The bytes of a compressed element are
+ * valid until the next element is decoded. The elements of the other
+ * encodings are left as they are. Returns REDIS_ERR if the element is
+ * corrupted. */
+int infqElementDecode(robj *qobj, const void **dataptr, int *size) {
+    const unsigned char *p = *dataptr;
+    const void          *data;
+    uint64_t            crc;
+    uint32_t            rawlen;
+    size_t              len;
+
+    if (qobj->encoding != REDIS_ENCODING_INFQ_LZF) return REDIS_OK;
+    if (*size < REDIS_INFQ_LZF_HDR_LEN) goto corrupted;
+
+    memcpy(&crc, p + 1, sizeof(crc));
+    memrev64ifbe(&crc);
+    if (p[0] == INFQ_LZF_PLAIN) {
+        data = p + REDIS_INFQ_LZF_HDR_LEN;
+        len = *size - REDIS_INFQ_LZF_HDR_LEN;
+    } else if (p[0] == INFQ_LZF_COMPRESSED && *size > REDIS_INFQ_LZF_HDR_LEN + 4) {
+        memcpy(&rawlen, p + REDIS_INFQ_LZF_HDR_LEN, sizeof(rawlen));
+        memrev32ifbe(&rawlen);
+        // elements are pushed as bulk strings, don't trust a larger length
+        if (rawlen > 512*1024*1024) goto corrupted;
+
+        infq_lzf_dbuf = infqLzfBuffer(infq_lzf_dbuf, rawlen);
+        if (lzf_decompress(p + REDIS_INFQ_LZF_HDR_LEN + 4,
+                    *size - REDIS_INFQ_LZF_HDR_LEN - 4,
+                    infq_lzf_dbuf, rawlen) != rawlen) {
+            goto corrupted;
+        }
+        data = infq_lzf_dbuf;
+        len = rawlen;
+    } else {
+        goto corrupted;
+    }
+
+    if (crc64(0, data, len) != crc) goto corrupted;
+    *dataptr = data;
+    *size = len;
+    return REDIS_OK;
+
+corrupted:
+    redisLog(REDIS_WARNING, "corrupted element of InfQ, type: %d, size: %d",
+            *size > 0 ? p[0] : -1, *size);
+    return REDIS_ERR;
+}
+
+// push the bytes of a string object to InfQ without any serialization
+int pushRawObj(robj *qobj, robj *val, mstime_t expire, int priority) {
+    char        buf[REDIS_LONGSTR_SIZE];
+    const void  *ptr;
+    size_t      len;
+
+    if (sdsEncodedObject(val)) {
+        ptr = val->ptr;
+        len = sdslen(val->ptr);
+    } else if (val->encoding == REDIS_ENCODING_INT) {
+        len = ll2string(buf, sizeof(buf), (long)val->ptr);
+        ptr = buf;
+    } else {
+        redisPanic("Unknown string encoding");
+    }
+
+    if (qobj->encoding == REDIS_ENCODING_INFQ_LZF) {
+        infqLzfEncode(&ptr, &len);
+    }
+
+    if (infqPushElement(qobj, ptr, len, expire, priority) == REDIS_ERR) {
+        redisLog(REDIS_WARNING, "failed to push infq, len: %zu", len);
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+/* Push 'count' objects to InfQ in order, and return the number of objects
+ * pushed before the first failure.
+ *
+ * For rdb encoded InfQ, a single serialization buffer and rio are shared by
+ * all the objects of the batch, so a QPUSH with many values doesn't pay an
+ * allocation per value. The objects in 'vals' may be replaced by their
+ * compact encoding. All the objects are pushed with the expire time
+ * 'expire' to the lane 'priority', see infqPushElement(). */
+int pushObjs(robj *qobj, robj **vals, int count, mstime_t expire, int priority) {
     sds     s;
     rio     r;
-    int     data_size, ret;
+    int     j, data_size;
     size_t  size;
     void    *raw_data;
 
-    // serialize robj to raw buffer
-    s = sdsempty();
-    rioInitWithBuffer(&r, s);
-    data_size = rdbSaveObject(&r, val);
-
-    // NOTICE: memory address of sds is changed when the space is increased
-    s = r.io.buffer.ptr;
-    redisAssert((size_t)data_size == sdslen(s));
-
-    // fetch the start pointer which point to the sdshdr and the length of sdshdr and data
-    sdsraw(s, &raw_data, &size);
-    // NOTICE: avoid the copy from robj => buffer
-    ret = REDIS_OK;
-    if (infq_push(qobj->ptr, raw_data, size) == INFQ_ERR) {
-        redisLog(REDIS_WARNING, "failed to push infq, data: %s, len: %d", s, data_size);
-        ret = REDIS_ERR;
+    if (qobj->encoding != REDIS_ENCODING_INFQ) {
+        for (j = 0; j < count; j++) {
+            if (pushRawObj(qobj, vals[j], expire, priority) == REDIS_ERR) break;
+        }
+        return j;
     }
 
-    if (s != NULL) {
-        sdsfree(s);
+    s = sdsempty();
+    for (j = 0; j < count; j++) {
+        vals[j] = tryObjectEncoding(vals[j]);
+
+        // serialize robj to raw buffer, reusing the space of the last one
+        sdsclear(s);
+        rioInitWithBuffer(&r, s);
+        data_size = rdbSaveObject(&r, vals[j]);
+
+        // NOTICE: memory address of sds is changed when the space is increased
+        s = r.io.buffer.ptr;
+        redisAssert((size_t)data_size == sdslen(s));
+
+        // fetch the start pointer which point to the sdshdr and the length of sdshdr and data
+        sdsraw(s, &raw_data, &size);
+        // NOTICE: avoid the copy from robj => buffer
+        if (infqPushElement(qobj, raw_data, size, expire, priority) == REDIS_ERR) {
+            redisLog(REDIS_WARNING, "failed to push infq, data: %s, len: %d", s, data_size);
+            break;
+        }
     }
+    sdsfree(s);
+
+    return j;
+}
 
-    return ret;
+int pushObj(robj *qobj, robj *val) {
+    return pushObjs(qobj, &val, 1, 0, 0) == 1 ? REDIS_OK : REDIS_ERR;
 }
 
 robj* deserialize(const void *dataptr, int size) {
@@ -115,12 +533,309 @@ robj* deserialize(const void *dataptr, int size) {
     return obj;
 }
 
+/* Skip the expire time before an element fetched from an expiring InfQ, see
+ * infqPushElement(), and return it. 0 is returned if the element never
+ * expires or the InfQ is not expiring. */
+mstime_t infqElementPayload(robj *qobj, const void **dataptr, int *size) {
+    uint64_t    expire;
+
+    if (!((infqObject *)qobj->ptr)->expiring || *size < REDIS_INFQ_EXPIRE_LEN) {
+        return 0;
+    }
+
+    memcpy(&expire, *dataptr, sizeof(expire));
+    memrev64ifbe(&expire);
+    *dataptr = (const char *)*dataptr + REDIS_INFQ_EXPIRE_LEN;
+    *size -= REDIS_INFQ_EXPIRE_LEN;
+    return (mstime_t)expire;
+}
+
+// convert an element fetched from InfQ to a string object
+robj* infqElementToObject(robj *qobj, const void *dataptr, int size) {
+    infqElementPayload(qobj, &dataptr, &size);
+    if (infqElementDecode(qobj, &dataptr, &size) == REDIS_ERR) {
+        return NULL;
+    }
+    if (qobj->encoding != REDIS_ENCODING_INFQ) {
+        return createStringObject((char *)dataptr, size);
+    }
+
+    return deserialize(dataptr, size);
+}
+
+// reply an element fetched from InfQ, raw elements are copied to the reply
+// buffer directly from the zero copy pointer of InfQ
+int addReplyInfqElement(redisClient *c, robj *qobj, const void *dataptr, int size) {
+    robj        *obj;
+    sds         s;
+    rio         r;
+    uint32_t    len;
+    int         isencoded;
+
+    infqElementPayload(qobj, &dataptr, &size);
+    if (infqElementDecode(qobj, &dataptr, &size) == REDIS_ERR) {
+        return REDIS_ERR;
+    }
+    if (qobj->encoding != REDIS_ENCODING_INFQ) {
+        addReplyBulkCBuffer(c, (void *)dataptr, size);
+        return REDIS_OK;
+    }
+
+    // plain strings are replied from the rdb payload in place, only integers
+    // and compressed strings have to be loaded to objects
+    if ((s = sdsinit(dataptr, size)) != NULL) {
+        rioInitWithBuffer(&r, s);
+        len = rdbLoadLen(&r, &isencoded);
+        if (len != REDIS_RDB_LENERR && !isencoded && (size_t)r.io.buffer.pos + len <= sdslen(s)) {
+            addReplyBulkCBuffer(c, s + r.io.buffer.pos, len);
+            return REDIS_OK;
+        }
+    }
+
+    if ((obj = deserialize(dataptr, size)) == NULL) {
+        return REDIS_ERR;
+    }
+
+    addReplyBulk(c, obj);
+    decrRefCount(obj);
+    return REDIS_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * Expiring elements of InfQ
+ *
+ * The elements pushed by QPUSH EX/PX/PXAT to the InfQs created as expiring
+ * carry their expire time. Like the expire of keys, the expired elements are
+ * dropped lazily, when they reach the head of the InfQ and it is accessed, and
+ * actively by infqExpireCron(). The pushes are tracked as runs of elements
+ * with the latest expire time of each, so the runs whose elements all expired
+ * are dropped without reading them back from the file blocks. Only the master
+ * drops the elements, and the drops are propagated to AOF and slaves as QJPOP.
+ *----------------------------------------------------------------------------*/
+
+// return 1 if the expired elements of the InfQ can be dropped
+static int infqDropsExpired(robj *q) {
+    return ((infqObject *)q->ptr)->expiring && server.masterhost == NULL && !server.loading;
+}
+
+static mstime_t infqExpireNow(void) {
+    // the time is frozen while a script runs, like the expire of keys
+    return server.lua_caller ? server.lua_time_start : mstime();
+}
+
+static int infqElementExpired(robj *q, const void *dataptr, int size, mstime_t now) {
+    mstime_t    expire;
+
+    expire = infqElementPayload(q, &dataptr, &size);
+    return expire != 0 && expire <= now;
+}
+
+static int infqHeadExpired(robj *q, mstime_t now) {
+    const void  *dataptr;
+    int         size;
+
+    if (infq_size(infqHeadQueue(q)) == 0 ||
+            infq_top_zero_cp(infqHeadQueue(q), &dataptr, &size) == INFQ_ERR) {
+        return 0;
+    }
+    return infqElementExpired(q, dataptr, size, now);
+}
+
+/* Drop the runs at the head of the InfQ whose elements all expired before
+ * 'now', but no more than 'max' elements. The runs already popped are
+ * removed, so a 'now' of 0 only removes them. Returns the number of dropped
+ * elements. */
+static long infqDropExpiredRuns(robj *q, mstime_t now, long max) {
+    infqObject      *qo = q->ptr;
+    infqExpireRun   *run;
+    listNode        *ln;
+    long long       head;
+    long            n, dropped = 0;
+
+    if (qo->expire_runs == NULL) {
+        return 0;
+    }
+
+    while ((ln = listFirst(qo->expire_runs)) != NULL) {
+        run = listNodeValue(ln);
+        head = qo->pushed - infq_size(qo->q);
+        if (run->end <= head) {
+            listDelNode(qo->expire_runs, ln);
+            continue;
+        }
+        // the elements loaded before the first run are not tracked, and the
+        // lanes of higher priorities are served before the runs
+        if (run->max_expire == 0 || run->max_expire > now || head < run->end - run->len ||
+                infqHeadQueue(q) != qo->q) {
+            break;
+        }
+
+        // the head of the run may have been popped already
+        n = run->end - head;
+        if (dropped + n > max) {
+            break;
+        }
+        for (; n > 0; n--, dropped++) {
+            if (infq_just_pop(qo->q) == INFQ_ERR) {
+                redisLog(REDIS_WARNING, "failed to drop expired elements of InfQ");
+                return dropped;
+            }
+        }
+        listDelNode(qo->expire_runs, ln);
+    }
+
+    return dropped;
+}
+
+// propagate the drop of 'count' expired elements as QJPOP key count
+static void propagateInfqExpire(redisDb *db, robj *key, long count) {
+    robj    *argv[3];
+
+    argv[0] = shared.qjpop;
+    argv[1] = key;
+    argv[2] = createStringObjectFromLongLong(count);
+    propagate(server.qjpopCommand, db->id, argv, 3,
+            REDIS_PROPAGATE_AOF | REDIS_PROPAGATE_REPL);
+    decrRefCount(argv[2]);
+    server.stat_infq_expired += count;
+}
+
+/* Drop the expired elements at the head of the InfQ 'q' of 'key', before
+ * the InfQ is accessed. Returns the number of dropped elements. */
+long infqExpireHead(redisDb *db, robj *key, robj *q) {
+    mstime_t    now;
+    long        dropped;
+
+    if (!infqDropsExpired(q)) {
+        return 0;
+    }
+
+    now = infqExpireNow();
+    dropped = infqDropExpiredRuns(q, now, LONG_MAX);
+    while (infqHeadExpired(q, now)) {
+        if (infq_just_pop(infqHeadQueue(q)) == INFQ_ERR) {
+            redisLog(REDIS_WARNING, "failed to drop expired element of InfQ, key: %s",
+                    (char *)key->ptr);
+            break;
+        }
+        dropped++;
+    }
+
+    if (dropped > 0) {
+        propagateInfqExpire(db, key, dropped);
+        signalModifiedKey(db, key);
+    }
+    return dropped;
+}
+
+/* Parse the optional 'EX seconds | PX milliseconds | PXAT unix-time-ms' of
+ * QPUSH and QPUSHX into the expire time 'expire', 0 if it's not given, and
+ * return the index of the argument after it, -1 on error. The option is
+ * rewritten to PXAT, so AOF and slaves expire the elements at the same time. */
+static int getPushExpireOrReply(redisClient *c, int j, mstime_t *expire) {
+    long long   ll;
+    mstime_t    now;
+    robj        *opt, *when;
+    char        *name = c->argv[j]->ptr;
+
+    if (getLongLongFromObjectOrReply(c, c->argv[j + 1], &ll, NULL) != REDIS_OK) {
+        return -1;
+    }
+
+    now = mstime();
+    if (ll <= 0 || (!strcasecmp(name, "ex") && ll > (LLONG_MAX - now) / 1000) ||
+            (!strcasecmp(name, "px") && ll > LLONG_MAX - now)) {
+        addReplyErrorFormat(c, "invalid expire time in %s", c->cmd->name);
+        return -1;
+    }
+    if (!strcasecmp(name, "pxat")) {
+        *expire = ll;
+        return j + 2;
+    }
+
+    *expire = !strcasecmp(name, "ex") ? now + ll * 1000 : now + ll;
+    opt = createStringObject("PXAT", 4);
+    when = createStringObjectFromLongLong(*expire);
+    rewriteClientCommandArgument(c, j, opt);
+    rewriteClientCommandArgument(c, j + 1, when);
+    decrRefCount(opt);
+    decrRefCount(when);
+    return j + 2;
+}
+
+/* Parse the optional 'PRIORITY p' and expire time of QPUSH and QPUSHX, in
+ * any order, into 'priority' and 'expire', 0 if they are not given. Returns
+ * the index of the first value, -1 on error. At least one value follows the
+ * options, so a value named like an option can still be pushed alone. */
+int getPushOptionsOrReply(redisClient *c, mstime_t *expire, int *priority) {
+    long long   ll;
+    char        *name;
+    int         j = 2, seen_expire = 0, seen_priority = 0;
+
+    *expire = 0;
+    *priority = 0;
+    while (j + 2 < c->argc) {
+        name = c->argv[j]->ptr;
+        if (!seen_expire && (!strcasecmp(name, "ex") || !strcasecmp(name, "px") ||
+                    !strcasecmp(name, "pxat"))) {
+            if ((j = getPushExpireOrReply(c, j, expire)) == -1) {
+                return -1;
+            }
+            seen_expire = 1;
+        } else if (!seen_priority && !strcasecmp(name, "priority")) {
+            if (getLongLongFromObjectOrReply(c, c->argv[j + 1], &ll, NULL) != REDIS_OK) {
+                return -1;
+            }
+            if (ll < 0 || ll >= REDIS_INFQ_PRIORITIES) {
+                addReplyErrorFormat(c, "priority must be between 0 and %d",
+                        REDIS_INFQ_PRIORITIES - 1);
+                return -1;
+            }
+            *priority = ll;
+            seen_priority = 1;
+            j += 2;
+        } else {
+            break;
+        }
+    }
+    return j;
+}
+
+/*-----------------------------------------------------------------------------
+ * InfQ Iterator
+ *
+ * Walks the elements in [start, end] from the head to the tail. infQ only
+ * exposes the access by index, so all the range reads go through here to
+ * keep the walk in one place.
+ *----------------------------------------------------------------------------*/
+
+void infqInitIterator(infqIterator *it, robj *subject, long start, long end) {
+    it->subject = subject;
+    it->index = start;
+    it->end = end;
+}
+
+/* Fetch the next element without copy. Returns 1 if an element is fetched,
+ * 0 at the end of the range, and -1 if the element can't be fetched, the
+ * iterator moves on in that case. */
+int infqNext(infqIterator *it, const void **dataptr, int *size) {
+    if (it->index > it->end) {
+        return 0;
+    }
+
+    if (infqAt(it->subject, it->index++, dataptr, size) == INFQ_ERR) {
+        return -1;
+    }
+
+    return 1;
+}
+
 /*-----------------------------------------------------------------------------
  * infQ Commands
  *
  * Aims on replcaing most commands of Lists.
  * qpush => lpush
- * qpop  => rpop
+ * qpop  => rpop, or pop many elements with a count
  * qlen  => llen
  * qat   => lindex
  * qrange => lranage
@@ -128,12 +843,47 @@ robj* deserialize(const void *dataptr, int size) {
  * qrpoplpush => rpoplpush
  *----------------------------------------------------------------------------*/
 
+// reply an error if elements with an expire time are pushed to an InfQ
+// not created as expiring
+static int checkPushExpireOrReply(redisClient *c, robj *qobj, mstime_t expire) {
+    if (expire != 0 && !((infqObject *)qobj->ptr)->expiring) {
+        addReplyError(c, "InfQ is not expiring, create it by QCREATE key EXPIRING");
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+// create the lane 'priority' of the InfQ before it is pushed, if needed
+static int prepareInfqLaneOrReply(redisClient *c, robj *qobj, int priority) {
+    if (priority == 0 || ((infqObject *)qobj->ptr)->lanes[priority] != NULL) {
+        return REDIS_OK;
+    }
+    if (infqGroupsLength(qobj) > 0) {
+        addReplyError(c, "consumer groups can't read an InfQ with priority lanes");
+        return REDIS_ERR;
+    }
+    if (createInfqLane(qobj, c->argv[1]->ptr, priority) == NULL) {
+        addReplyError(c, "failed to create lane of infq");
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+// delete the InfQ 'key' just created by a command failing before pushing to
+// it, so that no empty InfQ is left without being propagated
+static void deleteCreatedInfq(redisClient *c, robj *key, robj *qobj) {
+    if (infqLength(qobj) == 0) {
+        dbDelete(c->db, key);
+    }
+}
+
+// qpush key [PRIORITY p] [EX seconds | PX milliseconds | PXAT unix-time-ms] value [value ...]
 void qpushCommand(redisClient *c) {
-    int         j, pushed;
+    int         pushed, first, priority, created = 0;
     robj        *qobj;
     dictEntry   *de;
+    mstime_t    expire;
 
-    pushed = 0;
     qobj = lookupKeyWrite(c->db, c->argv[1]);
 
     if (qobj && qobj->type != REDIS_INFQ) {
@@ -141,99 +891,274 @@ void qpushCommand(redisClient *c) {
         return;
     }
 
-    for (j = 2; j < c->argc; j++) {
-        c->argv[j] = tryObjectEncoding(c->argv[j]);
-        if (!qobj) {
-            de = dictFind(server.infq_keys, c->argv[1]->ptr);
-            redisAssert(de == NULL);
+    if ((first = getPushOptionsOrReply(c, &expire, &priority)) == -1) {
+        return;
+    }
 
-            qobj = createInfQ(c->argv[1], c->db);
-            if (qobj == NULL) {
-                addReplyError(c, "failed to create infq");
-                return;
-            }
-        }
+    if (!qobj) {
+        de = dictFind(server.infq_keys, c->argv[1]->ptr);
+        redisAssert(de == NULL);
 
-        if (pushObj(qobj, c->argv[j]) == REDIS_ERR) {
-            redisLog(REDIS_WARNING, "failed to push InfQ, key: %s", (sds)c->argv[1]->ptr);
-            addReplyErrorFormat(c, "failed to push infq");
+        qobj = createInfQ(c->argv[1], c->db, NULL);
+        if (qobj == NULL) {
+            addReplyError(c, "failed to create infq");
             return;
         }
+        // the InfQ created by a push with expire time is expiring
+        ((infqObject *)qobj->ptr)->expiring = expire != 0;
+        created = 1;
+    } else if (checkPushExpireOrReply(c, qobj, expire) == REDIS_ERR) {
+        return;
+    }
+    if (prepareInfqLaneOrReply(c, qobj, priority) == REDIS_ERR) {
+        if (created) deleteCreatedInfq(c, c->argv[1], qobj);
+        return;
+    }
 
-        pushed++;
+    pushed = pushObjs(qobj, c->argv + first, c->argc - first, expire, priority);
+    if (pushed != c->argc - first) {
+        redisLog(REDIS_WARNING, "failed to push InfQ, key: %s", (sds)c->argv[1]->ptr);
+        addReplyErrorFormat(c, "failed to push infq");
+        if (created) deleteCreatedInfq(c, c->argv[1], qobj);
+        return;
     }
-    addReplyLongLong(c, qobj ? infqLength(qobj) : 0);
+
+    signalListAsReady(c->db, c->argv[1]);
+    addReplyLongLong(c, infqLength(qobj));
     server.dirty += pushed;
 }
 
+// qpushx key [PRIORITY p] [EX seconds | PX milliseconds | PXAT unix-time-ms] value [value ...]
 void qpushxCommand(redisClient *c) {
-    robj    *qobj;
+    int         pushed, first, priority;
+    robj        *qobj;
+    mstime_t    expire;
 
     if ((qobj = lookupKeyReadOrReply(c, c->argv[1], shared.czero)) == NULL ||
             checkType(c, qobj, REDIS_INFQ)) {
         return;
     }
 
-    c->argv[2] = tryObjectEncoding(c->argv[2]);
-    if (pushObj(qobj, c->argv[2]) == REDIS_ERR) {
+    if ((first = getPushOptionsOrReply(c, &expire, &priority)) == -1 ||
+            checkPushExpireOrReply(c, qobj, expire) == REDIS_ERR ||
+            prepareInfqLaneOrReply(c, qobj, priority) == REDIS_ERR) {
+        return;
+    }
+
+    pushed = pushObjs(qobj, c->argv + first, c->argc - first, expire, priority);
+    if (pushed != c->argc - first) {
         redisLog(REDIS_WARNING, "failed to push InfQ, key: %s", (sds)c->argv[1]->ptr);
         addReplyErrorFormat(c, "failed to push infq");
         return;
     }
 
+    signalListAsReady(c->db, c->argv[1]);
     addReplyLongLong(c, infqLength(qobj));
-    server.dirty += 1;
+    server.dirty += pushed;
 }
 
-void qpopCommand(redisClient *c) {
-    const void  *dataptr;
-    int         size;
-    robj        *obj, *q;
+/* Parse the optional 'count [BYTES maxbytes]' arguments of QPOP and QJPOP.
+ * 'maxbytes' is set to 0 when the popped bytes are not limited. */
+int getPopLimitsOrReply(redisClient *c, long *count, long long *maxbytes) {
+    *maxbytes = 0;
 
-    q = lookupKeyWriteOrReply(c, c->argv[1], shared.nullbulk);
-    if (q == NULL || checkType(c, q, REDIS_INFQ)) {
-        redisLog(REDIS_WARNING, "val is NULL or not a InfQ");
-        return;
+    if (getLongFromObjectOrReply(c, c->argv[2], count, "count must be a integer") != REDIS_OK) {
+        return REDIS_ERR;
     }
-
-    if (infq_pop_zero_cp(q->ptr, &dataptr, &size) == INFQ_ERR) {
-        redisLog(REDIS_WARNING, "failed to pop from infq, key: %s", (char *)c->argv[1]->ptr);
-        addReplyError(c, "failed to pop from infq");
-        return;
+    if (*count <= 0) {
+        addReplyError(c, "count must be positive");
+        return REDIS_ERR;
     }
 
-    if (size == 0) {
-        addReply(c, shared.nullbulk);
-        return;
+    if (c->argc == 3) {
+        return REDIS_OK;
     }
 
-    if ((obj = deserialize(dataptr, size)) == NULL) {
-        addReplyError(c, "failed to deserialize");
-        return;
+    if (c->argc != 5 || strcasecmp(c->argv[3]->ptr, "bytes")) {
+        addReply(c, shared.syntaxerr);
+        return REDIS_ERR;
+    }
+    if (getLongLongFromObjectOrReply(c, c->argv[4], maxbytes, "maxbytes must be a integer") != REDIS_OK) {
+        return REDIS_ERR;
+    }
+    if (*maxbytes <= 0) {
+        addReplyError(c, "maxbytes must be positive");
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+/* Pop at most 'count' elements from InfQ whose total size doesn't exceed
+ * 'maxbytes' (0 means no limit), but always pop the first one even if it's
+ * larger than 'maxbytes'. Popped elements are added to the reply if 'reply'
+ * is set. The expired elements at the head are dropped at first, see
+ * infqExpireHead(). Return the number of popped elements. */
+long popElements(redisClient *c, robj *q, long count, long long maxbytes, int reply) {
+    const void  *dataptr;
+    int         size, expiring, peek, expired = 0;
+    long        popped;
+    long long   bytes;
+    mstime_t    now = 0;
+    robj        *countobj;
+
+    infqExpireHead(c->db, c->argv[1], q);
+    if ((expiring = infqDropsExpired(q))) {
+        now = infqExpireNow();
+    }
+    peek = maxbytes != 0 || expiring;
+
+    popped = 0;
+    bytes = 0;
+    while (popped < count && infqLength(q) > 0) {
+        if (!peek) {
+            if (infq_pop_zero_cp(infqHeadQueue(q), &dataptr, &size) == INFQ_ERR) {
+                redisLog(REDIS_WARNING, "failed to pop from infq, key: %s", (char *)c->argv[1]->ptr);
+                break;
+            }
+        } else {
+            // peek the size of the element before popping it
+            if (infq_top_zero_cp(infqHeadQueue(q), &dataptr, &size) == INFQ_ERR) {
+                redisLog(REDIS_WARNING, "failed to fetch top from infq, key: %s",
+                        (char *)c->argv[1]->ptr);
+                break;
+            }
+            if (popped > 0 && maxbytes != 0 && bytes + size > maxbytes) {
+                break;
+            }
+            // the drops are propagated before the command, so an expired
+            // element behind the popped ones ends the batch
+            if (popped > 0 && expiring && infqElementExpired(q, dataptr, size, now)) {
+                expired = 1;
+                break;
+            }
+        }
+
+        if (reply && addReplyInfqElement(c, q, dataptr, size) == REDIS_ERR) {
+            redisLog(REDIS_WARNING, "failed to deserialize");
+            addReply(c, shared.nullbulk);
+        }
+
+        if (peek && infq_just_pop(infqHeadQueue(q)) == INFQ_ERR) {
+            redisLog(REDIS_WARNING, "failed to just pop from infq, key: %s", (char *)c->argv[1]->ptr);
+            // the element has been replied, count it to keep the reply consistent
+            popped++;
+            break;
+        }
+
+        bytes += size;
+        popped++;
+    }
+
+    // the expired elements are dropped by the following pop, so AOF and
+    // slaves have to pop as many elements as the master
+    if (expired) {
+        countobj = createStringObjectFromLongLong(popped);
+        rewriteClientCommandArgument(c, 2, countobj);
+        decrRefCount(countobj);
+    }
+
+    return popped;
+}
+
+// qpop key [count [BYTES maxbytes]]
+void qpopCommand(redisClient *c) {
+    const void  *dataptr;
+    int         size;
+    robj        *q;
+    long        count, popped;
+    long long   maxbytes;
+    void        *replylen;
+
+    if (c->argc > 2 && getPopLimitsOrReply(c, &count, &maxbytes) != REDIS_OK) {
+        return;
+    }
+
+    // the count form replies an empty multi bulk for a missing key
+    q = lookupKeyWriteOrReply(c, c->argv[1],
+            c->argc > 2 ? shared.emptymultibulk : shared.nullbulk);
+    if (q == NULL || checkType(c, q, REDIS_INFQ)) {
+        redisLog(REDIS_WARNING, "val is NULL or not a InfQ");
+        return;
+    }
+
+    // pop many elements into a single multi bulk reply
+    if (c->argc > 2) {
+        replylen = addDeferredMultiBulkLength(c);
+        popped = popElements(c, q, count, maxbytes, 1);
+        setDeferredMultiBulkLength(c, replylen, popped);
+        server.dirty += popped;
+        return;
+    }
+
+    // NOTICE: a raw element may be empty, so size can't tell an empty InfQ
+    infqExpireHead(c->db, c->argv[1], q);
+    if (infqLength(q) == 0) {
+        addReply(c, shared.nullbulk);
+        return;
+    }
+
+    if (infq_pop_zero_cp(infqHeadQueue(q), &dataptr, &size) == INFQ_ERR) {
+        redisLog(REDIS_WARNING, "failed to pop from infq, key: %s", (char *)c->argv[1]->ptr);
+        addReplyError(c, "failed to pop from infq");
+        return;
+    }
+
+    if (size == 0 && q->encoding == REDIS_ENCODING_INFQ) {
+        addReply(c, shared.nullbulk);
+        return;
+    }
+
+    if (addReplyInfqElement(c, q, dataptr, size) == REDIS_ERR) {
+        addReplyError(c, "failed to deserialize");
+        return;
     }
 
-    addReplyBulk(c, obj);
-    decrRefCount(obj);
     server.dirty++;
 }
 
+// qlen key [LANES]
 void qlenCommand(redisClient *c) {
     robj    *q;
     size_t  len;
+    infq_t  *lane;
+    void    *replylen;
+    int     j, n = 0, lanes = 0;
+
+    if (c->argc == 3 && !strcasecmp(c->argv[2]->ptr, "lanes")) {
+        lanes = 1;
+    } else if (c->argc != 2) {
+        addReply(c, shared.syntaxerr);
+        return;
+    }
 
     q = lookupKeyWriteOrReply(c, c->argv[1], shared.nullbulk);
     if (q == NULL || checkType(c, q, REDIS_INFQ)) {
         return;
     }
 
-    len = infq_size(q->ptr);
+    infqExpireHead(c->db, c->argv[1], q);
+    if (!lanes) {
+        len = infqLength(q);
+        addReplyLongLong(c, len);
+        return;
+    }
+
+    // the priority and the length of each lane, in the order they are served
+    replylen = addDeferredMultiBulkLength(c);
+    for (j = REDIS_INFQ_PRIORITIES - 1; j >= 0; j--) {
+        if ((lane = infqLaneQueue(q, j)) == NULL) continue;
 
-    addReplyLongLong(c, len);
+        addReplyLongLong(c, j);
+        addReplyLongLong(c, infq_size(lane));
+        n++;
+    }
+    setDeferredMultiBulkLength(c, replylen, n * 2);
 }
 
 void qtopCommand(redisClient *c) {
     const void      *data;
-    robj            *q, *obj;
+    robj            *q;
     int             data_size;
 
     q = lookupKeyWriteOrReply(c, c->argv[1], shared.nullbulk);
@@ -241,36 +1166,57 @@ void qtopCommand(redisClient *c) {
         return;
     }
 
-    if (infq_top_zero_cp(q->ptr, &data, &data_size) == INFQ_ERR) {
+    infqExpireHead(c->db, c->argv[1], q);
+    if (infqLength(q) == 0) {
+        addReply(c, shared.nullbulk);
+        return;
+    }
+
+    if (infq_top_zero_cp(infqHeadQueue(q), &data, &data_size) == INFQ_ERR) {
         redisLog(REDIS_WARNING, "failed to fetch top from infq, key: %s",
                 (char *)c->argv[1]->ptr);
         addReplyError(c, "failed to fetch top from infq");
         return;
     }
 
-    if (data_size == 0) {
+    if (data_size == 0 && q->encoding == REDIS_ENCODING_INFQ) {
         addReply(c, shared.nullbulk);
         return;
     }
 
-    if ((obj = deserialize(data, data_size)) == NULL) {
+    if (addReplyInfqElement(c, q, data, data_size) == REDIS_ERR) {
         addReplyError(c, "failed to deserialize");
         return;
     }
-
-    addReplyBulk(c, obj);
-    decrRefCount(obj);
 }
 
+// qjpop key [count [BYTES maxbytes]]
 void qjpopCommand(redisClient *c) {
-    robj    *q;
+    robj        *q;
+    long        count, popped;
+    long long   maxbytes;
 
-    q = lookupKeyWriteOrReply(c, c->argv[1], shared.nullbulk);
+    if (c->argc > 2 && getPopLimitsOrReply(c, &count, &maxbytes) != REDIS_OK) {
+        return;
+    }
+
+    // the count form replies 0 for a missing key
+    q = lookupKeyWriteOrReply(c, c->argv[1],
+            c->argc > 2 ? shared.czero : shared.nullbulk);
     if (q == NULL || checkType(c, q, REDIS_INFQ)) {
         return;
     }
 
-    if (infq_just_pop(q->ptr) == INFQ_ERR) {
+    // drop many elements, and reply the number of them
+    if (c->argc > 2) {
+        popped = popElements(c, q, count, maxbytes, 0);
+        addReplyLongLong(c, popped);
+        server.dirty += popped;
+        return;
+    }
+
+    infqExpireHead(c->db, c->argv[1], q);
+    if (infq_just_pop(infqHeadQueue(q)) == INFQ_ERR) {
         redisLog(REDIS_WARNING, "failed to just pop from infq, key: %s", (char *)c->argv[1]->ptr);
         addReplyError(c, "failed to jus pop from infq");
         return;
@@ -297,9 +1243,9 @@ void qdelCommand(redisClient *c) {
 }
 
 void qatCommand(redisClient *c) {
-    char*       data[INFQ_AT_MAX_BUF_SIZE];
+    const void  *data;
     int         data_size;
-    robj        *q, *obj;
+    robj        *q;
     long        idx, qlen;
 
     if (getLongFromObjectOrReply(c, c->argv[2], &idx, "index must be a integer") != REDIS_OK) {
@@ -312,18 +1258,20 @@ void qatCommand(redisClient *c) {
     }
 
     // convert negative index to positive
-    qlen = infq_size(q->ptr);
+    infqExpireHead(c->db, c->argv[1], q);
+    qlen = infqLength(q);
     if (idx < 0) {
         idx = qlen + idx;
     }
 
     // invalid index
-    if (idx >= qlen) {
+    if (idx < 0 || idx >= qlen) {
         addReply(c, shared.emptymultibulk);
         return;
     }
 
-    if (infq_at(q->ptr, idx, &data, INFQ_AT_MAX_BUF_SIZE, &data_size) == INFQ_ERR) {
+    // reply from the block of the element, so its size is not limited
+    if (infqAt(q, idx, &data, &data_size) == INFQ_ERR) {
         addReplyError(c, "failed to call at");
         sds key = c->argv[1]->ptr;
         redisLog(REDIS_WARNING, "failed to call at of InfQ, key: %s, size: %ld, idx: %ld",
@@ -331,24 +1279,48 @@ void qatCommand(redisClient *c) {
         return;
     }
 
-    if (data_size == 0) {
+    if (data_size == 0 && q->encoding == REDIS_ENCODING_INFQ) {
         addReply(c, shared.nullbulk);
         return;
     }
 
-    if ((obj = deserialize(data, data_size)) == NULL) {
+    if (addReplyInfqElement(c, q, data, data_size) == REDIS_ERR) {
         addReplyError(c, "failed to deserialize");
         return;
     }
+}
 
-    addReplyBulk(c, obj);
-    decrRefCount(obj);
+// reply the elements in [start, end] of InfQ one by one
+void addReplyInfqRange(redisClient *c, robj *q, long start, long end) {
+    infqIterator    it;
+    const void      *data;
+    int             data_size, ret;
+
+    infqInitIterator(&it, q, start, end);
+    while ((ret = infqNext(&it, &data, &data_size)) != 0) {
+        if (ret == -1) {
+            addReply(c, shared.nullbulk);
+            redisLog(REDIS_WARNING, "failed to fetch range of InfQ, key: %s, "
+                    "range: [%ld, %ld], idx: %ld", (sds)c->argv[1]->ptr, start, end,
+                    it.index - 1);
+            continue;
+        }
+
+        if (data_size == 0 && q->encoding == REDIS_ENCODING_INFQ) {
+            addReply(c, shared.nullbulk);
+            continue;
+        }
+
+        if (addReplyInfqElement(c, q, data, data_size) == REDIS_ERR) {
+            redisLog(REDIS_WARNING, "failed to deserialize");
+            addReply(c, shared.nullbulk);
+            continue;
+        }
+    }
 }
 
 void qrangeCommand(redisClient *c) {
-    const void  *data;
-    int         data_size;
-    robj        *q, *obj;
+    robj        *q;
     long        qlen, start, end, rangelen;
 
     if ((getLongFromObjectOrReply(c, c->argv[2], &start, "start must be a integer") == REDIS_ERR)
@@ -362,7 +1334,8 @@ void qrangeCommand(redisClient *c) {
     }
 
     // conver negative indexes
-    qlen = infq_size(q->ptr);
+    infqExpireHead(c->db, c->argv[1], q);
+    qlen = infqLength(q);
     if (start < 0) {
         start = qlen + start;
     }
@@ -384,29 +1357,157 @@ void qrangeCommand(redisClient *c) {
     rangelen = end - start + 1;
 
     addReplyMultiBulkLen(c, rangelen);
-    for (int i = start; i <= end; i++) {
-        if (infq_at_zero_cp(q->ptr, i, &data, &data_size) == INFQ_ERR) {
-            addReply(c, shared.nullbulk);
-            sds key = c->argv[1]->ptr;
-            redisLog(REDIS_WARNING, "failed to fetch range of InfQ, key: %s, "
-                    "range: [%ld, %ld], idx: %d", key, start, end, i);
-            continue;
+    addReplyInfqRange(c, q, start, end);
+}
+
+/* The cursor of QSCAN of the element at 'index'. With lanes, the cursor is
+ * the sequence of the element in its lane times REDIS_INFQ_PRIORITIES, plus
+ * the rank of the lane in the order they are served. */
+static unsigned long infqScanCursor(robj *q, long index) {
+    infq_t  *lane;
+    long    len;
+    int     j;
+
+    if (!infqHasLanes(q)) {
+        return ((infqObject *)q->ptr)->pushed - infqLength(q) + index;
+    }
+
+    for (j = REDIS_INFQ_PRIORITIES - 1; j >= 0; j--) {
+        if ((lane = infqLaneQueue(q, j)) == NULL) continue;
+
+        len = infq_size(lane);
+        if (index < len) {
+            return (infqLanePushed(q, j) - len + index) * REDIS_INFQ_PRIORITIES +
+                (REDIS_INFQ_PRIORITIES - 1 - j);
         }
+        index -= len;
+    }
+    return 0;
+}
 
-        if (data_size == 0) {
-            addReply(c, shared.nullbulk);
-            continue;
+/* The index of the first element to visit from the cursor of QSCAN, or -1
+ * if the cursor is past the elements ever pushed, e.g. a cursor got before
+ * the InfQ was loaded again. */
+static long infqScanIndex(robj *q, unsigned long cursor) {
+    infq_t      *lane;
+    long long   seq, head_seq, pushed;
+    long        index = 0, len;
+    int         j, priority;
+
+    if (!infqHasLanes(q)) {
+        pushed = ((infqObject *)q->ptr)->pushed;
+        if ((long long)cursor > pushed) return -1;
+        head_seq = pushed - infqLength(q);
+        return (long long)cursor > head_seq ? (long)((long long)cursor - head_seq) : 0;
+    }
+
+    priority = REDIS_INFQ_PRIORITIES - 1 - cursor % REDIS_INFQ_PRIORITIES;
+    seq = cursor / REDIS_INFQ_PRIORITIES;
+    for (j = REDIS_INFQ_PRIORITIES - 1; j >= 0; j--) {
+        if ((lane = infqLaneQueue(q, j)) == NULL) continue;
+
+        len = infq_size(lane);
+        if (j == priority) {
+            pushed = infqLanePushed(q, j);
+            if (seq > pushed) return -1;
+            head_seq = pushed - len;
+            if (seq > head_seq) {
+                index += seq - head_seq < len ? (long)(seq - head_seq) : len;
+            }
+            return index;
         }
+        if (j < priority) break;
+        index += len;
+    }
+    return seq > 0 ? -1 : index;
+}
 
-        if ((obj = deserialize(data, data_size)) == NULL) {
-            redisLog(REDIS_WARNING, "failed to deserialize");
-            addReply(c, shared.nullbulk);
-            continue;
+/* QSCAN key cursor [COUNT count]
+ *
+ * Walk the InfQ from the head by pages of 'count' elements. The cursor is the
+ * sequence number of the next element in the pushes of the InfQ, so the walk
+ * is not disturbed by the pops and pushes between the calls: the elements
+ * popped meanwhile are skipped, and the elements pushed are visited. A cursor
+ * of 0 starts from the head, and 0 is returned when the tail is reached.
+ *
+ * The lanes of an InfQ with priorities are walked in the order they are
+ * served, see infqScanCursor(), the elements pushed to a lane already walked
+ * are not visited.
+ *
+ * The sequence restarts from the loaded elements when the InfQ is loaded,
+ * and is not the same on the slaves, so a cursor is only valid on the
+ * server it was got from until a restart or a reload. A cursor past the
+ * elements ever pushed is refused. */
+void qscanCommand(redisClient *c) {
+    robj            *q;
+    unsigned long   cursor;
+    long            count = 10, qlen, start, end;
+
+    if (parseScanCursorOrReply(c, c->argv[2], &cursor) == REDIS_ERR) return;
+
+    if (c->argc == 5 && !strcasecmp(c->argv[3]->ptr, "count")) {
+        if (getLongFromObjectOrReply(c, c->argv[4], &count, NULL) != REDIS_OK) return;
+        if (count < 1) {
+            addReply(c, shared.syntaxerr);
+            return;
         }
+    } else if (c->argc != 3) {
+        addReply(c, shared.syntaxerr);
+        return;
+    }
 
-        addReplyBulk(c, obj);
-        decrRefCount(obj);
+    q = lookupKeyReadOrReply(c, c->argv[1], shared.emptyscan);
+    if (q == NULL || checkType(c, q, REDIS_INFQ)) {
+        return;
+    }
+
+    // convert the sequence to the index
+    infqExpireHead(c->db, c->argv[1], q);
+    qlen = infqLength(q);
+    if ((start = infqScanIndex(q, cursor)) == -1) {
+        addReplyError(c, "invalid cursor");
+        return;
+    }
+    end = start + count - 1;
+    if (end >= qlen) {
+        end = qlen - 1;
+    }
+
+    addReplyMultiBulkLen(c, 2);
+    if (start > end) {
+        addReplyBulkCBuffer(c, "0", 1);
+        addReply(c, shared.emptymultibulk);
+        return;
+    }
+
+    if (end == qlen - 1) {
+        addReplyBulkCBuffer(c, "0", 1);
+    } else {
+        addReplyBulkLongLong(c, infqScanCursor(q, end + 1));
+    }
+    addReplyMultiBulkLen(c, end - start + 1);
+    addReplyInfqRange(c, q, start, end);
+}
+
+// push the value popped from InfQ to the destination list, and reply it
+void qpopLpushHandlePush(redisClient *c, robj *dstkey, robj *dobj, robj *value, int where) {
+    if (dobj == NULL) {
+        dobj = createZiplistObject();
+        dbAdd(c->db, dstkey, dobj);
+    } else {
+        // dbAdd() has signaled the new list
+        signalListAsReady(c->db, dstkey);
+    }
+    signalModifiedKey(c->db, dstkey);
+
+    listTypePush(dobj, value, where);
+    if (where == REDIS_TAIL) {
+        notifyKeyspaceEvent(REDIS_NOTIFY_LIST, "rpush", dstkey, c->db->id);
+    } else {
+        notifyKeyspaceEvent(REDIS_NOTIFY_LIST, "lpush", dstkey, c->db->id);
     }
+
+    addReplyBulk(c, value);
 }
 
 // pop from InfQ, push to List
@@ -421,7 +1522,8 @@ void qpopLpushGeneric(redisClient *c, int where) {
         return;
     }
 
-    if (infq_size(sobj->ptr) == 0) {
+    infqExpireHead(c->db, c->argv[1], sobj);
+    if (infqLength(sobj) == 0) {
         addReply(c, shared.nullbulk);
         return;
     }
@@ -434,38 +1536,25 @@ void qpopLpushGeneric(redisClient *c, int where) {
     }
 
     // pop data
-    if (infq_pop_zero_cp(sobj->ptr, &dataptr, &size) == INFQ_ERR) {
+    if (infq_pop_zero_cp(infqHeadQueue(sobj), &dataptr, &size) == INFQ_ERR) {
         redisLog(REDIS_WARNING, "failed to pop from infq, key: %s", (char *)touchedkey->ptr);
         addReplyError(c, "failed to pop from InfQ");
         return;
     }
 
-    if (size == 0) {
+    if (size == 0 && sobj->encoding == REDIS_ENCODING_INFQ) {
         addReply(c, shared.nullbulk);
         redisLog(REDIS_WARNING, "InfQ is empty when pop, key: %s", (char *)touchedkey->ptr);
         return;
     }
 
-    if ((value = deserialize(dataptr, size)) == NULL) {
+    if ((value = infqElementToObject(sobj, dataptr, size)) == NULL) {
         addReplyError(c, "failed to pop from InfQ");
         return;
     }
 
     incrRefCount(touchedkey);
-    if (dobj == NULL) {
-        dobj = createZiplistObject();
-        dbAdd(c->db, c->argv[2], dobj);
-    }
-    signalModifiedKey(c->db, c->argv[2]);
-
-    listTypePush(dobj, value, where);
-    if (where == REDIS_TAIL) {
-        notifyKeyspaceEvent(REDIS_NOTIFY_LIST, "rpush", c->argv[2], c->db->id);
-    } else {
-        notifyKeyspaceEvent(REDIS_NOTIFY_LIST, "lpush", c->argv[2], c->db->id);
-    }
-
-    addReplyBulk(c, value);
+    qpopLpushHandlePush(c, c->argv[2], dobj, value, where);
 
     decrRefCount(value);
     signalModifiedKey(c->db, touchedkey);
@@ -485,6 +1574,7 @@ void qpoplpushCommand(redisClient *c) {
 void lpopQpushGeneric(redisClient *c, int where) {
     robj        *sobj, *value;
     dictEntry   *de;
+    int         created = 0;
 
     if ((sobj = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk)) == NULL ||
             checkType(c, sobj, REDIS_LIST)) {
@@ -508,27 +1598,31 @@ void lpopQpushGeneric(redisClient *c, int where) {
         de = dictFind(server.infq_keys, c->argv[2]->ptr);
         redisAssert(de == NULL);
 
-        qobj = createInfQ(c->argv[2], c->db);
+        qobj = createInfQ(c->argv[2], c->db, NULL);
         if (qobj == NULL) {
              addReplyError(c, "failed to create infq");
              return;
         }
+        created = 1;
     }
 
     value = listTypePop(sobj, where);
     incrRefCount(touchedkey);
 
-    if (pushObj(qobj, value) == REDIS_ERR) {
+    if (pushObjs(qobj, &value, 1, 0, 0) != 1) {
          redisLog(REDIS_WARNING, "failed to pop list and push InfQ, key: %s, where: %d",
                  (sds)c->argv[2]->ptr, where);
          addReplyErrorFormat(c, "failed to push infq");
 
          // push value back to list
          listTypePush(sobj, value, where);
+         decrRefCount(value);
+         decrRefCount(touchedkey);
+         if (created) deleteCreatedInfq(c, c->argv[2], qobj);
          return;
     }
+    signalListAsReady(c->db, c->argv[2]);
 
-    decrRefCount(value);
     /* Delete the source list when it is empty */
     notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"rpop",touchedkey,c->db->id);
     if (listTypeLength(sobj) == 0) {
@@ -538,6 +1632,7 @@ void lpopQpushGeneric(redisClient *c, int where) {
     }
 
     addReplyBulk(c, value);
+    decrRefCount(value);
     signalModifiedKey(c->db,touchedkey);
     decrRefCount(touchedkey);
     server.dirty++;
@@ -555,7 +1650,8 @@ void qrpoplpushCommand(redisClient *c) {
     robj        *sobj, *dobj, *obj;
     dictEntry   *de;
     const void  *dataptr;
-    int         size;
+    int         size, ret, created = 0;
+    mstime_t    expire;
 
     if ((sobj = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk)) == NULL ||
             checkType(c, sobj, REDIS_INFQ)) {
@@ -563,7 +1659,8 @@ void qrpoplpushCommand(redisClient *c) {
     }
 
     // source queue is empty
-    if (infq_size(sobj->ptr) == 0) {
+    infqExpireHead(c->db, c->argv[1], sobj);
+    if (infqLength(sobj) == 0) {
         addReply(c, shared.nullbulk);
         return;
     }
@@ -573,49 +1670,1221 @@ void qrpoplpushCommand(redisClient *c) {
         return;
     }
 
-    // create infq if needed
+    if (infq_top_zero_cp(infqHeadQueue(sobj), &dataptr, &size) == INFQ_ERR) {
+        redisLog(REDIS_WARNING, "failed to fetch top from infq, key: %s", (sds)c->argv[1]->ptr);
+        addReplyError(c, "failed to fetch pop from infq");
+        return;
+    }
+
+    if (size == 0 && sobj->encoding == REDIS_ENCODING_INFQ) {
+        addReply(c, shared.nullbulk);
+        return;
+    }
+
+    if ((obj = infqElementToObject(sobj, dataptr, size)) == NULL) {
+        addReplyError(c, "failed to deserial");
+        return;
+    }
+
+    // an element with an expire time can't be moved to an InfQ that can't
+    // keep it, the InfQ created here is expiring like the source
+    expire = infqElementPayload(sobj, &dataptr, &size);
+    if (dobj && checkPushExpireOrReply(c, dobj, expire) == REDIS_ERR) {
+        decrRefCount(obj);
+        return;
+    }
+
+    // create infq if needed, once the element is fetched
     if (dobj == NULL) {
         de = dictFind(server.infq_keys, c->argv[2]->ptr);
         redisAssert(de == NULL);
 
-        dobj = createInfQ(c->argv[2], c->db);
+        dobj = createInfQ(c->argv[2], c->db, NULL);
         if (dobj == NULL) {
             redisLog(REDIS_WARNING, "failed to create InfQ");
             addReplyError(c, "failed to create InfQ");
+            decrRefCount(obj);
             return;
         }
+        ((infqObject *)dobj->ptr)->expiring = ((infqObject *)sobj->ptr)->expiring;
+        created = 1;
     }
 
-    if (infq_top_zero_cp(sobj->ptr, &dataptr, &size) == INFQ_ERR) {
-        redisLog(REDIS_WARNING, "failed to fetch top from infq, key: %s", (sds)c->argv[1]->ptr);
-        addReplyError(c, "failed to fetch pop from infq");
+    // the element can be moved as is if both InfQs share the same encoding,
+    // with its expire time
+    if (sobj->encoding == dobj->encoding) {
+        ret = infqPushElement(dobj, dataptr, size, expire, 0);
+    } else {
+        ret = pushObjs(dobj, &obj, 1, expire, 0) == 1 ? REDIS_OK : REDIS_ERR;
+    }
+    if (ret == REDIS_ERR) {
+        redisLog(REDIS_WARNING, "failed to push infq, key: %s", (sds)c->argv[1]->ptr);
+        addReplyError(c, "failed to push infq");
+        decrRefCount(obj);
+        if (created) deleteCreatedInfq(c, c->argv[2], dobj);
         return;
     }
 
-    if (size == 0) {
-        addReply(c, shared.nullbulk);
+    signalListAsReady(c->db, c->argv[2]);
+
+    if (infq_just_pop(infqHeadQueue(sobj)) == INFQ_ERR) {
+        redisLog(REDIS_WARNING, "failed to just pop from infq, key: %s", (sds)c->argv[1]->ptr);
+        addReplyError(c, "failed to just pop");
+        decrRefCount(obj);
         return;
     }
 
-    if ((obj = deserialize(dataptr, size)) == NULL) {
-        addReplyError(c, "failed to deserial");
+    addReplyBulk(c, obj);
+    decrRefCount(obj);
+    server.dirty++;
+}
+
+/*-----------------------------------------------------------------------------
+ * Blocking pop of InfQ
+ *
+ * Works the same as BLPOP & co. (see t_list.c): the client blocks on the
+ * keys with REDIS_BLOCKED_INFQ, pushes to an InfQ signal the key as ready,
+ * and handleClientsBlockedOnLists() serves the blocked clients with
+ * serveClientBlockedOnInfQ().
+ *----------------------------------------------------------------------------*/
+
+// pop an element from a non empty InfQ, and reply it with the key like BLPOP
+int replyBlockingPop(redisClient *c, robj *key, robj *q) {
+    const void  *dataptr;
+    int         size;
+
+    if (infq_pop_zero_cp(infqHeadQueue(q), &dataptr, &size) == INFQ_ERR) {
+        redisLog(REDIS_WARNING, "failed to pop from infq, key: %s", (char *)key->ptr);
+        addReplyError(c, "failed to pop from infq");
+        return REDIS_ERR;
+    }
+
+    addReplyMultiBulkLen(c, 2);
+    addReplyBulk(c, key);
+    if (addReplyInfqElement(c, q, dataptr, size) == REDIS_ERR) {
+        redisLog(REDIS_WARNING, "failed to deserialize");
+        addReply(c, shared.nullbulk);
+    }
+
+    return REDIS_OK;
+}
+
+/* Serve a client blocked by BQPOP or BQPOPRPUSH on the InfQ 'q' which has
+ * elements, and propagate the operation as QPOP or QPOPRPUSH. Return
+ * REDIS_ERR if the client can't be served, that only happens when the
+ * destination of BQPOPRPUSH is not a list. */
+int serveClientBlockedOnInfQ(redisClient *receiver, robj *key, robj *dstkey, redisDb *db, robj *q) {
+    const void  *dataptr;
+    int         size;
+    robj        *argv[3], *dobj, *value;
+
+    if (dstkey == NULL) {
+        if (replyBlockingPop(receiver, key, q) == REDIS_ERR) {
+            return REDIS_ERR;
+        }
+
+        argv[0] = shared.qpop;
+        argv[1] = key;
+        propagate(server.qpopCommand, db->id, argv, 2,
+                REDIS_PROPAGATE_AOF | REDIS_PROPAGATE_REPL);
+        return REDIS_OK;
+    }
+
+    dobj = lookupKeyWrite(receiver->db, dstkey);
+    if (dobj && checkType(receiver, dobj, REDIS_LIST)) {
+        return REDIS_ERR;
+    }
+
+    // the element is popped only after it has been pushed to the list
+    if (infq_top_zero_cp(infqHeadQueue(q), &dataptr, &size) == INFQ_ERR ||
+            (value = infqElementToObject(q, dataptr, size)) == NULL) {
+        redisLog(REDIS_WARNING, "failed to fetch top from infq, key: %s", (char *)key->ptr);
+        addReplyError(receiver, "failed to pop from InfQ");
+        return REDIS_ERR;
+    }
+    if (infq_just_pop(infqHeadQueue(q)) == INFQ_ERR) {
+        redisLog(REDIS_WARNING, "failed to just pop from infq, key: %s", (char *)key->ptr);
+        addReplyError(receiver, "failed to pop from InfQ");
+        decrRefCount(value);
+        return REDIS_ERR;
+    }
+
+    qpopLpushHandlePush(receiver, dstkey, dobj, value, REDIS_TAIL);
+    decrRefCount(value);
+
+    argv[0] = shared.qpoprpush;
+    argv[1] = key;
+    argv[2] = dstkey;
+    propagate(server.qpoprpushCommand, db->id, argv, 3,
+            REDIS_PROPAGATE_AOF | REDIS_PROPAGATE_REPL);
+    return REDIS_OK;
+}
+
+// bqpop key [key ...] timeout
+void bqpopCommand(redisClient *c) {
+    robj        *q;
+    mstime_t    timeout;
+    int         j;
+
+    if (getTimeoutFromObjectOrReply(c, c->argv[c->argc - 1], &timeout, UNIT_SECONDS)
+            != REDIS_OK) {
         return;
     }
 
-    if (infq_push(dobj->ptr, (void *)dataptr, size) == INFQ_ERR) {
-        redisLog(REDIS_WARNING, "failed to push infq, key: %s", (sds)c->argv[1]->ptr);
-        addReplyError(c, "failed to push infq");
+    for (j = 1; j < c->argc - 1; j++) {
+        q = lookupKeyWrite(c->db, c->argv[j]);
+        if (q == NULL) {
+            continue;
+        }
+        if (q->type != REDIS_INFQ) {
+            addReply(c, shared.wrongtypeerr);
+            return;
+        }
+        infqExpireHead(c->db, c->argv[j], q);
+        if (infqLength(q) == 0) {
+            continue;
+        }
+
+        // non empty InfQ, this is like a normal QPOP
+        if (replyBlockingPop(c, c->argv[j], q) == REDIS_ERR) {
+            return;
+        }
+        signalModifiedKey(c->db, c->argv[j]);
+        server.dirty++;
+
+        // replicate it as a QPOP instead of BQPOP
+        rewriteClientCommandVector(c, 2, shared.qpop, c->argv[j]);
         return;
     }
 
-    if (infq_just_pop(sobj->ptr) == INFQ_ERR) {
-        redisLog(REDIS_WARNING, "failed to just pop from infq, key: %s", (sds)c->argv[1]->ptr);
-        addReplyError(c, "failed to just pop");
+    // if we are inside a MULTI/EXEC and all InfQs are empty, treat it as a timeout
+    if (c->flags & REDIS_MULTI) {
+        addReply(c, shared.nullmultibulk);
         return;
     }
 
-    addReplyBulk(c, obj);
-    server.dirty++;
+    blockForKeys(c, c->argv + 1, c->argc - 2, timeout, NULL, REDIS_BLOCKED_INFQ);
+}
+
+// bqpoprpush src dest timeout
+void bqpoprpushCommand(redisClient *c) {
+    robj        *q;
+    mstime_t    timeout;
+
+    if (getTimeoutFromObjectOrReply(c, c->argv[3], &timeout, UNIT_SECONDS) != REDIS_OK) {
+        return;
+    }
+
+    q = lookupKeyWrite(c->db, c->argv[1]);
+    if (q != NULL && q->type != REDIS_INFQ) {
+        addReply(c, shared.wrongtypeerr);
+        return;
+    }
+
+    // non empty InfQ, the regular QPOPRPUSH is executed
+    if (q != NULL) {
+        infqExpireHead(c->db, c->argv[1], q);
+    }
+    if (q != NULL && infqLength(q) > 0) {
+        qpoprpushCommand(c);
+        return;
+    }
+
+    if (c->flags & REDIS_MULTI) {
+        addReply(c, shared.nullbulk);
+        return;
+    }
+
+    blockForKeys(c, c->argv + 1, 1, timeout, c->argv[2], REDIS_BLOCKED_INFQ);
+}
+
+/*-----------------------------------------------------------------------------
+ * Reliable delivery of InfQ
+ *
+ * QRESERVE pops elements from InfQ as leases identified by ids, and keeps
+ * them in flight until QACK commits them. Leases not acked before their
+ * deadline are delivered again, with new ids, by the following QRESERVE.
+ *----------------------------------------------------------------------------*/
+
+infqLeases *createInfqLeases(void) {
+    infqLeases  *leases;
+
+    leases = zmalloc(sizeof(*leases));
+    leases->next_id = 1;
+    leases->dict = dictCreate(&infqLeaseDictType, NULL);
+    leases->zsl = zslCreate();
+    return leases;
+}
+
+void freeInfqLeases(infqLeases *leases) {
+    dictRelease(leases->dict);
+    zslFree(leases->zsl);
+    zfree(leases);
+}
+
+unsigned long infqLeasesLength(robj *q) {
+    infqObject  *qo = q->ptr;
+
+    return qo->leases ? dictSize(qo->leases->dict) : 0;
+}
+
+/* Keep 'value' in flight until 'deadline'. The lease is identified by 'id',
+ * or by the next id of the InfQ if 'id' is -1. Return the id of the lease. */
+long long infqLeaseAdd(robj *q, long long id, robj *value, mstime_t deadline) {
+    infqObject  *qo = q->ptr;
+    infqLease   *lease;
+    robj        *idobj;
+
+    if (qo->leases == NULL) {
+        qo->leases = createInfqLeases();
+    }
+
+    if (id == -1) {
+        id = qo->leases->next_id;
+    }
+    if (id >= qo->leases->next_id) {
+        qo->leases->next_id = id + 1;
+    }
+
+    lease = zmalloc(sizeof(*lease));
+    lease->deadline = deadline;
+    lease->value = value;
+    incrRefCount(value);
+
+    idobj = createStringObjectFromLongLong(id);
+    redisAssert(dictAdd(qo->leases->dict, idobj, lease) == DICT_OK);
+    incrRefCount(idobj);
+    zslInsert(qo->leases->zsl, (double)deadline, idobj);
+
+    return id;
+}
+
+// commit the lease identified by 'id', return 1 if it's in flight, or 0
+int infqLeaseAck(robj *q, robj *id) {
+    infqObject  *qo = q->ptr;
+    infqLease   *lease;
+    dictEntry   *de;
+
+    if (qo->leases == NULL || (de = dictFind(qo->leases->dict, id)) == NULL) {
+        return 0;
+    }
+
+    lease = dictGetVal(de);
+    redisAssert(zslDelete(qo->leases->zsl, (double)lease->deadline, dictGetKey(de)));
+    dictDelete(qo->leases->dict, id);
+    return 1;
+}
+
+// qreserve key count timeout [TIME unixtime-ms]
+void qreserveCommand(redisClient *c) {
+    const void      *dataptr;
+    int             size, expiring;
+    robj            *q, *value, *timeopt, *nowobj, *countobj;
+    infqObject      *qo;
+    zskiplistNode   *ln;
+    infqLease       *lease;
+    long            count, timeout, reserved, first;
+    long long       now, id;
+    mstime_t        deadline, expire_now = 0;
+    void            *replylen;
+
+    if (getLongFromObjectOrReply(c, c->argv[2], &count, "count must be a integer") != REDIS_OK ||
+            getLongFromObjectOrReply(c, c->argv[3], &timeout, "timeout must be a integer") != REDIS_OK) {
+        return;
+    }
+    if (count <= 0 || timeout <= 0) {
+        addReplyError(c, "count and timeout must be positive");
+        return;
+    }
+
+    // TIME is given when the command is propagated, so that the expired
+    // leases are the same on slaves and AOF
+    if (c->argc == 6 && !strcasecmp(c->argv[4]->ptr, "time")) {
+        if (getLongLongFromObjectOrReply(c, c->argv[5], &now, NULL) != REDIS_OK) {
+            return;
+        }
+    } else if (c->argc == 4) {
+        now = mstime();
+    } else {
+        addReply(c, shared.syntaxerr);
+        return;
+    }
+
+    q = lookupKeyWriteOrReply(c, c->argv[1], shared.emptymultibulk);
+    if (q == NULL || checkType(c, q, REDIS_INFQ)) {
+        return;
+    }
+
+    qo = q->ptr;
+    deadline = now + timeout * 1000;
+    reserved = 0;
+    replylen = addDeferredMultiBulkLength(c);
+
+    // deliver the expired leases again at first
+    while (reserved < count && qo->leases != NULL &&
+            (ln = qo->leases->zsl->header->level[0].forward) != NULL &&
+            ln->score <= (double)now) {
+        lease = dictFetchValue(qo->leases->dict, ln->obj);
+        value = lease->value;
+        incrRefCount(value);
+
+        infqLeaseAck(q, ln->obj);
+        id = infqLeaseAdd(q, -1, value, deadline);
+
+        addReplyLongLong(c, id);
+        addReplyBulk(c, value);
+        decrRefCount(value);
+        reserved++;
+    }
+
+    // like popElements(), an expired element behind the popped ones ends
+    // the batch, and the count is rewritten for AOF and slaves
+    infqExpireHead(c->db, c->argv[1], q);
+    if ((expiring = infqDropsExpired(q))) {
+        expire_now = infqExpireNow();
+    }
+    first = reserved;
+
+    while (reserved < count && infqLength(q) > 0) {
+        if (expiring && reserved > first && infqHeadExpired(q, expire_now)) {
+            countobj = createStringObjectFromLongLong(reserved);
+            rewriteClientCommandArgument(c, 2, countobj);
+            decrRefCount(countobj);
+            break;
+        }
+        if (infq_pop_zero_cp(infqHeadQueue(q), &dataptr, &size) == INFQ_ERR) {
+            redisLog(REDIS_WARNING, "failed to pop from infq, key: %s", (char *)c->argv[1]->ptr);
+            break;
+        }
+        if ((value = infqElementToObject(q, dataptr, size)) == NULL) {
+            redisLog(REDIS_WARNING, "failed to deserialize, key: %s", (char *)c->argv[1]->ptr);
+            break;
+        }
+
+        id = infqLeaseAdd(q, -1, value, deadline);
+
+        addReplyLongLong(c, id);
+        addReplyBulk(c, value);
+        decrRefCount(value);
+        reserved++;
+    }
+    setDeferredMultiBulkLength(c, replylen, reserved * 2);
+
+    if (reserved == 0) {
+        return;
+    }
+
+    signalModifiedKey(c->db, c->argv[1]);
+    server.dirty += reserved;
+
+    if (c->argc == 4) {
+        timeopt = createStringObject("TIME", 4);
+        nowobj = createStringObjectFromLongLong(now);
+        rewriteClientCommandVector(c, 6, c->argv[0], c->argv[1], c->argv[2], c->argv[3],
+                timeopt, nowobj);
+        decrRefCount(timeopt);
+        decrRefCount(nowobj);
+    }
+}
+
+// qack key id [id ...]
+void qackCommand(redisClient *c) {
+    robj    *q;
+    int     j, acked;
+
+    q = lookupKeyWriteOrReply(c, c->argv[1], shared.czero);
+    if (q == NULL || checkType(c, q, REDIS_INFQ)) {
+        return;
+    }
+
+    acked = 0;
+    for (j = 2; j < c->argc; j++) {
+        acked += infqLeaseAck(q, c->argv[j]);
+    }
+
+    if (acked) {
+        signalModifiedKey(c->db, c->argv[1]);
+        server.dirty += acked;
+    }
+    addReplyLongLong(c, acked);
+}
+
+/* qrestoreleases key next-id [id deadline value ...]
+ *
+ * Restore the leases in flight with their ids and deadlines (unix time in
+ * milliseconds), and the next id to reserve. Used by the AOF rewrite, so
+ * the QACKs logged after the rewrite match the leases. */
+void qrestoreleasesCommand(redisClient *c) {
+    robj        *q, *idobj;
+    infqObject  *qo;
+    long long   next_id, *ids, deadline;
+    int         j, k, n;
+
+    if ((c->argc - 3) % 3 != 0) {
+        addReply(c, shared.syntaxerr);
+        return;
+    }
+    if (getLongLongFromObjectOrReply(c, c->argv[2], &next_id, NULL) != REDIS_OK) {
+        return;
+    }
+    if ((q = lookupKeyWriteOrReply(c, c->argv[1], shared.nokeyerr)) == NULL ||
+            checkType(c, q, REDIS_INFQ)) {
+        return;
+    }
+    qo = q->ptr;
+
+    // check all the leases before restoring any of them
+    n = (c->argc - 3) / 3;
+    ids = zmalloc(sizeof(long long) * (n + 1));
+    for (j = 0; j < n; j++) {
+        if (getLongLongFromObjectOrReply(c, c->argv[3 + j * 3], &ids[j], "id must be a integer") != REDIS_OK ||
+                getLongLongFromObjectOrReply(c, c->argv[4 + j * 3], &deadline, NULL) != REDIS_OK) {
+            zfree(ids);
+            return;
+        }
+        for (k = 0; k < j && ids[k] != ids[j]; k++);
+        idobj = createStringObjectFromLongLong(ids[j]);
+        if (k < j || (qo->leases && dictFind(qo->leases->dict, idobj) != NULL)) {
+            decrRefCount(idobj);
+            zfree(ids);
+            addReplyError(c, "lease id already exists");
+            return;
+        }
+        decrRefCount(idobj);
+    }
+
+    for (j = 0; j < n; j++) {
+        getLongLongFromObject(c->argv[4 + j * 3], &deadline);
+        infqLeaseAdd(q, ids[j], c->argv[5 + j * 3], deadline);
+    }
+    zfree(ids);
+
+    if (qo->leases == NULL) {
+        qo->leases = createInfqLeases();
+    }
+    if (qo->leases->next_id < next_id) {
+        qo->leases->next_id = next_id;
+    }
+
+    signalModifiedKey(c->db, c->argv[1]);
+    server.dirty++;
+    addReply(c, shared.ok);
+}
+
+/*-----------------------------------------------------------------------------
+ * Consumer groups of InfQ
+ *
+ * QREAD reads the elements of an InfQ for a named consumer group without
+ * popping them, so one InfQ fans out to many consumers. Each group keeps
+ * the sequence of the next element to read, like the cursor of QSCAN, and
+ * the elements every group has read are popped, which lets the unlinker of
+ * infQ remove their file blocks. QPOP and the expire still pop from the
+ * head, the groups behind the head go on from the head.
+ *
+ * The sequences are not the same on the slaves and after a reload, so the
+ * groups are saved, propagated and rewritten as offsets from the head: a
+ * QREAD is propagated as QGROUP ADVANCE with the number of elements passed.
+ * The groups only read lane 0, so they don't go with priority lanes.
+ *----------------------------------------------------------------------------*/
+
+static long long infqHeadSeq(robj *q) {
+    infqObject  *qo = q->ptr;
+
+    return qo->pushed - infq_size(qo->q);
+}
+
+unsigned long infqGroupsLength(robj *q) {
+    infqObject  *qo = q->ptr;
+
+    return qo->groups ? dictSize(qo->groups) : 0;
+}
+
+/* Add the consumer group 'name' reading from 'offset' elements after the
+ * head. Returns REDIS_ERR if the group exists. 'name' is copied. */
+int infqGroupAdd(robj *q, sds name, long long offset) {
+    infqObject  *qo = q->ptr;
+    dictEntry   *de;
+
+    if (qo->groups == NULL) {
+        qo->groups = dictCreate(&infqGroupDictType, NULL);
+    }
+    if ((de = dictAddRaw(qo->groups, sdsdup(name))) == NULL) {
+        return REDIS_ERR;
+    }
+    dictSetSignedIntegerVal(de, infqHeadSeq(q) + offset);
+    return REDIS_OK;
+}
+
+// the elements between the head and the next element to read of a group
+long long infqGroupOffset(robj *q, dictEntry *de) {
+    long long   offset;
+
+    offset = dictGetSignedIntegerVal(de) - infqHeadSeq(q);
+    return offset > 0 ? offset : 0;
+}
+
+// pop the elements read by every group, return the number of them
+static long infqGroupsTrim(robj *q) {
+    infqObject      *qo = q->ptr;
+    dictIterator    *di;
+    dictEntry       *de;
+    long long       min = LLONG_MAX;
+    long            popped = 0;
+
+    if (infqGroupsLength(q) == 0) {
+        return 0;
+    }
+
+    di = dictGetIterator(qo->groups);
+    while ((de = dictNext(di)) != NULL) {
+        if (dictGetSignedIntegerVal(de) < min) min = dictGetSignedIntegerVal(de);
+    }
+    dictReleaseIterator(di);
+
+    while (infqHeadSeq(q) < min && infq_size(qo->q) > 0) {
+        if (infq_just_pop(qo->q) == INFQ_ERR) {
+            redisLog(REDIS_WARNING, "failed to pop the elements read by all groups of InfQ");
+            break;
+        }
+        popped++;
+    }
+    return popped;
+}
+
+/* Move the group of 'de' 'count' elements after its next element, or after
+ * the head if the head is beyond it, but not beyond the tail. Returns the
+ * number of elements passed. */
+static long infqGroupAdvance(robj *q, dictEntry *de, long count) {
+    long long   offset = infqGroupOffset(q, de);
+    long        qlen = infqLength(q);
+
+    if (count > qlen - offset) {
+        count = qlen - offset;
+    }
+    dictSetSignedIntegerVal(de, infqHeadSeq(q) + offset + count);
+    return count;
+}
+
+// QGROUP CREATE|DESTROY|ADVANCE|LIST key [group [count]]
+void qgroupCommand(redisClient *c) {
+    char            *opt = c->argv[1]->ptr;
+    robj            *q;
+    infqObject      *qo;
+    dictIterator    *di;
+    dictEntry       *de;
+    long            count, passed;
+    int             created = 0;
+
+    if (!strcasecmp(opt, "list") && c->argc == 3) {
+        if ((q = lookupKeyReadOrReply(c, c->argv[2], shared.emptymultibulk)) == NULL ||
+                checkType(c, q, REDIS_INFQ)) {
+            return;
+        }
+
+        // the name and the elements left to read of each group
+        addReplyMultiBulkLen(c, infqGroupsLength(q) * 2);
+        if (infqGroupsLength(q) == 0) return;
+        di = dictGetIterator(((infqObject *)q->ptr)->groups);
+        while ((de = dictNext(di)) != NULL) {
+            addReplyBulkCBuffer(c, dictGetKey(de), sdslen(dictGetKey(de)));
+            addReplyLongLong(c, infqLength(q) - infqGroupOffset(q, de));
+        }
+        dictReleaseIterator(di);
+        return;
+    }
+
+    if (!strcasecmp(opt, "create") && c->argc == 4) {
+        q = lookupKeyWrite(c->db, c->argv[2]);
+        if (q && checkType(c, q, REDIS_INFQ)) {
+            return;
+        }
+        if (q && infqHasLanes(q)) {
+            addReplyError(c, "consumer groups can't read an InfQ with priority lanes");
+            return;
+        }
+        // check the group before creating the InfQ, not to leave it empty
+        if (q && ((infqObject *)q->ptr)->groups &&
+                dictFind(((infqObject *)q->ptr)->groups, c->argv[3]->ptr)) {
+            addReplyError(c, "consumer group already exists");
+            return;
+        }
+        if (q == NULL) {
+            if ((q = createInfQ(c->argv[2], c->db, NULL)) == NULL) {
+                addReplyError(c, "failed to create infq");
+                return;
+            }
+            created = 1;
+        }
+
+        if (infqGroupAdd(q, c->argv[3]->ptr, 0) == REDIS_ERR) {
+            addReplyError(c, "failed to create consumer group");
+            if (created) deleteCreatedInfq(c, c->argv[2], q);
+            return;
+        }
+        signalModifiedKey(c->db, c->argv[2]);
+        server.dirty++;
+        addReply(c, shared.ok);
+        return;
+    }
+
+    if (!strcasecmp(opt, "destroy") && c->argc == 4) {
+        if ((q = lookupKeyWriteOrReply(c, c->argv[2], shared.czero)) == NULL ||
+                checkType(c, q, REDIS_INFQ)) {
+            return;
+        }
+
+        qo = q->ptr;
+        if (qo->groups == NULL || dictDelete(qo->groups, c->argv[3]->ptr) == DICT_ERR) {
+            addReply(c, shared.czero);
+            return;
+        }
+        if (dictSize(qo->groups) == 0) {
+            dictRelease(qo->groups);
+            qo->groups = NULL;
+        }
+        infqGroupsTrim(q);
+        signalModifiedKey(c->db, c->argv[2]);
+        server.dirty++;
+        addReply(c, shared.cone);
+        return;
+    }
+
+    if (!strcasecmp(opt, "advance") && c->argc == 5) {
+        if (getLongFromObjectOrReply(c, c->argv[4], &count, "count must be a integer") != REDIS_OK) {
+            return;
+        }
+        if (count < 0) {
+            addReplyError(c, "count can't be negative");
+            return;
+        }
+        if ((q = lookupKeyWriteOrReply(c, c->argv[2], shared.czero)) == NULL ||
+                checkType(c, q, REDIS_INFQ)) {
+            return;
+        }
+
+        qo = q->ptr;
+        if (qo->groups == NULL || (de = dictFind(qo->groups, c->argv[3]->ptr)) == NULL) {
+            addReplyError(c, "no such consumer group");
+            return;
+        }
+        passed = infqGroupAdvance(q, de, count);
+        infqGroupsTrim(q);
+        if (passed > 0) {
+            signalModifiedKey(c->db, c->argv[2]);
+            server.dirty++;
+        }
+        addReplyLongLong(c, passed);
+        return;
+    }
+
+    addReply(c, shared.syntaxerr);
+}
+
+// qread key group count
+void qreadCommand(redisClient *c) {
+    const void  *dataptr;
+    int         size, expiring;
+    robj        *q, *argv[5];
+    dictEntry   *de;
+    long        count, offset, index, qlen, read = 0;
+    mstime_t    now = 0;
+    void        *replylen;
+
+    if (getLongFromObjectOrReply(c, c->argv[3], &count, "count must be a integer") != REDIS_OK) {
+        return;
+    }
+    if (count <= 0) {
+        addReplyError(c, "count must be positive");
+        return;
+    }
+
+    q = lookupKeyWriteOrReply(c, c->argv[1], shared.emptymultibulk);
+    if (q == NULL || checkType(c, q, REDIS_INFQ)) {
+        return;
+    }
+    if (((infqObject *)q->ptr)->groups == NULL ||
+            (de = dictFind(((infqObject *)q->ptr)->groups, c->argv[2]->ptr)) == NULL) {
+        addReplyError(c, "no such consumer group");
+        return;
+    }
+
+    // the expired elements are skipped, the drop at the head is propagated
+    infqExpireHead(c->db, c->argv[1], q);
+    if ((expiring = infqDropsExpired(q))) {
+        now = infqExpireNow();
+    }
+
+    offset = infqGroupOffset(q, de);
+    qlen = infqLength(q);
+    replylen = addDeferredMultiBulkLength(c);
+    for (index = offset; index < qlen && read < count; index++) {
+        if (infqAt(q, index, &dataptr, &size) == INFQ_ERR) {
+            redisLog(REDIS_WARNING, "failed to read InfQ, key: %s, group: %s, idx: %ld",
+                    (char *)c->argv[1]->ptr, (char *)c->argv[2]->ptr, index);
+            break;
+        }
+        if (expiring && infqElementExpired(q, dataptr, size, now)) {
+            continue;
+        }
+
+        if (addReplyInfqElement(c, q, dataptr, size) == REDIS_ERR) {
+            redisLog(REDIS_WARNING, "failed to deserialize");
+            addReply(c, shared.nullbulk);
+        }
+        read++;
+    }
+    setDeferredMultiBulkLength(c, replylen, read);
+
+    if (index == offset) {
+        return;
+    }
+    infqGroupAdvance(q, de, index - offset);
+    infqGroupsTrim(q);
+    signalModifiedKey(c->db, c->argv[1]);
+    server.dirty++;
+
+    // the elements passed are the same on AOF and slaves, unlike the time
+    argv[0] = createStringObject("QGROUP", 6);
+    argv[1] = createStringObject("ADVANCE", 7);
+    argv[2] = c->argv[1];
+    argv[3] = c->argv[2];
+    argv[4] = createStringObjectFromLongLong(index - offset);
+    rewriteClientCommandVector(c, 5, argv[0], argv[1], argv[2], argv[3], argv[4]);
+    decrRefCount(argv[0]);
+    decrRefCount(argv[1]);
+    decrRefCount(argv[4]);
+}
+
+/*-----------------------------------------------------------------------------
+ * Settings of InfQ
+ *
+ * QCREATE creates an InfQ with its own block settings instead of the defaults
+ * of redis.conf, so small queues don't reserve the memory of hot ones, and
+ * QCONFIG reads or changes them. infQ allocates its blocks once when the queue
+ * is initialized, so the settings changed by QCONFIG are saved with the InfQ
+ * and take effect when it is loaded again.
+ *----------------------------------------------------------------------------*/
+
+/* Parse the settings in c->argv[j], c->argv[j+1] ... into 'conf'. */
+int getInfqConfigOrReply(redisClient *c, int j, infqConfig *conf) {
+    long long   ll;
+    double      usage;
+    char        *opt;
+
+    if ((c->argc - j) % 2 != 0) {
+        addReply(c, shared.syntaxerr);
+        return REDIS_ERR;
+    }
+
+    for (; j < c->argc; j += 2) {
+        opt = c->argv[j]->ptr;
+
+        if (!strcasecmp(opt, "dumpusage")) {
+            if (getDoubleFromObjectOrReply(c, c->argv[j+1], &usage, NULL) != REDIS_OK) {
+                return REDIS_ERR;
+            }
+            if (usage <= 0 || usage > 1) {
+                addReplyError(c, "DUMPUSAGE must be in (0, 1]");
+                return REDIS_ERR;
+            }
+            conf->dump_blocks_usage = usage;
+            continue;
+        }
+
+        if (getLongLongFromObjectOrReply(c, c->argv[j+1], &ll, NULL) != REDIS_OK) {
+            return REDIS_ERR;
+        }
+        if (!strcasecmp(opt, "blocksize")) {
+            if (ll < 1024 || ll > INT_MAX) {
+                addReplyError(c, "BLOCKSIZE must be between 1024 and 2147483647");
+                return REDIS_ERR;
+            }
+            conf->mem_block_size = ll;
+        } else if (!strcasecmp(opt, "pushblocks") || !strcasecmp(opt, "popblocks")) {
+            if (ll < 1 || ll > INT_MAX) {
+                addReplyErrorFormat(c, "%s must be positive", opt);
+                return REDIS_ERR;
+            }
+            if (!strcasecmp(opt, "pushblocks")) {
+                conf->pushq_blocks_num = ll;
+            } else {
+                conf->popq_blocks_num = ll;
+            }
+        } else {
+            addReply(c, shared.syntaxerr);
+            return REDIS_ERR;
+        }
+    }
+
+    return REDIS_OK;
+}
+
+// QCREATE key [EXPIRING] [BLOCKSIZE n] [PUSHBLOCKS n] [POPBLOCKS n] [DUMPUSAGE f]
+void qcreateCommand(redisClient *c) {
+    infqConfig  conf;
+    robj        *q;
+    int         expiring;
+
+    if (lookupKeyWrite(c->db, c->argv[1]) != NULL) {
+        addReplyError(c, "key already exists");
+        return;
+    }
+
+    // EXPIRING makes the elements keep the expire time given by QPUSH
+    expiring = c->argc > 2 && !strcasecmp(c->argv[2]->ptr, "expiring");
+
+    initInfqConfig(&conf);
+    if (getInfqConfigOrReply(c, expiring ? 3 : 2, &conf) == REDIS_ERR) {
+        return;
+    }
+
+    if ((q = createInfQ(c->argv[1], c->db, &conf)) == NULL) {
+        addReplyError(c, "failed to create infq");
+        return;
+    }
+    ((infqObject *)q->ptr)->expiring = expiring;
+
+    addReply(c, shared.ok);
+    server.dirty++;
+}
+
+// QCONFIG key GET | QCONFIG key SET option value [option value ...]
+void qconfigCommand(redisClient *c) {
+    robj        *q;
+    infqObject  *qo;
+    infqConfig  conf;
+    char        buf[64];
+
+    if ((q = lookupKeyWriteOrReply(c, c->argv[1], shared.nokeyerr)) == NULL ||
+            checkType(c, q, REDIS_INFQ)) {
+        return;
+    }
+    qo = q->ptr;
+
+    if (c->argc == 3 && !strcasecmp(c->argv[2]->ptr, "get")) {
+        addReplyMultiBulkLen(c, 10);
+        addReplyBulkCString(c, "blocksize");
+        addReplyBulkLongLong(c, qo->conf.mem_block_size);
+        addReplyBulkCString(c, "pushblocks");
+        addReplyBulkLongLong(c, qo->conf.pushq_blocks_num);
+        addReplyBulkCString(c, "popblocks");
+        addReplyBulkLongLong(c, qo->conf.popq_blocks_num);
+        addReplyBulkCString(c, "dumpusage");
+        snprintf(buf, sizeof(buf), "%g", qo->conf.dump_blocks_usage);
+        addReplyBulkCString(c, buf);
+        addReplyBulkCString(c, "expiring");
+        addReplyBulkLongLong(c, qo->expiring);
+    } else if (c->argc > 3 && !strcasecmp(c->argv[2]->ptr, "set")) {
+        conf = qo->conf;
+        if (getInfqConfigOrReply(c, 3, &conf) == REDIS_ERR) {
+            return;
+        }
+
+        // infQ allocates its blocks when it's created, so the options are
+        // only used once the InfQ is loaded again: say it in the reply
+        qo->conf = conf;
+        qo->conf_set = 1;
+        addReplyStatus(c, "DEFERRED");
+        server.dirty++;
+    } else {
+        addReply(c, shared.syntaxerr);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Memory budget of InfQ
+ *
+ * infq-max-memory bounds the memory used by the blocks of all the InfQs. The
+ * blocks of a queue are owned by its infQ, so the budget is kept by spilling
+ * idle InfQs: once per second, if the InfQs use more memory than the budget,
+ * the push queues of the InfQs pushed least recently jump to new blocks, so
+ * their filled blocks are moved to file blocks by the dumper, until the bytes
+ * of the push queues they release cover the excess: the pop queue of a
+ * spilled InfQ stays in memory. InfQs pushed in the last second are
+ * never spilled, the memory is left to them.
+ *----------------------------------------------------------------------------*/
+
+typedef struct infqSpillCandidate {
+    robj *qobj;
+    sds key;
+} infqSpillCandidate;
+
+static int infqSpillCandidateCompare(const void *a, const void *b) {
+    const infqObject *qa = ((infqSpillCandidate *)a)->qobj->ptr;
+    const infqObject *qb = ((infqSpillCandidate *)b)->qobj->ptr;
+
+    if (qa->last_push == qb->last_push) return 0;
+    return qa->last_push < qb->last_push ? -1 : 1;
+}
+
+// return 1 if any lane of the InfQ was pushed since its push queue jumped
+static int infqPushedSinceJump(infqObject *qo) {
+    int j;
+
+    if (qo->pushed != qo->jumped_at) return 1;
+    for (j = 1; j < REDIS_INFQ_PRIORITIES; j++) {
+        if (qo->lanes[j] && qo->lanes[j]->pushed != qo->lanes[j]->jumped_at) return 1;
+    }
+    return 0;
+}
+
+/* Bytes held by the blocks of the push queue of q, which the dumper releases
+ * once the push queue jumped. The pop queue keeps its blocks in memory. */
+static long long infqPushQueueMemory(infqObject *qo, infq_t *q) {
+    infq_stats_t    stats;
+    long long       pushq_size;
+
+    if (infq_fetch_stats(q, &stats) == INFQ_ERR) return 0;
+
+    pushq_size = (long long)stats.pushq_used_blocks * qo->conf.mem_block_size;
+    return pushq_size < stats.mem_size ? pushq_size : stats.mem_size;
+}
+
+/* Make the push queues of the lanes of the InfQ pushed since their last jump
+ * jump to the next memory block, adding to *released the bytes of their push
+ * queues. Returns REDIS_ERR if a lane failed to jump. */
+static int infqJumpLanes(infqObject *qo, long long *released) {
+    infqLane    *lane;
+    long long   pushq_size;
+    int         j;
+
+    if (qo->pushed != qo->jumped_at) {
+        pushq_size = infqPushQueueMemory(qo, qo->q);
+        if (infq_push_queue_jump(qo->q) == INFQ_ERR) return REDIS_ERR;
+        qo->jumped_at = qo->pushed;
+        *released += pushq_size;
+    }
+    for (j = 1; j < REDIS_INFQ_PRIORITIES; j++) {
+        if ((lane = qo->lanes[j]) == NULL || lane->pushed == lane->jumped_at) continue;
+
+        pushq_size = infqPushQueueMemory(qo, lane->q);
+        if (infq_push_queue_jump(lane->q) == INFQ_ERR) return REDIS_ERR;
+        lane->jumped_at = lane->pushed;
+        *released += pushq_size;
+    }
+    return REDIS_OK;
+}
+
+/* Sum the stats of all the InfQs and their lanes for INFO. */
+void getInfqSummary(infqSummary *sum) {
+    dictIterator    *di;
+    dictEntry       *de;
+    robj            *qobj;
+    infqObject      *qo;
+    infq_t          *q;
+    infq_stats_t    stats;
+    int             j;
+
+    memset(sum, 0, sizeof(*sum));
+    di = dictGetIterator(server.infq_keys);
+    while ((de = dictNext(di)) != NULL) {
+        if ((qobj = infqFromKeysEntry(de)) == NULL) continue;
+        qo = qobj->ptr;
+
+        for (j = 0; j < REDIS_INFQ_PRIORITIES; j++) {
+            if ((q = infqLaneQueue(qobj, j)) == NULL) continue;
+
+            sum->reserved_memory += (long long)qo->conf.mem_block_size *
+                (qo->conf.pushq_blocks_num + qo->conf.popq_blocks_num);
+            if (infq_fetch_stats(q, &stats) == INFQ_ERR) continue;
+
+            sum->used_memory += stats.mem_size;
+            sum->dump_jobs += stats.dumper.job_num;
+            sum->load_jobs += stats.loader.job_num;
+            sum->unlink_jobs += stats.unlinker.job_num;
+            sum->busy_executors += (stats.dumper.job_num > 0) +
+                (stats.loader.job_num > 0) + (stats.unlinker.job_num > 0);
+            if (stats.unlinker.is_suspended) sum->suspended_unlinkers++;
+        }
+    }
+    dictReleaseIterator(di);
+}
+
+void infqCron(void) {
+    dictIterator        *di;
+    dictEntry           *de;
+    robj                *qobj;
+    infqObject          *qo;
+    infq_t              *q;
+    infq_stats_t        stats;
+    infqSpillCandidate  *cands;
+    long long           used = 0, excess, released;
+    int                 n = 0, j;
+
+    if (server.infq_max_memory == 0 || dictSize(server.infq_keys) == 0) return;
+
+    cands = zmalloc(sizeof(*cands) * dictSize(server.infq_keys));
+    di = dictGetIterator(server.infq_keys);
+    while ((de = dictNext(di)) != NULL) {
+        if ((qobj = infqFromKeysEntry(de)) == NULL) continue;
+        qo = qobj->ptr;
+
+        for (j = 0; j < REDIS_INFQ_PRIORITIES; j++) {
+            if ((q = infqLaneQueue(qobj, j)) == NULL ||
+                    infq_fetch_stats(q, &stats) == INFQ_ERR) {
+                continue;
+            }
+            used += stats.mem_size;
+        }
+
+        // idle, and pushed since spilled last time
+        if (qo->last_push < server.unixtime && infqPushedSinceJump(qo)) {
+            cands[n].qobj = qobj;
+            cands[n].key = dictGetKey(de);
+            n++;
+        }
+    }
+    dictReleaseIterator(di);
+    server.infq_used_memory = used;
+
+    if (used > server.infq_max_memory) {
+        excess = used - server.infq_max_memory;
+        qsort(cands, n, sizeof(*cands), infqSpillCandidateCompare);
+
+        for (j = 0; j < n && excess > 0; j++) {
+            qo = cands[j].qobj->ptr;
+            released = 0;
+            if (infqJumpLanes(qo, &released) == REDIS_ERR) {
+                redisLog(REDIS_WARNING, "failed to spill InfQ, key: %s", cands[j].key);
+                continue;
+            }
+
+            // the pop queue stays in memory, only the push queue is dumped
+            excess -= released;
+            server.stat_infq_spilled++;
+        }
+
+        if (excess > 0) {
+            redisLog(REDIS_VERBOSE, "InfQs use %lld bytes over infq-max-memory, "
+                    "no more idle InfQ to spill", excess);
+        }
+    }
+
+    zfree(cands);
+}
+
+/* Drop the expired runs at the heads of the expiring InfQs, see
+ * infqDropExpiredRuns(), no more than REDIS_INFQ_EXPIRE_CRON_MAX elements per
+ * call. Slaves only forget the runs popped by the master. */
+void infqExpireCron(void) {
+    dictIterator    *di;
+    dictEntry       *de;
+    robj            *qobj, *key;
+    mstime_t        now;
+    long            dropped, budget = REDIS_INFQ_EXPIRE_CRON_MAX;
+
+    if (dictSize(server.infq_keys) == 0) return;
+
+    now = (server.masterhost == NULL && !server.loading) ? mstime() : 0;
+    di = dictGetIterator(server.infq_keys);
+    while (budget > 0 && (de = dictNext(di)) != NULL) {
+        if ((qobj = infqFromKeysEntry(de)) == NULL || !((infqObject *)qobj->ptr)->expiring) {
+            continue;
+        }
+
+        if ((dropped = infqDropExpiredRuns(qobj, now, budget)) > 0) {
+            key = createStringObject(dictGetKey(de), sdslen(dictGetKey(de)));
+            propagateInfqExpire(dictGetVal(de), key, dropped);
+            decrRefCount(key);
+            budget -= dropped;
+        }
+    }
+    dictReleaseIterator(di);
+}
+
+/* Make the push queue of the InfQs jump to the next memory block before a
+ * snapshot, so the elements pushed so far are dumped by the child. InfQs with
+ * nothing pushed since their last jump are skipped: their push block is
+ * still the empty one left by that jump, jumping again would only waste a
+ * block and dump I/O, which adds up with frequent saves. Returns the number
+ * of InfQs jumped, -1 on error, the number skipped is set in 'skipped'. */
+int infqJumpPushQueues(int *skipped) {
+    dictIterator    *di;
+    dictEntry       *de;
+    robj            *qobj;
+    infqObject      *qo;
+    long long       released = 0;
+    int             jumped = 0;
+
+    *skipped = 0;
+    di = dictGetIterator(server.infq_keys);
+    while ((de = dictNext(di)) != NULL) {
+        if ((qobj = infqFromKeysEntry(de)) == NULL) continue;
+        qo = qobj->ptr;
+        if (!infqPushedSinceJump(qo)) {
+            (*skipped)++;
+            continue;
+        }
+
+        if (infqJumpLanes(qo, &released) == REDIS_ERR) {
+            redisLog(REDIS_WARNING, "failed to jump push queue, key: %s",
+                    (char *)dictGetKey(de));
+            jumped = -1;
+            break;
+        }
+        jumped++;
+    }
+    dictReleaseIterator(di);
+    return jumped;
+}
+
+/*-----------------------------------------------------------------------------
+ * Background unlinkers of InfQ
+ *
+ * Every infQ runs its own dumper, loader and unlinker in background. With
+ * infq-max-bg-unlinkers, at most that many InfQs unlink files at a time: once
+ * per second the slots go to the InfQs with pending unlink jobs in round
+ * robin, and the unlinkers of the other InfQs are suspended until their turn.
+ * The dumper and loader are never suspended, pushes and pops wait on them.
+ * Nothing is done while the unlinkers are suspended for RDB or replication.
+ *----------------------------------------------------------------------------*/
+
+void infqUnlinkerCron(void) {
+    dictIterator    *di;
+    dictEntry       *de;
+    robj            *qobj;
+    infq_t          *q, **qs;
+    infq_stats_t    stats;
+    unsigned long   count = 0, start, j;
+    int             running = 0, p;
+
+    if (server.infq_max_bg_unlinkers == 0 || dictSize(server.infq_keys) == 0 ||
+            server.infq_unlinker_suspend_type != REDIS_INFQ_UNLINKER_SUSPEND_NONE) {
+        return;
+    }
+
+    // the lanes of an InfQ unlink their files like InfQs of their own
+    qs = zmalloc(sizeof(infq_t *) * dictSize(server.infq_keys) * REDIS_INFQ_PRIORITIES);
+    di = dictGetIterator(server.infq_keys);
+    while ((de = dictNext(di)) != NULL) {
+        if ((qobj = infqFromKeysEntry(de)) == NULL) continue;
+
+        for (p = 0; p < REDIS_INFQ_PRIORITIES; p++) {
+            if ((q = infqLaneQueue(qobj, p)) != NULL) qs[count++] = q;
+        }
+    }
+    dictReleaseIterator(di);
+
+    start = count ? server.infq_unlinker_rr++ % count : 0;
+    for (j = 0; j < count; j++) {
+        q = qs[(start + j) % count];
+        if (infq_fetch_stats(q, &stats) == INFQ_ERR || stats.unlinker.job_num == 0) {
+            continue;
+        }
+
+        if (running < server.infq_max_bg_unlinkers) {
+            running++;
+            if (stats.unlinker.is_suspended &&
+                    infq_continue_bg_exec_if_suspended(q, INFQ_UNLINK_BG_EXEC) == INFQ_ERR) {
+                redisLog(REDIS_WARNING, "failed to continue unlinker");
+            }
+        } else if (!stats.unlinker.is_suspended &&
+                infq_suspend_bg_exec(q, INFQ_UNLINK_BG_EXEC) == INFQ_ERR) {
+            redisLog(REDIS_WARNING, "failed to suspend unlinker");
+        }
+    }
+
+    zfree(qs);
 }
 
 void qinspectCommand(redisClient *c) {
@@ -628,7 +2897,7 @@ void qinspectCommand(redisClient *c) {
         return;
     }
 
-    if ((debug_info = infq_debug_info(qobj->ptr, buf, 2048)) == NULL) {
+    if ((debug_info = infq_debug_info(infqPtr(qobj), buf, 2048)) == NULL) {
         addReply(c, shared.nullbulk);
         return;
     }
@@ -34,13 +34,13 @@
  *----------------------------------------------------------------------------*/
 
 /* Check the argument length to see if it requires us to convert the ziplist
- * to a real list. Only check raw-encoded objects because integer encoded
+ * to a quicklist. Only check raw-encoded objects because integer encoded
  * objects are never too long. */
 void listTypeTryConversion(robj *subject, robj *value) {
     if (subject->encoding != REDIS_ENCODING_ZIPLIST) return;
     if (sdsEncodedObject(value) &&
         sdslen(value->ptr) > server.list_max_ziplist_value)
-            listTypeConvert(subject,REDIS_ENCODING_LINKEDLIST);
+            listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
 }
 
 /* The function pushes an element to the specified list object 'subject',
@@ -53,25 +53,27 @@ void listTypePush(robj *subject, robj *value, int where) {
     listTypeTryConversion(subject,value);
     if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
         ziplistLen(subject->ptr) >= server.list_max_ziplist_entries)
-            listTypeConvert(subject,REDIS_ENCODING_LINKEDLIST);
+            listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
 
     if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
         int pos = (where == REDIS_HEAD) ? ZIPLIST_HEAD : ZIPLIST_TAIL;
         value = getDecodedObject(value);
         subject->ptr = ziplistPush(subject->ptr,value->ptr,sdslen(value->ptr),pos);
         decrRefCount(value);
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        if (where == REDIS_HEAD) {
-            listAddNodeHead(subject->ptr,value);
-        } else {
-            listAddNodeTail(subject->ptr,value);
-        }
-        incrRefCount(value);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+        value = getDecodedObject(value);
+        quicklistPush(subject->ptr,value->ptr,sdslen(value->ptr),pos);
+        decrRefCount(value);
     } else {
         redisPanic("Unknown list encoding");
     }
 }
 
+static void *listPopSaver(unsigned char *data, unsigned int sz) {
+    return createStringObject((char*)data,sz);
+}
+
 robj *listTypePop(robj *subject, int where) {
     robj *value = NULL;
     if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
@@ -90,18 +92,12 @@ robj *listTypePop(robj *subject, int where) {
             /* We only need to delete an element when it exists */
             subject->ptr = ziplistDelete(subject->ptr,&p);
         }
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list *list = subject->ptr;
-        listNode *ln;
-        if (where == REDIS_HEAD) {
-            ln = listFirst(list);
-        } else {
-            ln = listLast(list);
-        }
-        if (ln != NULL) {
-            value = listNodeValue(ln);
-            incrRefCount(value);
-            listDelNode(list,ln);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        long long vlong;
+        int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+        if (quicklistPopCustom(subject->ptr,pos,(unsigned char **)&value,
+                               NULL,&vlong,listPopSaver)) {
+            if (value == NULL) value = createStringObjectFromLongLong(vlong);
         }
     } else {
         redisPanic("Unknown list encoding");
@@ -112,8 +108,8 @@ robj *listTypePop(robj *subject, int where) {
 unsigned long listTypeLength(robj *subject) {
     if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
         return ziplistLen(subject->ptr);
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        return listLength((list*)subject->ptr);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistCount(subject->ptr);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -127,8 +123,11 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char
     li->direction = direction;
     if (li->encoding == REDIS_ENCODING_ZIPLIST) {
         li->zi = ziplistIndex(subject->ptr,index);
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        li->ln = listIndex(subject->ptr,index);
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        /* REDIS_TAIL means iterating towards the tail, that is starting
+         * from the head. */
+        int qldir = (direction == REDIS_TAIL) ? AL_START_HEAD : AL_START_TAIL;
+        li->iter = quicklistGetIteratorAtIdx(subject->ptr,qldir,index);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -137,6 +136,8 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char
 
 /* Clean up the iterator. */
 void listTypeReleaseIterator(listTypeIterator *li) {
+    if (li->encoding == REDIS_ENCODING_QUICKLIST)
+        quicklistReleaseIterator(li->iter);
     zfree(li);
 }
 
@@ -157,15 +158,8 @@ int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
                 li->zi = ziplistPrev(li->subject->ptr,li->zi);
             return 1;
         }
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        entry->ln = li->ln;
-        if (entry->ln != NULL) {
-            if (li->direction == REDIS_TAIL)
-                li->ln = li->ln->next;
-            else
-                li->ln = li->ln->prev;
-            return 1;
-        }
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistNext(li->iter,&entry->entry);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -188,10 +182,13 @@ robj *listTypeGet(listTypeEntry *entry) {
                 value = createStringObjectFromLongLong(vlong);
             }
         }
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        redisAssert(entry->ln != NULL);
-        value = listNodeValue(entry->ln);
-        incrRefCount(value);
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        if (entry->entry.value) {
+            value = createStringObject((char*)entry->entry.value,
+                                       entry->entry.sz);
+        } else {
+            value = createStringObjectFromLongLong(entry->entry.longval);
+        }
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -216,13 +213,16 @@ void listTypeInsert(listTypeEntry *entry, robj *value, int where) {
             subject->ptr = ziplistInsert(subject->ptr,entry->zi,value->ptr,sdslen(value->ptr));
         }
         decrRefCount(value);
-    } else if (entry->li->encoding == REDIS_ENCODING_LINKEDLIST) {
+    } else if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
+        value = getDecodedObject(value);
         if (where == REDIS_TAIL) {
-            listInsertNode(subject->ptr,entry->ln,value,AL_START_TAIL);
+            quicklistInsertAfter(subject->ptr,&entry->entry,
+                                 value->ptr,sdslen(value->ptr));
         } else {
-            listInsertNode(subject->ptr,entry->ln,value,AL_START_HEAD);
+            quicklistInsertBefore(subject->ptr,&entry->entry,
+                                  value->ptr,sdslen(value->ptr));
         }
-        incrRefCount(value);
+        decrRefCount(value);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -234,8 +234,9 @@ int listTypeEqual(listTypeEntry *entry, robj *o) {
     if (li->encoding == REDIS_ENCODING_ZIPLIST) {
         redisAssertWithInfo(NULL,o,sdsEncodedObject(o));
         return ziplistCompare(entry->zi,o->ptr,sdslen(o->ptr));
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        return equalStringObjects(o,listNodeValue(entry->ln));
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        redisAssertWithInfo(NULL,o,sdsEncodedObject(o));
+        return quicklistCompare(entry->entry.zi,o->ptr,sdslen(o->ptr));
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -253,36 +254,25 @@ void listTypeDelete(listTypeEntry *entry) {
             li->zi = p;
         else
             li->zi = ziplistPrev(li->subject->ptr,p);
-    } else if (entry->li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode *next;
-        if (li->direction == REDIS_TAIL)
-            next = entry->ln->next;
-        else
-            next = entry->ln->prev;
-        listDelNode(li->subject->ptr,entry->ln);
-        li->ln = next;
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistDelEntry(li->iter,&entry->entry);
     } else {
         redisPanic("Unknown list encoding");
     }
 }
 
 void listTypeConvert(robj *subject, int enc) {
-    listTypeIterator *li;
-    listTypeEntry entry;
     redisAssertWithInfo(NULL,subject,subject->type == REDIS_LIST);
-
-    if (enc == REDIS_ENCODING_LINKEDLIST) {
-        list *l = listCreate();
-        listSetFreeMethod(l,decrRefCountVoid);
-
-        /* listTypeGet returns a robj with incremented refcount */
-        li = listTypeInitIterator(subject,0,REDIS_TAIL);
-        while (listTypeNext(li,&entry)) listAddNodeTail(l,listTypeGet(&entry));
-        listTypeReleaseIterator(li);
-
-        subject->encoding = REDIS_ENCODING_LINKEDLIST;
-        zfree(subject->ptr);
-        subject->ptr = l;
+    redisAssertWithInfo(NULL,subject,
+                        subject->encoding == REDIS_ENCODING_ZIPLIST);
+
+    if (enc == REDIS_ENCODING_QUICKLIST) {
+        /* The ziplist is consumed: it usually becomes the first node of the
+         * quicklist as it is, otherwise its entries are copied. */
+        subject->ptr = quicklistCreateFromZiplist(
+            server.list_max_ziplist_entries,server.list_compress_depth,
+            subject->ptr);
+        subject->encoding = REDIS_ENCODING_QUICKLIST;
     } else {
         redisPanic("Unsupported list conversion");
     }
@@ -360,7 +350,7 @@ void pushxGenericCommand(redisClient *c, robj *refval, robj *val, int where) {
             /* Check if the length exceeds the ziplist length threshold. */
             if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
                 ziplistLen(subject->ptr) > server.list_max_ziplist_entries)
-                    listTypeConvert(subject,REDIS_ENCODING_LINKEDLIST);
+                    listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
             signalModifiedKey(c->db,c->argv[1]);
             notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"linsert",
                                 c->argv[1],c->db->id);
@@ -435,14 +425,21 @@ void lindexCommand(redisClient *c) {
         } else {
             addReply(c,shared.nullbulk);
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode *ln = listIndex(o->ptr,index);
-        if (ln != NULL) {
-            value = listNodeValue(ln);
-            addReplyBulk(c,value);
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistIter *iter;
+        quicklistEntry entry;
+
+        iter = quicklistGetIteratorAtIdx(o->ptr,AL_START_TAIL,index);
+        if (quicklistNext(iter,&entry)) {
+            if (entry.value) {
+                addReplyBulkCBuffer(c,entry.value,entry.sz);
+            } else {
+                addReplyBulkLongLong(c,entry.longval);
+            }
         } else {
             addReply(c,shared.nullbulk);
         }
+        quicklistReleaseIterator(iter);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -473,14 +470,16 @@ void lsetCommand(redisClient *c) {
             notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"lset",c->argv[1],c->db->id);
             server.dirty++;
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode *ln = listIndex(o->ptr,index);
-        if (ln == NULL) {
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        int replaced;
+
+        value = getDecodedObject(value);
+        replaced = quicklistReplaceAtIndex(o->ptr,index,
+                                           value->ptr,sdslen(value->ptr));
+        decrRefCount(value);
+        if (!replaced) {
             addReply(c,shared.outofrangeerr);
         } else {
-            decrRefCount((robj*)listNodeValue(ln));
-            listNodeValue(ln) = value;
-            incrRefCount(value);
             addReply(c,shared.ok);
             signalModifiedKey(c->db,c->argv[1]);
             notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"lset",c->argv[1],c->db->id);
@@ -564,28 +563,29 @@ void lrangeCommand(redisClient *c) {
             }
             p = ziplistNext(o->ptr,p);
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode *ln;
-
-        /* If we are nearest to the end of the list, reach the element
-         * starting from tail and going backward, as it is faster. */
-        if (start > llen/2) start -= llen;
-        ln = listIndex(o->ptr,start);
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        /* The start element is reached from the nearest end of the list. */
+        quicklistIter *iter = quicklistGetIteratorAtIdx(o->ptr,
+                                                        AL_START_HEAD,start);
+        quicklistEntry entry;
 
         while(rangelen--) {
-            addReplyBulk(c,ln->value);
-            ln = ln->next;
+            quicklistNext(iter,&entry);
+            if (entry.value) {
+                addReplyBulkCBuffer(c,entry.value,entry.sz);
+            } else {
+                addReplyBulkLongLong(c,entry.longval);
+            }
         }
+        quicklistReleaseIterator(iter);
     } else {
-        redisPanic("List encoding is not LINKEDLIST nor ZIPLIST!");
+        redisPanic("List encoding is not QUICKLIST nor ZIPLIST!");
     }
 }
 
 void ltrimCommand(redisClient *c) {
     robj *o;
-    long start, end, llen, j, ltrim, rtrim;
-    list *list;
-    listNode *ln;
+    long start, end, llen, ltrim, rtrim;
 
     if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != REDIS_OK) ||
         (getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != REDIS_OK)) return;
@@ -615,16 +615,9 @@ void ltrimCommand(redisClient *c) {
     if (o->encoding == REDIS_ENCODING_ZIPLIST) {
         o->ptr = ziplistDeleteRange(o->ptr,0,ltrim);
         o->ptr = ziplistDeleteRange(o->ptr,-rtrim,rtrim);
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list = o->ptr;
-        for (j = 0; j < ltrim; j++) {
-            ln = listFirst(list);
-            listDelNode(list,ln);
-        }
-        for (j = 0; j < rtrim; j++) {
-            ln = listLast(list);
-            listDelNode(list,ln);
-        }
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistDelRange(o->ptr,0,ltrim);
+        quicklistDelRange(o->ptr,-rtrim,rtrim);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -652,9 +645,8 @@ void lremCommand(redisClient *c) {
     subject = lookupKeyWriteOrReply(c,c->argv[1],shared.czero);
     if (subject == NULL || checkType(c,subject,REDIS_LIST)) return;
 
-    /* Make sure obj is raw when we're dealing with a ziplist */
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST)
-        obj = getDecodedObject(obj);
+    /* Make sure obj is raw, both encodings compare against ziplist entries */
+    obj = getDecodedObject(obj);
 
     listTypeIterator *li;
     if (toremove < 0) {
@@ -675,8 +667,7 @@ void lremCommand(redisClient *c) {
     listTypeReleaseIterator(li);
 
     /* Clean up raw encoded object */
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST)
-        decrRefCount(obj);
+    decrRefCount(obj);
 
     if (listTypeLength(subject) == 0) dbDelete(c->db,c->argv[1]);
     addReplyLongLong(c,removed);
@@ -771,8 +762,9 @@ void rpoplpushCommand(redisClient *c) {
  */
 
 /* Set a client in blocking mode for the specified key, with the specified
- * timeout */
-void blockForKeys(redisClient *c, robj **keys, int numkeys, mstime_t timeout, robj *target) {
+ * timeout. 'btype' is REDIS_BLOCKED_LIST or REDIS_BLOCKED_INFQ, depending on
+ * the type of the keys the client waits for. */
+void blockForKeys(redisClient *c, robj **keys, int numkeys, mstime_t timeout, robj *target, int btype) {
     dictEntry *de;
     list *l;
     int j;
@@ -802,7 +794,7 @@ void blockForKeys(redisClient *c, robj **keys, int numkeys, mstime_t timeout, ro
         }
         listAddNodeTail(l,c);
     }
-    blockClient(c,REDIS_BLOCKED_LIST);
+    blockClient(c,btype);
 }
 
 /* Unblock a client that's waiting in a blocking operation such as BLPOP.
@@ -964,23 +956,45 @@ void handleClientsBlockedOnLists(void) {
              * we can safely call signalListAsReady() against this key. */
             dictDelete(rl->db->ready_keys,rl->key);
 
-            /* If the key exists and it's a list, serve blocked clients
-             * with data. */
+            /* If the key exists and it's a list or an InfQ, serve blocked
+             * clients with data. */
             robj *o = lookupKeyWrite(rl->db,rl->key);
-            if (o != NULL && o->type == REDIS_LIST) {
+            if (o != NULL && (o->type == REDIS_LIST || o->type == REDIS_INFQ)) {
                 dictEntry *de;
+                int btype = (o->type == REDIS_LIST) ? REDIS_BLOCKED_LIST :
+                                                      REDIS_BLOCKED_INFQ;
 
                 /* We serve clients in the same order they blocked for
                  * this key, from the first blocked to the last. */
                 de = dictFind(rl->db->blocking_keys,rl->key);
                 if (de) {
                     list *clients = dictGetVal(de);
-                    int numclients = listLength(clients);
+                    listNode *clientnode;
+                    listIter li;
 
-                    while(numclients--) {
-                        listNode *clientnode = listFirst(clients);
+                    /* Served clients are removed from the list while
+                     * iterating, which is safe with a list iterator. */
+                    listRewind(clients,&li);
+                    while((clientnode = listNext(&li)) != NULL) {
                         redisClient *receiver = clientnode->value;
                         robj *dstkey = receiver->bpop.target;
+
+                        /* Clients blocked for the other type of key keep
+                         * waiting. */
+                        if (receiver->btype != btype) continue;
+
+                        if (o->type == REDIS_INFQ) {
+                            infqExpireHead(rl->db,rl->key,o);
+                            if (infqLength(o) == 0) break;
+
+                            if (dstkey) incrRefCount(dstkey);
+                            unblockClient(receiver);
+                            serveClientBlockedOnInfQ(receiver,
+                                rl->key,dstkey,rl->db,o);
+                            if (dstkey) decrRefCount(dstkey);
+                            continue;
+                        }
+
                         int where = (receiver->lastcmd &&
                                      receiver->lastcmd->proc == blpopCommand) ?
                                     REDIS_HEAD : REDIS_TAIL;
@@ -1010,7 +1024,8 @@ void handleClientsBlockedOnLists(void) {
                     }
                 }
 
-                if (listTypeLength(o) == 0) dbDelete(rl->db,rl->key);
+                if (o->type == REDIS_LIST && listTypeLength(o) == 0)
+                    dbDelete(rl->db,rl->key);
                 /* We don't call signalModifiedKey() as it was already called
                  * when an element was pushed on the list. */
             }
@@ -1078,7 +1093,7 @@ void blockingPopGenericCommand(redisClient *c, int where) {
     }
 
     /* If the list is empty or the key does not exists we must block */
-    blockForKeys(c, c->argv + 1, c->argc - 2, timeout, NULL);
+    blockForKeys(c, c->argv + 1, c->argc - 2, timeout, NULL, REDIS_BLOCKED_LIST);
 }
 
 void blpopCommand(redisClient *c) {
@@ -1104,7 +1119,7 @@ void brpoplpushCommand(redisClient *c) {
             addReply(c, shared.nullbulk);
         } else {
             /* The list is empty and the client blocks. */
-            blockForKeys(c, c->argv + 1, 1, timeout, c->argv[2]);
+            blockForKeys(c, c->argv + 1, 1, timeout, c->argv[2], REDIS_BLOCKED_LIST);
         }
     } else {
         if (key->type != REDIS_LIST) {
@@ -915,24 +915,18 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
     unsigned char *eptr = ziplistIndex(zl,0), *sptr;
 
+    if (eptr == NULL) return NULL;
     ele = getDecodedObject(ele);
-    while (eptr != NULL) {
+    /* Elements and scores alternate, so skip the scores. */
+    eptr = ziplistFind(zl,eptr,ele->ptr,sdslen(ele->ptr),1);
+    if (eptr != NULL && score != NULL) {
+        /* Matching element, pull out score. */
         sptr = ziplistNext(zl,eptr);
         redisAssertWithInfo(NULL,ele,sptr != NULL);
-
-        if (ziplistCompare(eptr,ele->ptr,sdslen(ele->ptr))) {
-            /* Matching element, pull out score. */
-            if (score != NULL) *score = zzlGetScore(sptr);
-            decrRefCount(ele);
-            return eptr;
-        }
-
-        /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        *score = zzlGetScore(sptr);
     }
-
     decrRefCount(ele);
-    return NULL;
+    return eptr;
 }
 
 /* Delete (element,score) pair from ziplist. Use local copy of eptr because we
@@ -0,0 +1,149 @@
+/* Ziplist lookup micro-benchmark.
+ *
+ * Measures the ziplist hot paths used by HGET/HEXISTS, ZSCORE, LINDEX and
+ * LRANGE on small encodings: ziplistFind() with every scan implementation
+ * supported by the CPU, ziplistIndex() and ziplistNext(). The results of
+ * the SIMD scans are checked against the scalar one.
+ *
+ * Build it with 'make ziplist-benchmark' and run it as:
+ *
+ *   ./ziplist-benchmark [lookups]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "ziplist.h"
+#include "zmalloc.h"
+
+void _redisAssert(char *estr, char *file, int line) {
+    fprintf(stderr,"=== ASSERTION FAILED ===\n");
+    fprintf(stderr,"==> %s:%d '%s' is not true\n",file,line,estr);
+    abort();
+}
+
+/* Written by the benchmarks so that the loops are not optimized away. */
+static volatile long long sink;
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Create a ziplist laid out like a hash of 'pairs' fields. */
+static unsigned char *createHashZiplist(int pairs) {
+    unsigned char *zl = ziplistNew();
+    char buf[64];
+    int j, len;
+
+    for (j = 0; j < pairs; j++) {
+        len = snprintf(buf,sizeof(buf),"field:%d",j);
+        zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+        len = snprintf(buf,sizeof(buf),"value:%d:%d",j,rand());
+        zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+    }
+    return zl;
+}
+
+/* Look up 'lookups' random fields, existing ones if 'hit' is true, and
+ * return the sum of the offsets found so the results can be compared. */
+static long long benchFind(unsigned char *zl, int pairs, long lookups,
+                           int hit, long long *elapsed) {
+    long long start, sum = 0;
+    char buf[64];
+    long j;
+    int len;
+
+    srand(1234);
+    start = ustime();
+    for (j = 0; j < lookups; j++) {
+        int field = rand() % pairs;
+        unsigned char *p;
+
+        if (hit)
+            len = snprintf(buf,sizeof(buf),"field:%d",field);
+        else
+            len = snprintf(buf,sizeof(buf),"missing:%d",field);
+        p = ziplistFind(zl,ziplistIndex(zl,ZIPLIST_HEAD),
+                        (unsigned char*)buf,len,1);
+        if (p) sum += p-zl;
+    }
+    *elapsed = ustime()-start;
+    return sum;
+}
+
+static void benchIndex(unsigned char *zl, long lookups) {
+    unsigned int count = ziplistLen(zl);
+    long long start, sum = 0;
+    long j;
+
+    srand(1234);
+    start = ustime();
+    for (j = 0; j < lookups; j++) {
+        unsigned char *p = ziplistIndex(zl,rand() % count);
+        sum += p-zl;
+    }
+    printf("    %-22s %8.1f ns/op\n","ziplistIndex",
+        (double)(ustime()-start)*1000/lookups);
+
+    start = ustime();
+    for (j = 0; j < lookups/count+1; j++) {
+        unsigned char *p = ziplistIndex(zl,0);
+        while (p) {
+            sum += p-zl;
+            p = ziplistNext(zl,p);
+        }
+    }
+    printf("    %-22s %8.1f ns/entry\n","ziplistNext",
+        (double)(ustime()-start)*1000/((lookups/count+1)*count));
+    sink = sum;
+}
+
+int main(int argc, char **argv) {
+    const char *impls[] = {"scalar","sse2","avx2"};
+    int sizes[] = {16, 128, 512, 2048};
+    long lookups = (argc > 1) ? atol(argv[1]) : 200000;
+    unsigned int i, k;
+    int hit;
+
+    if (lookups <= 0) {
+        fprintf(stderr,"Usage: %s [lookups]\n",argv[0]);
+        return 1;
+    }
+    printf("Default scan implementation: %s\n",ziplistScanImpl());
+
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        unsigned char *zl = createHashZiplist(sizes[i]);
+
+        printf("\n%d fields, %zu bytes:\n",sizes[i],ziplistBlobLen(zl));
+        for (hit = 1; hit >= 0; hit--) {
+            long long expected = 0;
+
+            for (k = 0; k < sizeof(impls)/sizeof(impls[0]); k++) {
+                long long elapsed, sum;
+                char name[32];
+
+                if (!ziplistSetScanImpl(impls[k])) continue;
+                sum = benchFind(zl,sizes[i],lookups,hit,&elapsed);
+                if (k == 0) {
+                    expected = sum;
+                } else if (sum != expected) {
+                    printf("ERROR: %s results differ from scalar\n",
+                        impls[k]);
+                    return 1;
+                }
+                snprintf(name,sizeof(name),"ziplistFind %s %s",
+                    hit ? "hit" : "miss",impls[k]);
+                printf("    %-22s %8.1f ns/op\n",name,
+                    (double)elapsed*1000/lookups);
+            }
+        }
+        ziplistSetScanImpl("auto");
+        benchIndex(zl,lookups);
+        zfree(zl);
+    }
+    return 0;
+}
@@ -308,6 +308,10 @@ static int zipPrevLenByteDiff(unsigned char *p, unsigned int len) {
 /* Return the total number of bytes used by the entry pointed to by 'p'. */
 static unsigned int zipRawEntryLength(unsigned char *p) {
     unsigned int prevlensize, encoding, lensize, len;
+
+    /* Fast path for the most common entry: one byte previous entry length
+     * followed by a string of up to 63 bytes. */
+    if (p[0] < ZIP_BIGLEN && p[1] < ZIP_STR_14B) return 2 + p[1];
     ZIP_DECODE_PREVLENSIZE(p, prevlensize);
     ZIP_DECODE_LENGTH(p + prevlensize, encoding, lensize, len);
     return prevlensize + lensize + len;
@@ -815,13 +819,168 @@ unsigned int ziplistCompare(unsigned char *p, unsigned char *sstr, unsigned int
     return 0;
 }
 
-/* Find pointer to the entry equal to the specified entry. Skip 'skip' entries
- * between every comparison. Returns NULL when the field could not be found. */
-unsigned char *ziplistFind(unsigned char *p, unsigned char *vstr, unsigned int vlen, unsigned int skip) {
+/* ziplistFind() has to walk the entries one after the other, since the
+ * position of every entry depends on the length of the previous ones. However
+ * a string of 1 to 63 bytes that can't be encoded as an integer can only be
+ * found in an entry whose encoding byte is the string length, followed by the
+ * string itself. So the raw bytes of the ziplist are scanned in bulk looking
+ * for a candidate position 'c' where c[0] is the length, and c[1] and c[len]
+ * are the first and the last byte of the searched string. The entries before
+ * the candidate are skipped without decoding them fully, and when no
+ * candidate is left the search ends without walking the rest of the
+ * ziplist, that makes lookups of missing fields much faster.
+ *
+ * The scan uses AVX2 or SSE2 when the CPU supports them, otherwise the
+ * entries are compared one by one. The implementation is selected using
+ * cpuid the first time ziplistFind() is called. The scan functions search
+ * [s,end), where 'end' points to the ZIP_END byte, and return NULL if there
+ * is no candidate. */
+typedef unsigned char *(*zipScanFunc)(unsigned char *s, unsigned char *end,
+                                      unsigned char *vstr, unsigned int vlen);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || \
+     (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_ZIPLIST_SIMD 1
+#include <immintrin.h>
+
+/* Check the positions left by the vectorized loops one at a time. */
+static unsigned char *zipScanTail(unsigned char *s, unsigned char *end,
+                                  unsigned char *vstr, unsigned int vlen) {
+    unsigned char first = vstr[0], last = vstr[vlen-1];
+
+    for (; s + vlen < end; s++) {
+        if (s[0] == vlen && s[1] == first && s[vlen] == last) return s;
+    }
+    return NULL;
+}
+
+__attribute__((target("sse2")))
+static unsigned char *zipScanSSE2(unsigned char *s, unsigned char *end,
+                                  unsigned char *vstr, unsigned int vlen) {
+    const __m128i len = _mm_set1_epi8((char)vlen);
+    const __m128i first = _mm_set1_epi8((char)vstr[0]);
+    const __m128i last = _mm_set1_epi8((char)vstr[vlen-1]);
+
+    /* Check 16 positions at a time, as long as all the loads are before
+     * the end of the ziplist. */
+    while (s + vlen + 16 <= end) {
+        __m128i a = _mm_loadu_si128((const __m128i*)s);
+        __m128i b = _mm_loadu_si128((const __m128i*)(s+1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s+vlen));
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a,len),
+                                        _mm_cmpeq_epi8(b,first)),
+                          _mm_cmpeq_epi8(c,last)));
+        if (mask) return s + __builtin_ctz(mask);
+        s += 16;
+    }
+    return zipScanTail(s,end,vstr,vlen);
+}
+
+__attribute__((target("avx2")))
+static unsigned char *zipScanAVX2(unsigned char *s, unsigned char *end,
+                                  unsigned char *vstr, unsigned int vlen) {
+    const __m256i len = _mm256_set1_epi8((char)vlen);
+    const __m256i first = _mm256_set1_epi8((char)vstr[0]);
+    const __m256i last = _mm256_set1_epi8((char)vstr[vlen-1]);
+
+    /* Same as the SSE2 version, 32 positions at a time. */
+    while (s + vlen + 32 <= end) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)s);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s+1));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(s+vlen));
+        unsigned int mask = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(a,len),
+                                              _mm256_cmpeq_epi8(b,first)),
+                             _mm256_cmpeq_epi8(c,last)));
+        if (mask) return s + __builtin_ctz(mask);
+        s += 32;
+    }
+    return zipScanSSE2(s,end,vstr,vlen);
+}
+#endif
+
+/* The scan in use, NULL when comparing the entries one by one. */
+static zipScanFunc zipScan = NULL;
+static const char *zipScanName = NULL;
+
+/* Select the ziplistFind() implementation by name: "scalar", "sse2", "avx2",
+ * or "auto" for the best one supported by the CPU. Returns 0 if the requested
+ * implementation is unknown or not supported. */
+int ziplistSetScanImpl(const char *name) {
+    int autoselect = !strcmp(name,"auto");
+
+#ifdef HAVE_ZIPLIST_SIMD
+    __builtin_cpu_init();
+    if ((autoselect || !strcmp(name,"avx2")) &&
+        __builtin_cpu_supports("avx2"))
+    {
+        zipScan = zipScanAVX2;
+        zipScanName = "avx2";
+        return 1;
+    }
+    if ((autoselect || !strcmp(name,"sse2")) &&
+        __builtin_cpu_supports("sse2"))
+    {
+        zipScan = zipScanSSE2;
+        zipScanName = "sse2";
+        return 1;
+    }
+#endif
+    if (autoselect || !strcmp(name,"scalar")) {
+        zipScan = NULL;
+        zipScanName = "scalar";
+        return 1;
+    }
+    return 0;
+}
+
+/* Return the name of the ziplistFind() implementation in use. */
+const char *ziplistScanImpl(void) {
+    if (zipScanName == NULL) ziplistSetScanImpl("auto");
+    return zipScanName;
+}
+
+/* Find pointer to the entry equal to the specified entry, starting from the
+ * entry 'p' of the ziplist 'zl'. Skip 'skip' entries between every
+ * comparison. Returns NULL when the field could not be found. */
+unsigned char *ziplistFind(unsigned char *zl, unsigned char *p, unsigned char *vstr, unsigned int vlen, unsigned int skip) {
     int skipcnt = 0;
     unsigned char vencoding = 0;
     long long vll = 0;
 
+    if (zipScanName == NULL) ziplistSetScanImpl("auto");
+
+    /* Use the candidate scan for short strings that can't be encoded as
+     * integers, see above. */
+    if (zipScan && vlen > 0 && vlen < ZIP_STR_14B &&
+        !zipTryEncoding(vstr, vlen, &vll, &vencoding))
+    {
+        unsigned char *end = ZIPLIST_ENTRY_END(zl);
+        unsigned char *c = zipScan(p, end, vstr, vlen);
+
+        while (c != NULL) {
+            unsigned char *e = NULL;
+
+            /* Move to the entry whose encoding byte 'e' is at or after the
+             * candidate, keeping track of the entries to skip. */
+            while (p[0] != ZIP_END) {
+                e = p + ((p[0] < ZIP_BIGLEN) ? 1 : 5);
+                if (e >= c) break;
+                p += zipRawEntryLength(p);
+                skipcnt = (skipcnt == 0) ? (int)skip : skipcnt-1;
+            }
+            if (p[0] == ZIP_END) return NULL;
+
+            /* The length, first and last bytes already match. */
+            if (e == c && skipcnt == 0 && memcmp(c+1, vstr, vlen) == 0)
+                return p;
+            c = zipScan((e > c) ? e : c+1, end, vstr, vlen);
+        }
+        return NULL;
+    }
+
     while (p[0] != ZIP_END) {
         unsigned int prevlensize, encoding, lensize, len;
         unsigned char *q;
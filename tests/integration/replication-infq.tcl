@@ -0,0 +1,95 @@
+proc infq_file_block {dir queue} {
+    set path [file join $dir $queue file_block_0]
+    if {![file exists $path]} {return {}}
+    set fd [open $path r]
+    set content [read $fd]
+    close $fd
+    return $content
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_dir [lindex [$master config get dir] 1]
+
+    start_server {} {
+        set slave [srv 0 client]
+        set slave_dir [lindex [$slave config get dir] 1]
+
+        test {InfQ files - A key named like a lane is sent apart from the lane} {
+            $master qpush a#1 x
+            $master qpush a PRIORITY 1 y
+            # the key a#1 and the lane 1 of a hold a file block each
+            foreach {dir content} {infq_data key infq_data.lanes lane} {
+                file mkdir [file join $master_dir $dir a#1]
+                set fd [open [file join $master_dir $dir a#1 file_block_0] w]
+                puts -nonewline $fd $content
+                close $fd
+            }
+
+            $slave slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [string match {*master_link_status:up*} [$slave info replication]]
+            } else {
+                fail "Slave not synced with master"
+            }
+            list [infq_file_block [file join $slave_dir infq_data] a#1] \
+                 [infq_file_block [file join $slave_dir infq_data.lanes] a#1] \
+                 [$slave qrange a#1 0 -1] [$slave qrange a 0 -1]
+        } {key lane x y}
+    }
+}
+
+# Sync with the master like a slave advertising 'capa', and return the header
+# of the first InfQ file sent.
+proc infq_sync_file_header {capa} {
+    set s [socket [srv 0 host] [srv 0 port]]
+    fconfigure $s -translation binary
+    if {$capa ne {}} {
+        puts -nonewline $s "REPLCONF capa $capa\r\n"
+        flush $s
+        gets $s
+    }
+    puts -nonewline $s "SYNC\r\n"
+    flush $s
+
+    # newlines are sent while the RDB is saved
+    while {[set count [string trim [gets $s]]] eq {}} {}
+    set count [string range $count 1 end]
+    while {$count} {
+        set buf [read $s $count]
+        set count [expr {$count-[string length $buf]}]
+    }
+
+    set keys [string trim [gets $s]]
+    set queue [string trim [gets $s]]
+    set file [string trim [gets $s]]
+    close $s
+    assert_equal {$infq_keys_to_send 1} $keys
+    assert_match {$q 0 * 1} $queue
+    return $file
+}
+
+start_server {tags {"repl"}} {
+    r qpush q a
+    set dir [lindex [r config get dir] 1]
+    file mkdir [file join $dir infq_data q]
+    set fd [open [file join $dir infq_data q file_block_0] w]
+    puts -nonewline $fd "block"
+    close $fd
+
+    test {InfQ files - The crc64 is sent to the slaves checking it} {
+        infq_sync_file_header infq-crc
+    } {$file_block 0 5 crc:*}
+
+    test {InfQ files - The crc64 is not sent to the slaves not checking it} {
+        list [infq_sync_file_header {}] [infq_sync_file_header unknown-capa]
+    } {{$file_block 0 5} {$file_block 0 5}}
+
+    test {InfQ files - The crc64 known is not sent with repl-infq-checksum no} {
+        # the crc64 of the block is remembered by the master by now
+        r config set repl-infq-checksum no
+        set header [infq_sync_file_header infq-crc]
+        r config set repl-infq-checksum yes
+        set header
+    } {$file_block 0 5}
+}
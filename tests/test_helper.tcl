@@ -24,6 +24,7 @@ set ::all_tests {
     unit/type/set
     unit/type/zset
     unit/type/hash
+    unit/type/infq
     unit/sort
     unit/expire
     unit/other
@@ -35,6 +36,7 @@ set ::all_tests {
     integration/replication-3
     integration/replication-4
     integration/replication-psync
+    integration/replication-infq
     integration/aof
     integration/rdb
     integration/convert-zipmap-hash-on-load
@@ -46,6 +48,7 @@ set ::all_tests {
     unit/introspection
     unit/limits
     unit/obuf-limits
+    unit/io-threads
     unit/bitops
     unit/memefficiency
     unit/hyperloglog
@@ -474,6 +477,20 @@ proc attach_to_replication_stream {} {
         set buf [read $s $count]
         set count [expr {$count-[string length $buf]}]
     }
+
+    # The payload is followed by the InfQ files: attach with no InfQ in the
+    # dataset, so that only their header is sent.
+    set header [string trim [gets $s]]
+    if {$header ne {$infq_keys_to_send 0}} {
+        error "attach_to_replication_stream error. Received '$header' as InfQ header."
+    }
+
+    # Consume the newline bulk that ends the InfQ transfer.
+    set marker [gets $s]
+    read $s 3
+    if {[string trim $marker] ne {$1}} {
+        error "attach_to_replication_stream error. Received '$marker' as InfQ end marker."
+    }
     return $s
 }
 
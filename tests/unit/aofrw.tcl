@@ -77,7 +77,7 @@ start_server {tags {"aofrw"}} {
     }
 
     foreach d {string int} {
-        foreach e {ziplist linkedlist} {
+        foreach e {ziplist quicklist} {
             test "AOF rewrite of list with $e encoding, $d data" {
                 r flushall
                 if {$e eq {ziplist}} {set len 10} else {set len 1000}
@@ -0,0 +1,67 @@
+start_server {tags {"io-threads"} overrides {io-threads 4 io-threads-do-reads yes}} {
+    test {Many clients reading the same big value with I/O threads} {
+        set big [string repeat x 100000]
+        r set bigkey $big
+        r set small foo
+
+        set clients {}
+        for {set j 0} {$j < 20} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        # The big value does not fit the static buffer, so it goes in the
+        # reply lists of all the clients, followed by small replies.
+        for {set round 0} {$round < 50} {incr round} {
+            foreach rd $clients {
+                $rd get bigkey
+                $rd get small
+                $rd get bigkey
+            }
+            foreach rd $clients {
+                assert_equal $big [$rd read]
+                assert_equal foo [$rd read]
+                assert_equal $big [$rd read]
+            }
+        }
+        foreach rd $clients {
+            $rd close
+        }
+        assert {[s io_threaded_writes_processed] > 0}
+        r ping
+    } {PONG}
+
+    test {Reply lists share the values with I/O threads} {
+        set big [string repeat x 1000000]
+        r set bigkey $big
+        set rd [redis_deferring_client]
+        # Fill the socket buffers so that the replies stay queued.
+        for {set j 0} {$j < 20} {incr j} {
+            $rd get bigkey
+        }
+        # The queued replies reference the value instead of copying it.
+        wait_for_condition 50 100 {
+            [regexp {omem=([0-9]+)} [lindex [split [r client list] "\n"] 1] - omem] &&
+            $omem > 1000000 && [r object refcount bigkey] > 1
+        } else {
+            fail "Replies not queued in the client output buffer"
+        }
+        for {set j 0} {$j < 20} {incr j} {
+            assert_equal $big [$rd read]
+        }
+        $rd close
+        wait_for_condition 50 100 {
+            [r object refcount bigkey] == 1
+        } else {
+            fail "Written replies not released"
+        }
+    }
+
+    test {Protocol errors are replied with I/O threads} {
+        set s [socket [srv 0 host] [srv 0 port]]
+        fconfigure $s -translation binary
+        puts -nonewline $s "*3000000000\r\n"
+        flush $s
+        set reply [gets $s]
+        close $s
+        set reply
+    } {*Protocol error*}
+}
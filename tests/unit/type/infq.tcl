@@ -0,0 +1,599 @@
+start_server {tags {"infq"}} {
+    test {QRESERVE/QACK - Reserved elements are removed once acked} {
+        r del q
+        r qpush q a b
+        set reply [r qreserve q 2 10]
+        assert_equal {a b} [list [lindex $reply 1] [lindex $reply 3]]
+        list [r qack q [lindex $reply 0] [lindex $reply 2]] \
+             [r qack q [lindex $reply 0]] [r qreserve q 1 10]
+    } {2 0 {}}
+
+    test {QRESERVE - Leases are redelivered after the deadline} {
+        r del q
+        r qpush q a
+        set now 1000000
+        set first [r qreserve q 1 10 TIME $now]
+        assert_equal {} [r qreserve q 1 10 TIME [expr {$now+5000}]]
+        set again [r qreserve q 1 10 TIME [expr {$now+11000}]]
+        assert_equal a [lindex $again 1]
+        assert {[lindex $again 0] != [lindex $first 0]}
+        # The id of the expired lease can't ack the element anymore.
+        list [r qack q [lindex $first 0]] [r qack q [lindex $again 0]]
+    } {0 1}
+
+    test {QRESERVE - Leases expire in real time} {
+        r del q
+        r qpush q a
+        r qreserve q 1 1
+        after 1100
+        lindex [r qreserve q 1 10] 1
+    } {a}
+
+    test {QRESERVE - Leases survive DEBUG RELOAD} {
+        r del q
+        r qpush q a b
+        set first [r qreserve q 1 10]
+        r debug reload
+        set reply [r qreserve q 5 10]
+        assert_equal {b} [list [lindex $reply 1]]
+        assert_equal 2 [llength $reply]
+        r qack q [lindex $first 0]
+    } {1}
+
+    test {QPUSH - Expired elements are dropped on access} {
+        r del q
+        r qpush q PX 100 a
+        r qpush q b
+        after 200
+        list [r qpop q] [r qlen q]
+    } {b 0}
+
+    test {QPUSH - Dropped elements are propagated as QJPOP} {
+        r flushall
+        set repl [attach_to_replication_stream]
+        r qpush q PX 100 a
+        r qpush q b
+        after 200
+        r qpop q
+        assert_replication_stream $repl {
+            {select *}
+            {qpush q PXAT * a}
+            {qpush q b}
+            {qjpop q 1}
+            {qpop q}
+        }
+        close_replication_stream $repl
+    }
+
+    test {QPUSH - Expired elements are dropped by the cron without access} {
+        r flushall
+        set repl [attach_to_replication_stream]
+        r qpush q PX 100 a
+        after 1500
+        assert_replication_stream $repl {
+            {select *}
+            {qpush q PXAT * a}
+            {qjpop q 1}
+        }
+        close_replication_stream $repl
+        r qlen q
+    } {0}
+
+    test {QRPOPLPUSH - The expire of the element is kept} {
+        r del src dst
+        r qpush src PX 100000 a
+        r qpush dst b
+        catch {r qrpoplpush src dst} e
+        assert_match {*not expiring*} $e
+        list [r qlen src] [r qlen dst] [r qrpoplpush src fresh] [r qpop fresh]
+    } {1 1 a a}
+
+    test {QPUSH PRIORITY - Pops serve the highest lane first} {
+        r del q
+        r qpush q a
+        r qpush q PRIORITY 5 b
+        r qpush q PRIORITY 9 c
+        r qpush q PRIORITY 5 d
+        assert_equal {9 1 5 2 0 1} [r qlen q LANES]
+        list [r qpop q] [r qpop q] [r qpop q] [r qpop q] [r qlen q]
+    } {c b d a 0}
+
+    test {QPUSH PRIORITY - Lanes of a key named __lanes__} {
+        r del __lanes__ q
+        r qpush q PRIORITY 3 x
+        r qpush __lanes__ a
+        r qpush __lanes__ PRIORITY 3 b
+        list [r qpop __lanes__] [r qpop __lanes__] [r qpop q]
+    } {b a x}
+
+    test {QPUSH PRIORITY - Lanes survive DEBUG RELOAD} {
+        r del q
+        r qpush q a
+        r qpush q PRIORITY 5 b c
+        r debug reload
+        assert_equal {5 2 0 1} [r qlen q LANES]
+        list [r qpop q] [r qpop q] [r qpop q]
+    } {b c a}
+
+    test {QGROUP CREATE - Consumer groups can't read lanes} {
+        r del q
+        r qpush q PRIORITY 2 a
+        catch {r qgroup create q g1} e
+        assert_match {*priority lanes*} $e
+        r qgroup list q
+    } {}
+
+    test {QREAD - Every group reads all the elements, then they are popped} {
+        r del q
+        r qpush q a b c
+        r qgroup create q g1
+        r qgroup create q g2
+        list [r qread q g1 2] [r qread q g2 5] [r qread q g1 5] [r qlen q]
+    } {{a b} {a b c} c 0}
+
+    test {QGROUP - Group cursors survive DEBUG RELOAD} {
+        r del q
+        r qpush q a b c d
+        r qgroup create q g1
+        r qgroup create q g2
+        r qread q g1 2
+        r qread q g2 1
+        array set before [r qgroup list q]
+        r debug reload
+        array set after [r qgroup list q]
+        assert_equal [list $before(g1) $before(g2)] [list $after(g1) $after(g2)]
+        list $after(g1) $after(g2) [r qread q g1 5] [r qread q g2 1]
+    } {2 3 {c d} b}
+
+    test {QGROUP CREATE - Existing groups are not replaced} {
+        r del q
+        r qpush q a b
+        r qgroup create q g1
+        r qread q g1 1
+        catch {r qgroup create q g1} e
+        assert_match {*already exists*} $e
+        list [r qgroup list q] [r qread q g1 1]
+    } {{g1 1} b}
+
+    test {QPOP/QJPOP with count - Missing key} {
+        r del q
+        list [r qpop q 3] [r qjpop q 3] [r qpop q] [r exists q]
+    } {{} 0 {} 0}
+
+    test {QPOP/QJPOP with count - Count must be positive} {
+        r del q
+        r qpush q a
+        catch {r qpop q 0} e1
+        catch {r qjpop q -1} e2
+        list $e1 $e2 [r qlen q]
+    } {{*positive*} {*positive*} 1}
+
+    test {QPOP/QJPOP with count - Pop up to count elements} {
+        r del q
+        r qpush q a b c d e
+        list [r qpop q 2] [r qjpop q 2] [r qpop q 10] [r qpop q 10] [r qjpop q 10]
+    } {{a b} 2 e {} 0}
+
+    test {QPOP/QJPOP with count - BYTES limit} {
+        r del q
+        r qpush q aaaa bbbb cccc dddd eeee
+        # the first element is always popped, even if larger than the limit
+        list [r qpop q 10 BYTES 9] [r qpop q 10 BYTES 1] \
+             [r qjpop q 10 BYTES 8] [r qlen q]
+    } {{aaaa bbbb} cccc 2 0}
+
+    test {QPOP/QJPOP with count - Syntax errors} {
+        r del q
+        r qpush q a
+        catch {r qpop q 2 BYTES} e1
+        catch {r qpop q 2 FOO 3} e2
+        catch {r qjpop q 2 BYTES 0} e3
+        list $e1 $e2 $e3
+    } {{*syntax*} {*syntax*} {*positive*}}
+
+    test {BQPOP - Blocked client is served by QPUSH} {
+        r del q
+        set rd [redis_deferring_client]
+        $rd bqpop q 0
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "BQPOP didn't block"
+        }
+        r qpush q a b
+        set res [$rd read]
+        $rd close
+        list $res [r qlen q]
+    } {{q a} 1}
+
+    test {BQPOP - Pops the first non empty InfQ without blocking} {
+        r del q1 q2
+        r qpush q2 b
+        r bqpop q1 q2 1
+    } {q2 b}
+
+    test {BQPOP - Timeout} {
+        r del q
+        set rd [redis_deferring_client]
+        $rd bqpop q 1
+        after 1500
+        set res [$rd read]
+        $rd close
+        set res
+    } {}
+
+    test {BQPOPRPUSH - Blocked client is served by QPUSH} {
+        r del q target
+        set rd [redis_deferring_client]
+        $rd bqpoprpush q target 0
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "BQPOPRPUSH didn't block"
+        }
+        r qpush q a
+        set res [$rd read]
+        $rd close
+        list $res [r lrange target 0 -1] [r qlen q]
+    } {a a 0}
+
+    test {BQPOPRPUSH - Timeout} {
+        r del q target
+        set rd [redis_deferring_client]
+        $rd bqpoprpush q target 1
+        after 1500
+        set res [$rd read]
+        $rd close
+        list $res [r exists target]
+    } {{} 0}
+
+    test {BQPOP/BQPOPRPUSH - Served clients are propagated as QPOP/QPOPRPUSH} {
+        r flushall
+        set repl [attach_to_replication_stream]
+        set rd [redis_deferring_client]
+        $rd bqpop q 0
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "BQPOP didn't block"
+        }
+        r qpush q a
+        assert_equal {q a} [$rd read]
+        $rd bqpoprpush q target 0
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "BQPOPRPUSH didn't block"
+        }
+        r qpush q b
+        assert_equal b [$rd read]
+        $rd close
+        assert_replication_stream $repl {
+            {select *}
+            {qpush q a}
+            {qpop q}
+            {qpush q b}
+            {qpoprpush q target}
+        }
+        close_replication_stream $repl
+    }
+
+    test {BQPOP/BQPOPRPUSH - Don't block inside MULTI} {
+        r del q target
+        r multi
+        r bqpop q 0
+        r bqpoprpush q target 0
+        r qpush q a b
+        r bqpop q 0
+        r bqpoprpush q target 0
+        r exec
+    } {{} {} 2 {q a} b}
+
+    test {BQPOP and BLPOP blocked on different keys are both served} {
+        r del q list
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        $rd1 bqpop q 0
+        $rd2 blpop list 0
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 2
+        } else {
+            fail "Clients didn't block"
+        }
+        # both keys are signaled as ready by the same transaction
+        r multi
+        r rpush list a
+        r qpush q b
+        r exec
+        set res [list [$rd1 read] [$rd2 read]]
+        $rd1 close
+        $rd2 close
+        set res
+    } {{q b} {list a}}
+
+    test {BQPOP - Wrong type} {
+        r del q
+        r set q foo
+        catch {r bqpop q 1} e
+        set e
+    } {WRONGTYPE*}
+
+    test {AOF rewrite - Leases keep their ids and deadlines} {
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r del q
+        r qpush q a b c
+        set first [r qreserve q 1 100]
+        set second [r qreserve q 1 100]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        # the QACK logged after the rewrite matches the rewritten lease
+        assert_equal 1 [r qack q [lindex $first 0]]
+        r debug loadaof
+        set later [expr {[clock milliseconds]+200000}]
+        set res [list [r qack q [lindex $first 0]] [r qlen q] \
+                      [r qreserve q 5 100 TIME $later]]
+        r config set appendonly no
+        set res
+    } {0 1 {3 b 4 c}}
+
+    test {AOF rewrite - QRESTORELEASES checks the leases} {
+        r del q
+        r qcreate q
+        catch {r qrestoreleases q 5 1 1000} e1
+        catch {r qrestoreleases q 5 1 1000 a 1 2000 b} e2
+        catch {r qrestoreleases nokey 5 1 1000 a} e3
+        list $e1 $e2 $e3 [r qrestoreleases q 5 1 1000 a] \
+             [lindex [r qreserve q 1 10 TIME 2000] 0]
+    } {{*syntax*} {*already exists*} {*no such key*} OK 5}
+
+    test {QSCAN - Full scan} {
+        r del q
+        for {set j 0} {$j < 100} {incr j} {
+            r qpush q $j
+        }
+        set cursor 0
+        set elements {}
+        while 1 {
+            set res [r qscan q $cursor COUNT 7]
+            set cursor [lindex $res 0]
+            lappend elements {*}[lindex $res 1]
+            if {$cursor == 0} break
+        }
+        assert_equal 100 [llength $elements]
+        assert_equal [lsort -integer $elements] $elements
+        lindex $elements end
+    } {99}
+
+    test {QSCAN - Full scan of lanes} {
+        r del q
+        r qpush q a b
+        r qpush q PRIORITY 5 c d
+        r qpush q PRIORITY 2 e
+        set cursor 0
+        set elements {}
+        while 1 {
+            set res [r qscan q $cursor COUNT 1]
+            set cursor [lindex $res 0]
+            lappend elements {*}[lindex $res 1]
+            if {$cursor == 0} break
+        }
+        set elements
+    } {c d e a b}
+
+    test {QSCAN - Scan while popping and pushing} {
+        r del q
+        r qpush q a b c d e
+        set res [r qscan q 0 COUNT 2]
+        assert_equal {a b} [lindex $res 1]
+        # the popped elements are skipped, and the pushed ones visited
+        r qpop q 3
+        r qpush q f
+        set res [r qscan q [lindex $res 0] COUNT 10]
+        list [lindex $res 0] [lindex $res 1]
+    } {0 {d e f}}
+
+    test {QSCAN - Invalid cursor} {
+        r del q
+        r qpush q a b
+        catch {r qscan q foo} e1
+        catch {r qscan q 3} e2
+        catch {r qscan q 0 COUNT 0} e3
+        list $e1 $e2 $e3 [r qscan q 2]
+    } {{*invalid cursor*} {*invalid cursor*} {*syntax*} {0 {}}}
+
+    test {QSCAN - A cursor got before a reload is refused} {
+        r del q
+        r qpush q a b c d e f
+        r qpop q 4
+        set cursor [lindex [r qscan q 0 COUNT 1] 0]
+        assert_equal 5 $cursor
+        r debug reload
+        catch {r qscan q $cursor} e
+        set e
+    } {*invalid cursor*}
+
+    test {QCREATE - Options are reported by QCONFIG GET} {
+        r del q
+        r qcreate q BLOCKSIZE 4096 PUSHBLOCKS 2 POPBLOCKS 3 DUMPUSAGE 0.5
+        r qpush q a b
+        list [r qconfig q get] [r qpop q 2]
+    } {{blocksize 4096 pushblocks 2 popblocks 3 dumpusage 0.5 expiring 0} {a b}}
+
+    test {QCREATE - Errors} {
+        r del q x
+        r qcreate q
+        catch {r qcreate q} e1
+        catch {r qcreate x BLOCKSIZE 10} e2
+        catch {r qcreate x DUMPUSAGE 2} e3
+        catch {r qcreate x PUSHBLOCKS 0} e4
+        catch {r qcreate x FOO 1} e5
+        catch {r qcreate x BLOCKSIZE} e6
+        list $e1 $e2 $e3 $e4 $e5 $e6 [r exists x]
+    } {{*already exists*} {*BLOCKSIZE*} {*DUMPUSAGE*} {*positive*} {*syntax*} {*syntax*} 0}
+
+    test {QCONFIG - SET is deferred to the next load} {
+        r del q
+        r qcreate q BLOCKSIZE 4096
+        set reply [r qconfig q set POPBLOCKS 4 PUSHBLOCKS 5]
+        array set conf [r qconfig q get]
+        list $reply $conf(blocksize) $conf(pushblocks) $conf(popblocks)
+    } {DEFERRED 4096 5 4}
+
+    test {QCONFIG - Errors} {
+        r del q nokey
+        r set str foo
+        r qcreate q
+        catch {r qconfig nokey get} e1
+        catch {r qconfig str get} e2
+        catch {r qconfig q set BLOCKSIZE 1} e3
+        catch {r qconfig q foo} e4
+        list $e1 $e2 $e3 $e4
+    } {{*no such key*} {WRONGTYPE*} {*BLOCKSIZE*} {*syntax*}}
+
+    test {QCREATE/QCONFIG - Settings survive DEBUG RELOAD} {
+        r del q
+        r qcreate q EXPIRING BLOCKSIZE 4096 PUSHBLOCKS 2 POPBLOCKS 3 DUMPUSAGE 0.25
+        r qpush q a
+        r qconfig q set POPBLOCKS 6
+        r debug reload
+        list [r qconfig q get] [r qpop q]
+    } {{blocksize 4096 pushblocks 2 popblocks 6 dumpusage 0.25 expiring 1} a}
+
+    test {QCREATE/QCONFIG - Settings survive an AOF rewrite} {
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r del q
+        r qcreate q EXPIRING BLOCKSIZE 4096 PUSHBLOCKS 2 POPBLOCKS 3 DUMPUSAGE 0.25
+        r qpush q PX 100000 a
+        r qpush q b
+        r qconfig q set POPBLOCKS 6
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        set res [list [r qconfig q get] [r qpop q 2]]
+        r config set appendonly no
+        set res
+    } {{blocksize 4096 pushblocks 2 popblocks 6 dumpusage 0.25 expiring 1} {a b}}
+
+    test {INFO InfQ - Background jobs} {
+        r del q
+        r qpush q a
+        set info [r info infq]
+        foreach field {infq_busy_bg_executors infq_dump_jobs infq_load_jobs
+                       infq_unlink_jobs infq_suspended_unlinkers} {
+            assert_match "*$field:*" $info
+        }
+        regexp {infq_busy_bg_executors:([0-9]+)} $info - busy
+        regexp {infq_dump_jobs:([0-9]+)} $info - dump
+        regexp {infq_load_jobs:([0-9]+)} $info - load
+        regexp {infq_unlink_jobs:([0-9]+)} $info - unlink
+        # an executor is busy only if it has jobs
+        assert {$busy <= $dump + $load + $unlink}
+        assert {![string match *infq_bg_executors:* $info]}
+    }
+}
+
+start_server {tags {"infq"} overrides {infq-max-memory 1}} {
+    test {infq-max-memory - Idle InfQs over the budget are spilled} {
+        r qpush q1 a b c
+        r qpush q2 d e f
+        wait_for_condition 50 100 {
+            [s infq_spilled] == 2
+        } else {
+            fail "idle InfQs not spilled"
+        }
+        assert {[s infq_used_memory] > 0}
+        # spilling keeps the elements
+        list [r qpop q1 3] [r qpop q2 3]
+    } {{a b c} {d e f}}
+
+    test {infq-max-memory - InfQs are spilled again only once pushed} {
+        set spilled [s infq_spilled]
+        after 2100
+        assert_equal $spilled [s infq_spilled]
+        r qpush q1 g h
+        wait_for_condition 50 100 {
+            [s infq_spilled] == $spilled + 1
+        } else {
+            fail "pushed InfQ not spilled"
+        }
+    }
+}
+
+start_server {tags {"infq"}} {
+    test {infq-max-memory - Nothing is spilled without a budget} {
+        r qpush q a b c
+        after 2100
+        s infq_spilled
+    } {0}
+}
+
+start_server {tags {"infq"} overrides {infq-element-encoding lzf}} {
+    set json [string repeat {{"id":12345,"name":"infq","tags":["a","b"]},} 50]
+
+    test {infq-element-encoding lzf - Elements are pushed and popped back} {
+        r del q
+        r qpush q $json short 12345 {}
+        list [r object encoding q] [r qlen q] [r qat q 0] \
+             [r qrange q 1 -1] [r qpop q 4]
+    } [list infqlzf 4 $json {short 12345 {}} [list $json short 12345 {}]]
+
+    test {infq-element-encoding lzf - Elements survive a reload} {
+        r del q
+        r qpush q $json short
+        r debug reload
+        list [r object encoding q] [r qpop q 2]
+    } [list infqlzf [list $json short]]
+
+    test {infq-element-encoding lzf - Expiring elements} {
+        r del q
+        r qpush q EX 100 $json
+        r qpush q short
+        r debug reload
+        r qpop q 2
+    } [list $json short]
+
+    test {infq-element-encoding lzf - QRPOPLPUSH and AOF rewrite} {
+        r del q dst
+        r qpush q $json short
+        r qrpoplpush q dst
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        r config set appendonly no
+        list [r object encoding dst] [r qpop dst] [r qpop q]
+    } [list infqlzf $json short]
+}
+
+set server_path [tmpdir "server.infq-lzf-test"]
+
+start_server [list tags {"infq"} overrides [list dir $server_path infq-element-encoding lzf]] {
+    set json [string repeat {{"id":12345,"name":"infq"},} 50]
+    r qpush q $json
+    set pid [s process_id]
+}
+
+# the elements are dumped by the infQ library, corrupt the last byte of the
+# element in the last dump, saved at shutdown, if it can be found
+set dumps [glob -nocomplain /tmp/infqstub-dumps/$pid-*]
+if {[llength $dumps] > 0} {
+    set dump [lindex [lsort -dictionary $dumps] end]
+    set fd [open $dump r+]
+    fconfigure $fd -translation binary
+    seek $fd -1 end
+    binary scan [read $fd 1] c byte
+    seek $fd -1 end
+    puts -nonewline $fd [binary format c [expr {$byte ^ 0xff}]]
+    close $fd
+
+    start_server [list tags {"infq"} overrides [list dir $server_path infq-element-encoding lzf]] {
+        test {infq-element-encoding lzf - A corrupted element is refused} {
+            assert_equal 1 [r qlen q]
+            catch {r qpop q} err
+            set err
+        } {ERR*}
+    }
+}
@@ -77,3 +77,80 @@ start_server {
         }
     }
 }
+
+start_server {
+    tags {list quicklist}
+    overrides {
+        "list-max-ziplist-value" 64
+        "list-max-ziplist-entries" 4
+        "list-compress-depth" 1
+    }
+} {
+    test {quicklist implementation: nodes are compressed except the ends} {
+        r del l
+        for {set i 0} {$i < 100} {incr i} {
+            r rpush l [string repeat "element:$i " 10]
+        }
+        assert_encoding quicklist l
+        set info [r debug object l]
+        assert_match {*ql_nodes:25 *} $info
+        assert_match {*ql_compressed:23 *} $info
+        assert_equal [string repeat "element:50 " 10] [r lindex l 50]
+        assert_equal [string repeat "element:99 " 10] [r lindex l -1]
+        r debug reload
+        assert_match {*ql_compressed:23 *} [r debug object l]
+        assert_equal [string repeat "element:50 " 10] [r lindex l 50]
+    }
+
+    tags {slow} {
+        test {quicklist implementation: stress testing with compression} {
+            for {set j 0} {$j < 50} {incr j} {
+                r del l
+                set l {}
+                for {set i 0} {$i < 300} {incr i} {
+                    set rv [randomValue]
+                    randpath {
+                        lappend l $rv
+                        r rpush l $rv
+                    } {
+                        set l [concat [list $rv] $l]
+                        r lpush l $rv
+                    } {
+                        if {[llength $l]} {
+                            set l [lrange $l 1 end]
+                            r lpop l
+                        }
+                    } {
+                        if {[llength $l]} {
+                            set idx [randomInt [llength $l]]
+                            set l [lreplace $l $idx $idx $rv]
+                            r lset l $idx $rv
+                        }
+                    } {
+                        if {[llength $l]} {
+                            set idx [randomInt [llength $l]]
+                            set pivot [lindex $l [lsearch -exact $l [lindex $l $idx]]]
+                            set l [linsert $l [lsearch -exact $l $pivot] $rv]
+                            r linsert l before $pivot $rv
+                        }
+                    } {
+                        if {[llength $l] > 10} {
+                            set l [lrange $l 2 end-2]
+                            r ltrim l 2 -3
+                        }
+                    }
+                }
+                assert_equal $l [r lrange l 0 -1]
+                if {[llength $l]} {
+                    set ele [lindex $l [randomInt [llength $l]]]
+                    set removed [llength [lsearch -all -exact $l $ele]]
+                    set l [lsearch -all -inline -not -exact $l $ele]
+                    assert_equal $removed [r lrem l 0 $ele]
+                    assert_equal $l [r lrange l 0 -1]
+                }
+            }
+            r debug reload
+            assert_equal $l [r lrange l 0 -1]
+        }
+    }
+}
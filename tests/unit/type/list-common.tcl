@@ -2,4 +2,4 @@
 # the list has the right encoding when it is swapped in again.
 array set largevalue {}
 set largevalue(ziplist) "hello"
-set largevalue(linkedlist) [string repeat "hello" 4]
+set largevalue(quicklist) [string repeat "hello" 4]
@@ -37,29 +37,29 @@ start_server {
 
     test {LPUSH, RPUSH, LLENGTH, LINDEX, LPOP - regular list} {
         # first lpush then rpush
-        assert_equal 1 [r lpush mylist1 $largevalue(linkedlist)]
-        assert_encoding linkedlist mylist1
+        assert_equal 1 [r lpush mylist1 $largevalue(quicklist)]
+        assert_encoding quicklist mylist1
         assert_equal 2 [r rpush mylist1 b]
         assert_equal 3 [r rpush mylist1 c]
         assert_equal 3 [r llen mylist1]
-        assert_equal $largevalue(linkedlist) [r lindex mylist1 0]
+        assert_equal $largevalue(quicklist) [r lindex mylist1 0]
         assert_equal b [r lindex mylist1 1]
         assert_equal c [r lindex mylist1 2]
         assert_equal {} [r lindex mylist1 3]
         assert_equal c [r rpop mylist1]
-        assert_equal $largevalue(linkedlist) [r lpop mylist1]
+        assert_equal $largevalue(quicklist) [r lpop mylist1]
 
         # first rpush then lpush
-        assert_equal 1 [r rpush mylist2 $largevalue(linkedlist)]
-        assert_encoding linkedlist mylist2
+        assert_equal 1 [r rpush mylist2 $largevalue(quicklist)]
+        assert_encoding quicklist mylist2
         assert_equal 2 [r lpush mylist2 b]
         assert_equal 3 [r lpush mylist2 c]
         assert_equal 3 [r llen mylist2]
         assert_equal c [r lindex mylist2 0]
         assert_equal b [r lindex mylist2 1]
-        assert_equal $largevalue(linkedlist) [r lindex mylist2 2]
+        assert_equal $largevalue(quicklist) [r lindex mylist2 2]
         assert_equal {} [r lindex mylist2 3]
-        assert_equal $largevalue(linkedlist) [r rpop mylist2]
+        assert_equal $largevalue(quicklist) [r rpop mylist2]
         assert_equal c [r lpop mylist2]
     }
 
@@ -92,10 +92,10 @@ start_server {
         assert_encoding ziplist $key
     }
 
-    proc create_linkedlist {key entries} {
+    proc create_quicklist {key entries} {
         r del $key
         foreach entry $entries { r rpush $key $entry }
-        assert_encoding linkedlist $key
+        assert_encoding quicklist $key
     }
 
     foreach {type large} [array get largevalue] {
@@ -548,43 +548,43 @@ start_server {
     } {*ERR*syntax*error*}
 
     test {LPUSHX, RPUSHX convert from ziplist to list} {
-        set large $largevalue(linkedlist)
+        set large $largevalue(quicklist)
 
         # convert when a large value is pushed
         create_ziplist xlist a
         assert_equal 2 [r rpushx xlist $large]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
         create_ziplist xlist a
         assert_equal 2 [r lpushx xlist $large]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
 
         # convert when the length threshold is exceeded
         create_ziplist xlist [lrepeat 256 a]
         assert_equal 257 [r rpushx xlist b]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
         create_ziplist xlist [lrepeat 256 a]
         assert_equal 257 [r lpushx xlist b]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
     }
 
     test {LINSERT convert from ziplist to list} {
-        set large $largevalue(linkedlist)
+        set large $largevalue(quicklist)
 
         # convert when a large value is inserted
         create_ziplist xlist a
         assert_equal 2 [r linsert xlist before a $large]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
         create_ziplist xlist a
         assert_equal 2 [r linsert xlist after a $large]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
 
         # convert when the length threshold is exceeded
         create_ziplist xlist [lrepeat 256 a]
         assert_equal 257 [r linsert xlist before a a]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
         create_ziplist xlist [lrepeat 256 a]
         assert_equal 257 [r linsert xlist after a a]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
 
         # don't convert when the value could not be inserted
         create_ziplist xlist [lrepeat 256 a]
@@ -595,7 +595,7 @@ start_server {
         assert_encoding ziplist xlist
     }
 
-    foreach {type num} {ziplist 250 linkedlist 500} {
+    foreach {type num} {ziplist 250 quicklist 500} {
         proc check_numbered_list_consistency {key} {
             set len [r llen $key]
             for {set i 0} {$i < $len} {incr i} {
@@ -690,8 +690,8 @@ start_server {
 
                 # When we rpoplpush'ed a large value, dstlist should be
                 # converted to the same encoding as srclist.
-                if {$type eq "linkedlist"} {
-                    assert_encoding linkedlist dstlist
+                if {$type eq "quicklist"} {
+                    assert_encoding quicklist dstlist
                 }
             }
         }
@@ -745,7 +745,7 @@ start_server {
         assert_error WRONGTYPE* {r rpop notalist}
     }
 
-    foreach {type num} {ziplist 250 linkedlist 500} {
+    foreach {type num} {ziplist 250 quicklist 500} {
         test "Mass RPOP/LPOP - $type" {
             r del mylist
             set sum1 0